@@ -14,10 +14,22 @@ newoption {
    description = "Choose a dialog backend for linux",
    allowed = {
       { "gtk3", "GTK 3 - link to gtk3 directly" },      
-      { "zenity", "Zenity - generate dialogs on the end users machine with zenity" }
+      { "zenity", "Zenity - generate dialogs on the end users machine with zenity" },
+      { "gtk3_server", "GTK 3 server - run GTK dialogs in a resident nfd-server process" },
+      { "headless", "Headless - answer dialogs from a callback or NFD_HEADLESS_SCRIPT, for tests and CI" }
    }
 }
 
+newoption {
+   trigger     = "compact_pathset",
+   description = "Store multiple selections in a single length-aware allocation"
+}
+
+newoption {
+   trigger     = "usdt",
+   description = "Build in USDT probes for bpftrace and perf (needs sys/sdt.h)"
+}
+
 if not _OPTIONS["linux_backend"] then
    _OPTIONS["linux_backend"] = "gtk3"
 end
@@ -93,6 +105,18 @@ workspace "NativeFileDialog"
     filter {"system:linux", "options:linux_backend=zenity"}
       language "C"
       files {root_dir.."src/nfd_zenity.c"}
+    filter {"system:linux", "options:linux_backend=gtk3_server"}
+      language "C"
+      files {root_dir.."src/nfd_gtkserver.c"}
+    filter {"system:linux", "options:linux_backend=headless"}
+      language "C"
+      files {root_dir.."src/nfd_headless.c"}
+
+    filter "options:compact_pathset"
+      defines {"NFD_COMPACT_PATHSET"}
+
+    filter {"system:linux", "options:usdt"}
+      defines {"NFD_USDT"}
 
 
     -- visual studio filters
@@ -130,16 +154,16 @@ local make_test = function(name)
 
     filter {"configurations:Release", "system:linux", "options:linux_backend=gtk3"}
       linkoptions {"-lnfd `pkg-config --libs gtk+-3.0`"}
-    filter {"configurations:Release", "system:linux", "options:linux_backend=zenity"}
-      linkoptions {"-lnfd"}
+    filter {"configurations:Release", "system:linux", "options:linux_backend=zenity or linux_backend=gtk3_server or linux_backend=headless"}
+      linkoptions {"-lnfd -pthread"}
 
     filter {"system:macosx"}
       links {"Foundation.framework", "AppKit.framework"}
       
     filter {"configurations:Debug", "system:linux", "options:linux_backend=gtk3"}
       linkoptions {"-lnfd_d `pkg-config --libs gtk+-3.0`"}
-    filter {"configurations:Debug", "system:linux", "options:linux_backend=zenity"}
-      linkoptions {"-lnfd_d"}
+    filter {"configurations:Debug", "system:linux", "options:linux_backend=zenity or linux_backend=gtk3_server or linux_backend=headless"}
+      linkoptions {"-lnfd_d -pthread"}
 
 
 
@@ -152,6 +176,93 @@ make_test("test_pickfolder")
 make_test("test_opendialog")
 make_test("test_opendialogmultiple")
 make_test("test_savedialog")
+make_test("test_trace")
+
+-- asynchronous dialogs are only implemented by the zenity backend
+if _OPTIONS["linux_backend"] == "zenity" then
+  make_test("test_opendialogasync")
+end
+
+-- first dialog latency with and without NFD_InitAsync, dialog pool
+-- reuse and leaks, dialogs answered through XTest, and cancelling
+-- from another thread, under Xvfb
+if os.istarget("linux") and _OPTIONS["linux_backend"] == "gtk3" then
+  make_test("bench_gtkinit")
+  make_test("bench_gtkpool")
+  make_test("bench_gtkdialog")
+    filter {}
+    links {"X11", "Xtst", "Xfixes", "pthread"}
+  make_test("bench_gtkcancel")
+    filter {}
+    links {"pthread"}
+end
+
+-- the gtk3_server backend runs its dialogs in nfd-server, which links
+-- GTK so that the host does not have to
+if _OPTIONS["linux_backend"] == "gtk3_server" then
+  project "nfd-server"
+    kind "ConsoleApp"
+    language "C"
+    targetdir(build_dir.."/bin")
+    files {root_dir.."src/nfd_server.c",
+           root_dir.."src/nfd_gtk.c",
+           root_dir.."src/nfd_common.c",
+    }
+    includedirs {root_dir.."src/include/"}
+    buildoptions {"`pkg-config --cflags gtk+-3.0`"}
+    linkoptions {"`pkg-config --libs gtk+-3.0`"}
+    warnings "extra"
+
+    filter {"options:usdt"}
+      defines {"NFD_USDT"}
+
+    -- the backend runs nfd-server by name
+    filter {"configurations:Debug"}
+      targetsuffix ""
+end
+
+-- benchmarks use POSIX timers
+if not os.istarget("windows") then
+  make_test("bench_pathparser")
+  make_test("bench_filter")
+  make_test("bench_match")
+  make_test("bench_glob")
+  make_test("bench_utf8")
+  make_test("bench_context")
+    filter {}
+    links {"pthread"}
+  make_test("bench_capture")
+  make_test("bench_spawn")
+  make_test("bench_spawnfds")
+  make_test("bench_headless")
+    filter {}
+    links {"pthread"}
+end
+
+-- bench_nfd times the zenity backend against fake_zenity, which is
+-- built as zenity in a directory of its own so that PATH finds it, and
+-- bench_cancel cancels dialogs that fake_zenity keeps open
+if _OPTIONS["linux_backend"] == "zenity" then
+  project "fake_zenity"
+    kind "ConsoleApp"
+    language "C"
+    targetdir(build_dir.."/bin/fake_zenity")
+    targetname "zenity"
+    files {root_dir.."test/fake_zenity.c"}
+    warnings "extra"
+
+    filter {"configurations:Debug"}
+      targetsuffix ""
+
+  make_test("bench_nfd")
+    filter {}
+    dependson {"fake_zenity"}
+
+  make_test("bench_cancel")
+    filter {}
+    dependson {"fake_zenity"}
+    links {"pthread"}
+end
 
 newaction
 {
@@ -164,7 +275,7 @@ newaction
          local premake_dir
          if special then
             if args['linux_backend'] ~= nil then
-               premake_dir = "./"..action.."_"..os_str..'_zenity'
+               premake_dir = "./"..action.."_"..os_str..'_'..args['linux_backend']
             else
                premake_dir = "./"..action.."_"..os_str
             end
@@ -192,6 +303,8 @@ newaction
       premake_do_action("xcode4", "macosx", false,{})
       premake_do_action("gmake", "linux", true,{})
       premake_do_action("gmake", "linux", true,{linux_backend='zenity'})
+      premake_do_action("gmake", "linux", true,{linux_backend='gtk3_server'})
+      premake_do_action("gmake", "linux", true,{linux_backend='headless'})
       premake_do_action("gmake", "macosx", true,{})
       premake_do_action("gmake", "windows", true,{})
    end
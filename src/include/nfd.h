@@ -15,6 +15,7 @@ extern "C" {
 #endif
 
 #include <stddef.h>
+#include <stdint.h>
 
 /* denotes UTF-8 char */
 typedef char nfdchar_t;
@@ -22,15 +23,96 @@ typedef char nfdchar_t;
 /* opaque data structure -- see NFD_PathSet_* */
 typedef struct {
     nfdchar_t *buf;
-    size_t *indices; /* byte offsets into buf */
+    size_t *indices; /* byte offsets into buf, NULL if buf is compact */
     size_t count;    /* number of indices into buf */
 }nfdpathset_t;
 
+/* opaque handle to a dialog that is still open -- see NFD_Handle_* */
+typedef struct nfdhandle_s nfdhandle_t;
+
+/* opaque parsed filter list -- see NFD_Filter_* */
+typedef struct nfdfilter_s nfdfilter_t;
+
+/* the steps of a dialog reported to a hook set with NFD_SetTraceHook */
+typedef enum {
+    NFD_PHASE_INIT,          /* starting the backend: gtk_init_check, the
+                                zenity launcher, connecting to nfd-server */
+    NFD_PHASE_FILTER_BUILD,  /* compiling a filter list and building the
+                                backend's filters or arguments from it */
+    NFD_PHASE_SPAWN,         /* starting zenity or nfd-server */
+    NFD_PHASE_SHOW,          /* creating or resetting the dialog until its
+                                window is mapped */
+    NFD_PHASE_USER_WAIT,     /* the dialog is up, waiting for the user */
+    NFD_PHASE_CAPTURE,       /* reading zenity's or nfd-server's output */
+    NFD_PHASE_PARSE,         /* splitting and validating returned paths */
+    NFD_PHASE_ALLOC,         /* allocating and filling the returned paths */
+    NFD_PHASE_CLEANUP,       /* hiding the dialog, reaping zenity */
+    NFD_PHASE_COUNT
+}nfdphase_t;
+
+/* called as each phase ends, on the thread that ran it, with monotonic
+   start and end times in nanoseconds */
+typedef void (*nfdtracefn_t)( nfdphase_t phase, uint64_t startNs, uint64_t endNs, void *userData );
+
+/* the kind of dialog a headless callback is asked to answer */
+typedef enum {
+    NFD_DIALOG_OPEN,
+    NFD_DIALOG_OPEN_MULTIPLE,
+    NFD_DIALOG_SAVE,
+    NFD_DIALOG_PICK_FOLDER
+}nfddialogtype_t;
+
+/* what dialog calls cost -- see NFD_GetStats */
+typedef struct {
+    uint64_t calls;             /* outermost NFD_* dialog and init calls */
+    uint64_t allocs;            /* allocations and reallocations by nfd */
+    uint64_t allocBytes;        /* bytes they asked for */
+    uint64_t peakPathSetBytes;  /* the largest path set allocated */
+    uint64_t captureReallocs;   /* times captured output outgrew its buffer */
+    uint64_t reads;             /* read() calls on zenity's or nfd-server's output */
+    uint64_t spawnNs;           /* time spent starting zenity or nfd-server */
+    uint64_t paths;             /* paths returned */
+}nfdstatcounts_t;
+
+typedef struct {
+    nfdstatcounts_t lastCall;   /* the calling thread's last dialog call */
+    nfdstatcounts_t total;      /* everything since the process started */
+}nfdstats_t;
+
+/* opaque error, allocator and timeout state -- see NFD_Context_* */
+typedef struct nfdcontext_s nfdcontext_t;
+
+/* allocation functions -- see NFD_SetAllocator */
+typedef void *(*nfdallocfn_t)( size_t bytes, void *userData );
+typedef void  (*nfdfreefn_t)( void *ptr, void *userData );
+
 typedef enum {
     NFD_ERROR,       /* programmatic error */
     NFD_OKAY,        /* user pressed okay, or successful return */
     NFD_CANCEL       /* user pressed cancel */
 }nfdresult_t;
+
+/* what went wrong when nfdresult_t returns NFD_ERROR */
+typedef enum {
+    NFD_ERR_NONE,           /* no error yet */
+    NFD_ERR_PLATFORM,       /* the dialog or the backend failed */
+    NFD_ERR_OUT_OF_MEMORY,  /* an allocation failed */
+    NFD_ERR_UNAVAILABLE,    /* the backend could not start: no zenity,
+                               no display for GTK, no nfd-server */
+    NFD_ERR_INVALID_UTF8,   /* the dialog returned a path that is not UTF-8 */
+    NFD_ERR_USAGE           /* a function was called the wrong way */
+}nfderror_t;
+
+/* Answers a dialog without showing it -- see NFD_Headless_SetCallback.
+   filterList is the dialog's filter list, or NULL.  Set *outPaths to
+   the chosen paths separated by '|' and return NFD_OKAY, or to an error
+   message for NFD_ERROR.  The string must stay valid until the callback
+   is next called. */
+typedef nfdresult_t (*nfdheadlessfn_t)( nfddialogtype_t type,
+                                        const nfdchar_t *filterList,
+                                        const nfdchar_t *defaultPath,
+                                        const nfdchar_t **outPaths,
+                                        void *userData );
     
 
 /* nfd_<targetplatform>.c */
@@ -55,14 +137,186 @@ nfdresult_t NFD_SaveDialog( const nfdchar_t *filterList,
 nfdresult_t NFD_PickFolder( const nfdchar_t *defaultPath,
                             nfdchar_t **outPath);
 
+/* The dialogs above, taking a filter list compiled with
+   NFD_Filter_Compile instead of a string.  The filter keeps what the
+   backend builds from it, so dialogs that share a filter only pay for
+   parsing it once.  filter may be NULL for no filter. */
+nfdresult_t NFD_OpenDialogF( nfdfilter_t *filter,
+                             const nfdchar_t *defaultPath,
+                             nfdchar_t **outPath );
+
+nfdresult_t NFD_OpenDialogMultipleF( nfdfilter_t *filter,
+                                     const nfdchar_t *defaultPath,
+                                     nfdpathset_t *outPaths );
+
+nfdresult_t NFD_SaveDialogF( nfdfilter_t *filter,
+                             const nfdchar_t *defaultPath,
+                             nfdchar_t **outPath );
+
+/* optional -- prepare the backend before the first dialog, so that it
+   opens as quickly as later ones.
+
+   GTK: initializes GTK and loads the file chooser and icon theme.
+   Zenity: forks a small launcher process that starts every later
+   dialog, so the fork happens while the host is still small.  Call it
+   before the host starts threads.  Dialogs see the environment as it
+   was at this call.
+   GTK server: starts nfd-server.
+   Windows and MacOS: does nothing. */
+nfdresult_t NFD_Init( void );
+/* on GTK, starts loading what the first dialog needs that is safe to
+   load off the GTK thread -- GIO modules, the MIME database and the
+   font cache -- on a background thread, and returns at once.  GTK is
+   still initialized by NFD_Init or the first dialog, on the calling
+   thread.  The same as NFD_Init elsewhere. */
+nfdresult_t NFD_InitAsync( void );
+/* release what NFD_Init set up; dialogs already open are not affected */
+void        NFD_Quit( void );
+
+/* nfd_zenity.c only -- dialogs that do not block the calling thread.
+
+   Wait for the fd from NFD_Handle_GetFd to become readable, then call
+   NFD_Handle_Poll.  Once it returns non-zero the dialog has closed;
+   collect the result with NFD_Handle_Finish, or
+   NFD_Handle_FinishMultiple for NFD_OpenDialogMultipleAsync.  Finishing
+   frees the handle, and blocks if the dialog is still open. */
+
+nfdresult_t NFD_OpenDialogAsync( const nfdchar_t *filterList,
+                                 const nfdchar_t *defaultPath,
+                                 nfdhandle_t **outHandle );
+
+nfdresult_t NFD_OpenDialogMultipleAsync( const nfdchar_t *filterList,
+                                         const nfdchar_t *defaultPath,
+                                         nfdhandle_t **outHandle );
+
+nfdresult_t NFD_SaveDialogAsync( const nfdchar_t *filterList,
+                                 const nfdchar_t *defaultPath,
+                                 nfdhandle_t **outHandle );
+
+nfdresult_t NFD_PickFolderAsync( const nfdchar_t *defaultPath,
+                                 nfdhandle_t **outHandle );
+
+/* fd that becomes readable when the dialog has output or has exited */
+int         NFD_Handle_GetFd( const nfdhandle_t *handle );
+/* non-zero once the dialog has closed; never blocks */
+int         NFD_Handle_Poll( nfdhandle_t *handle );
+/* collect the result of a single path dialog and free the handle */
+nfdresult_t NFD_Handle_Finish( nfdhandle_t *handle, nfdchar_t **outPath );
+/* collect the result of a multiple selection dialog and free the handle */
+nfdresult_t NFD_Handle_FinishMultiple( nfdhandle_t *handle, nfdpathset_t *outPaths );
+/* close the dialog if it is still open, as though the user pressed
+   cancel.  Safe to call while another thread waits in
+   NFD_Handle_Finish, but not after it returns. */
+void        NFD_Cancel( nfdhandle_t *handle );
+/* cancel the dialog once it has been open for timeoutMs; 0 disables.
+   Replaces the timeout set by NFD_SetTimeout for this handle. */
+void        NFD_Handle_SetTimeout( nfdhandle_t *handle, int timeoutMs );
+
 /* nfd_common.c */
 
-/* get last error -- set when nfdresult_t returns NFD_ERROR */
+/* headless dialogs -- answered from a callback or a script instead of
+   being shown, for tests and benchmarks on machines without a display.
+   The filter list is still compiled and the returned paths go through
+   the same parsing, validation and allocation as a real dialog's.
+
+   The headless backend (premake5 --linux_backend=headless) answers
+   every dialog this way.  The other Linux backends do too once a
+   callback is set, or when NFD_HEADLESS_SCRIPT names a script file as
+   the first dialog opens, though zenity's async dialogs still run
+   zenity; Windows and MacOS always show real dialogs.  A
+   script answers one dialog per line, in order, starting over after
+   the last:
+
+       okay /home/user/a.png
+       okay /home/user/a.png|/home/user/b.png
+       cancel
+       error no disk in drive A:
+
+   Blank lines and lines starting with '#' are skipped.  Without a
+   callback or a script, the headless backend cancels every dialog. */
+void        NFD_Headless_SetCallback( nfdheadlessfn_t callback, void *userData );
+
+/* get last error -- set when nfdresult_t returns NFD_ERROR.  Each
+   thread has its own, or that of the context bound to it. */
 const char *NFD_GetError( void );
+nfderror_t  NFD_GetErrorCode( void );
+/* GTK and zenity only -- dialogs opened after this call close on their
+   own and return NFD_CANCEL after timeoutMs.  0, the default, waits
+   forever. */
+void        NFD_SetTimeout( int timeoutMs );
+/* nfd_gtk.c only -- close the dialogs that are open, from any thread,
+   as though the user pressed cancel; they return NFD_CANCEL.  Dialogs
+   opened after the call are not affected. */
+void        NFD_CancelDialogs( void );
+/* make every allocation nfd does call allocFn and freeFn, with
+   userData, instead of malloc and free.  That includes the paths the
+   dialogs return, which the caller then releases with freeFn.  NULL for
+   both restores malloc and free.  Call it before anything is allocated
+   under the previous functions, or after all of it has been freed. */
+void        NFD_SetAllocator( nfdallocfn_t allocFn, nfdfreefn_t freeFn, void *userData );
+
+/* Contexts let independent parts of a program use nfd from their own
+   threads at once.  A context holds the last error and its code, and
+   the allocator and timeout used while it is bound to a thread; it
+   starts with those set by NFD_SetAllocator and NFD_SetTimeout.
+   NFD_SetThreadContext binds one to the calling thread and returns the
+   one bound before, or NULL for the thread's own error and the
+   defaults.  Anything allocated while a context is bound, such as a
+   returned path or a compiled filter, must be freed while it is bound
+   again.  A context may be bound to one thread at a time.  Async
+   handles keep the context they were opened in.  Contexts themselves
+   are allocated with the NFD_SetAllocator functions. */
+nfdresult_t   NFD_Context_Create( nfdcontext_t **outContext );
+/* free a context that is not bound to any thread */
+void          NFD_Context_Free( nfdcontext_t *context );
+void          NFD_Context_SetAllocator( nfdcontext_t *context, nfdallocfn_t allocFn,
+                                        nfdfreefn_t freeFn, void *userData );
+void          NFD_Context_SetTimeout( nfdcontext_t *context, int timeoutMs );
+const char   *NFD_Context_GetError( const nfdcontext_t *context );
+nfderror_t    NFD_Context_GetErrorCode( const nfdcontext_t *context );
+nfdcontext_t *NFD_SetThreadContext( nfdcontext_t *context );
+
+/* Report how long each phase of every dialog takes to hook, or stop
+   reporting with NULL.  Phases nest: a parse phase contains the alloc
+   phase of the path set it fills, and capture phases happen during
+   user_wait.  The Linux backends report every phase that applies to
+   them; Windows and MacOS report only the filter and path phases that
+   nfd does itself.  The hook may be called from several threads, and
+   should be set while no dialog is open.  Without a hook, a phase
+   costs a call and a branch. */
+void        NFD_SetTraceHook( nfdtracefn_t hook, void *userData );
+/* "init", "filter_build", "spawn", "show", "user_wait", "capture",
+   "parse", "alloc" or "cleanup" */
+const char *NFD_GetPhaseName( nfdphase_t phase );
+/* Fill outStats with the resources used by the calling thread's last
+   dialog call and by every call so far.  A call that runs others, such
+   as NFD_OpenDialog running NFD_Handle_Finish on zenity, counts once
+   with everything it did; an async dialog counts as its start and its
+   finish.  Totals also include work outside dialog calls, such as
+   NFD_Filter_Compile.  Counting is always on, with relaxed atomic adds
+   for the totals.  The Linux backends count every field; Windows and
+   MacOS only count allocations, in total. */
+void        NFD_GetStats( nfdstats_t *outStats );
+/* parse a filter list such as "png,jpg;pdf" once, for any number of
+   NFD_*DialogF calls.  A filter must not be used by two threads at
+   once. */
+nfdresult_t NFD_Filter_Compile( const nfdchar_t *filterList, nfdfilter_t **outFilter );
+/* free a compiled filter once no dialog is using it */
+void        NFD_Filter_Free( nfdfilter_t *filter );
+/* set outMask[i] to 1 if path i of pathSet has one of filter's
+   extensions or matches one of its globs, else 0.  outMask holds
+   NFD_PathSet_GetCount entries.  ASCII case is always ignored; every
+   path matches a NULL or empty filter. */
+nfdresult_t NFD_Filter_MatchPathSet( nfdfilter_t *filter,
+                                     const nfdpathset_t *pathSet,
+                                     unsigned char *outMask );
 /* get the number of entries stored in pathSet */
 size_t      NFD_PathSet_GetCount( const nfdpathset_t *pathSet );
 /* Get the UTF-8 path at offset index */
 nfdchar_t  *NFD_PathSet_GetPath( const nfdpathset_t *pathSet, size_t index );
+/* Get the UTF-8 path at offset index, and its length in bytes, not
+   counting the null terminator, in outLen */
+nfdchar_t  *NFD_PathSet_GetPathN( const nfdpathset_t *pathSet, size_t index, size_t *outLen );
 /* Free the pathSet */    
 void        NFD_PathSet_Free( nfdpathset_t *pathSet );
 
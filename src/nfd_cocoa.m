@@ -8,35 +8,21 @@
 #include "nfd.h"
 #include "nfd_common.h"
 
-static NSArray *BuildAllowedFileTypes( const char *filterList )
+static NSArray *BuildAllowedFileTypes( const nfdfilter_t *filter )
 {
-    // Commas and semicolons are the same thing on this platform
+    // Commas and semicolons are the same thing on this platform, and
+    // only extensions can be allowed, so globs are left out
 
     NSMutableArray *buildFilterList = [[NSMutableArray alloc] init];
 
-    char typebuf[NFD_MAX_STRLEN] = {0};
-    
-    size_t filterListLen = strlen(filterList);
-    char *p_typebuf = typebuf;
-    for ( size_t i = 0; i < filterListLen+1; ++i )
+    for ( size_t i = 0; i < filter->specCount; ++i )
     {
-        if ( filterList[i] == ',' || filterList[i] == ';' || filterList[i] == '\0' )
-        {
-            if (filterList[i] != '\0')
-                ++p_typebuf;
-            *p_typebuf = '\0';
-
-            NSString *thisType = [NSString stringWithUTF8String: typebuf];
-            [buildFilterList addObject:thisType];
-            p_typebuf = typebuf;
-            *p_typebuf = '\0';
-        }
-        else
-        {
-            *p_typebuf = filterList[i];
-            ++p_typebuf;
+        if ( NFDi_Filter_IsGlob( filter, i ) )
+            continue;
 
-        }
+        const char *ext = NFDi_Filter_GetSpec( filter, i, NULL );
+        NSString *thisType = [NSString stringWithUTF8String: ext];
+        [buildFilterList addObject:thisType];
     }
 
     NSArray *returnArray = [NSArray arrayWithArray:buildFilterList];
@@ -45,12 +31,26 @@ static NSArray *BuildAllowedFileTypes( const char *filterList )
     return returnArray;
 }
 
-static void AddFilterListToDialog( NSSavePanel *dialog, const char *filterList )
+static void FreeAllowedFileTypes( void *backendData )
 {
-    if ( !filterList || strlen(filterList) == 0 )
+    [(NSArray*)backendData release];
+}
+
+static void AddFilterListToDialog( NSSavePanel *dialog, nfdfilter_t *filter )
+{
+    if ( !filter || filter->specCount == 0 )
         return;
 
-    NSArray *allowedFileTypes = BuildAllowedFileTypes( filterList );
+    // built on first use and kept with the filter, which outlives the
+    // dialog's autorelease pool
+    NSArray *allowedFileTypes = (NSArray*)filter->backendData;
+    if ( !allowedFileTypes )
+    {
+        allowedFileTypes = [BuildAllowedFileTypes( filter ) retain];
+        filter->backendData = allowedFileTypes;
+        filter->freeBackendData = FreeAllowedFileTypes;
+    }
+
     if ( [allowedFileTypes count] != 0 )
     {
         [dialog setAllowedFileTypes:allowedFileTypes];
@@ -118,10 +118,25 @@ static nfdresult_t AllocPathSet( NSArray *urls, nfdpathset_t *pathset )
 
 /* public */
 
+/* nothing to prepare ahead of the first dialog */
+nfdresult_t NFD_Init( void )
+{
+    return NFD_OKAY;
+}
 
-nfdresult_t NFD_OpenDialog( const nfdchar_t *filterList,
-                            const nfdchar_t *defaultPath,
-                            nfdchar_t **outPath )
+nfdresult_t NFD_InitAsync( void )
+{
+    return NFD_OKAY;
+}
+
+void NFD_Quit( void )
+{
+}
+
+
+static nfdresult_t OpenDialog( nfdfilter_t *filter,
+                               const nfdchar_t *defaultPath,
+                               nfdchar_t **outPath )
 {
     NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
 
@@ -130,7 +145,7 @@ nfdresult_t NFD_OpenDialog( const nfdchar_t *filterList,
     [dialog setAllowsMultipleSelection:NO];
 
     // Build the filter list
-    AddFilterListToDialog(dialog, filterList);
+    AddFilterListToDialog(dialog, filter);
 
     // Set the starting directory
     SetDefaultPath(dialog, defaultPath);
@@ -161,9 +176,9 @@ nfdresult_t NFD_OpenDialog( const nfdchar_t *filterList,
 }
 
 
-nfdresult_t NFD_OpenDialogMultiple( const nfdchar_t *filterList,
-                                    const nfdchar_t *defaultPath,
-                                    nfdpathset_t *outPaths )
+static nfdresult_t OpenDialogMultiple( nfdfilter_t *filter,
+                                       const nfdchar_t *defaultPath,
+                                       nfdpathset_t *outPaths )
 {
     NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
     NSWindow *keyWindow = [[NSApplication sharedApplication] keyWindow];
@@ -172,7 +187,7 @@ nfdresult_t NFD_OpenDialogMultiple( const nfdchar_t *filterList,
     [dialog setAllowsMultipleSelection:YES];
 
     // Build the fiter list.
-    AddFilterListToDialog(dialog, filterList);
+    AddFilterListToDialog(dialog, filter);
 
     // Set the starting directory
     SetDefaultPath(dialog, defaultPath);
@@ -205,9 +220,9 @@ nfdresult_t NFD_OpenDialogMultiple( const nfdchar_t *filterList,
 }
 
 
-nfdresult_t NFD_SaveDialog( const nfdchar_t *filterList,
-                            const nfdchar_t *defaultPath,
-                            nfdchar_t **outPath )
+static nfdresult_t SaveDialog( nfdfilter_t *filter,
+                               const nfdchar_t *defaultPath,
+                               nfdchar_t **outPath )
 {
     NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
     NSWindow *keyWindow = [[NSApplication sharedApplication] keyWindow];
@@ -216,7 +231,7 @@ nfdresult_t NFD_SaveDialog( const nfdchar_t *filterList,
     [dialog setExtensionHidden:NO];
     
     // Build the filter list.
-    AddFilterListToDialog(dialog, filterList);
+    AddFilterListToDialog(dialog, filter);
 
     // Set the starting directory
     SetDefaultPath(dialog, defaultPath);
@@ -245,6 +260,74 @@ nfdresult_t NFD_SaveDialog( const nfdchar_t *filterList,
     return nfdResult;
 }
 
+nfdresult_t NFD_OpenDialog( const nfdchar_t *filterList,
+                            const nfdchar_t *defaultPath,
+                            nfdchar_t **outPath )
+{
+    nfdfilter_t *filter;
+    nfdresult_t result = NFD_Filter_Compile( filterList, &filter );
+    if ( result == NFD_OKAY )
+    {
+        result = OpenDialog( filter, defaultPath, outPath );
+        NFD_Filter_Free( filter );
+    }
+
+    return result;
+}
+
+nfdresult_t NFD_OpenDialogMultiple( const nfdchar_t *filterList,
+                                    const nfdchar_t *defaultPath,
+                                    nfdpathset_t *outPaths )
+{
+    nfdfilter_t *filter;
+    nfdresult_t result = NFD_Filter_Compile( filterList, &filter );
+    if ( result == NFD_OKAY )
+    {
+        result = OpenDialogMultiple( filter, defaultPath, outPaths );
+        NFD_Filter_Free( filter );
+    }
+
+    return result;
+}
+
+nfdresult_t NFD_SaveDialog( const nfdchar_t *filterList,
+                            const nfdchar_t *defaultPath,
+                            nfdchar_t **outPath )
+{
+    nfdfilter_t *filter;
+    nfdresult_t result = NFD_Filter_Compile( filterList, &filter );
+    if ( result == NFD_OKAY )
+    {
+        result = SaveDialog( filter, defaultPath, outPath );
+        NFD_Filter_Free( filter );
+    }
+
+    return result;
+}
+
+/* the allowed types built from a compiled filter are kept with it, so
+   reusing the filter skips rebuilding them */
+nfdresult_t NFD_OpenDialogF( nfdfilter_t *filter,
+                             const nfdchar_t *defaultPath,
+                             nfdchar_t **outPath )
+{
+    return OpenDialog( filter, defaultPath, outPath );
+}
+
+nfdresult_t NFD_OpenDialogMultipleF( nfdfilter_t *filter,
+                                     const nfdchar_t *defaultPath,
+                                     nfdpathset_t *outPaths )
+{
+    return OpenDialogMultiple( filter, defaultPath, outPaths );
+}
+
+nfdresult_t NFD_SaveDialogF( nfdfilter_t *filter,
+                             const nfdchar_t *defaultPath,
+                             nfdchar_t **outPath )
+{
+    return SaveDialog( filter, defaultPath, outPath );
+}
+
 nfdresult_t NFD_PickFolder(const nfdchar_t *defaultPath,
     nfdchar_t **outPath)
 {
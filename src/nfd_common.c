@@ -4,62 +4,1519 @@
   http://www.frogtoss.com/labs
  */
 
+/* clock_gettime and pthread_once under strict C modes */
+#if defined(__linux__) && !defined(_POSIX_C_SOURCE) && !defined(_GNU_SOURCE)
+#define _POSIX_C_SOURCE 199506L
+#endif
+
+#include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#include <pthread.h>
+#endif
 #include "nfd_common.h"
 
-static char g_errorstr[NFD_MAX_STRLEN] = {0};
+static const char INVALID_UTF8_MSG[] = "dialog returned a path that is not valid UTF-8";
+
+#if defined(_MSC_VER)
+#define NFD_THREAD_LOCAL __declspec(thread)
+#elif defined(__GNUC__) || defined(__clang__)
+#define NFD_THREAD_LOCAL __thread
+#else
+#define NFD_THREAD_LOCAL _Thread_local
+#endif
+
+/* contexts
+
+   Errors go to the context bound to the calling thread with
+   NFD_SetThreadContext, or to the thread's own storage when there is
+   none, so threads never see each other's errors.  Allocation and the
+   timeout come from that context, or from g_defaults, which
+   NFD_SetAllocator and NFD_SetTimeout change and new contexts copy. */
+
+static nfdcontext_t g_defaults = { {0}, NFD_ERR_NONE, NULL, NULL, NULL, 0 };
+
+static NFD_THREAD_LOCAL nfdcontext_t *t_context = NULL;
+static NFD_THREAD_LOCAL char t_errorstr[NFD_MAX_STRLEN];
+static NFD_THREAD_LOCAL nfderror_t t_errorCode = NFD_ERR_NONE;
+
+/* set by NFD_SetTraceHook; dialogs read it once per phase */
+static nfdtracefn_t g_traceHook = NULL;
+static void *g_traceUserData = NULL;
+
+/* statistics
+
+   Totals are shared by every thread and only ever grow, so they are
+   updated with relaxed atomics and never locked.  Each thread keeps the
+   counts of the call it is in and of its last finished call. */
+
+#if defined(_MSC_VER)
+#define NFD_ATOMIC_ADD( p, n )  InterlockedExchangeAdd64( (volatile LONG64*)(p), (LONG64)(n) )
+#define NFD_ATOMIC_LOAD( p )    ((uint64_t)InterlockedCompareExchange64( (volatile LONG64*)(p), 0, 0 ))
+#define NFD_ATOMIC_CAS( p, expected, desired ) \
+    ((uint64_t)InterlockedCompareExchange64( (volatile LONG64*)(p), (LONG64)(desired), (LONG64)(expected) ))
+#else
+#define NFD_ATOMIC_ADD( p, n )  __atomic_fetch_add( (p), (n), __ATOMIC_RELAXED )
+#define NFD_ATOMIC_LOAD( p )    __atomic_load_n( (p), __ATOMIC_RELAXED )
+#define NFD_ATOMIC_CAS( p, expected, desired ) \
+    __sync_val_compare_and_swap( (p), (expected), (desired) )
+#endif
+
+static uint64_t g_stats[NFD_STAT_COUNT];
+
+static NFD_THREAD_LOCAL uint64_t t_callStats[NFD_STAT_COUNT];
+static NFD_THREAD_LOCAL uint64_t t_lastCallStats[NFD_STAT_COUNT];
+static NFD_THREAD_LOCAL int t_callDepth = 0;
+
+/* headless dialogs
+
+   NFD_HEADLESS_SCRIPT is read once, by whichever thread asks first,
+   into answers kept for the life of the process; threads asking while
+   it is read block until it is done.  Dialogs take answers in turn
+   through an atomic counter, so any number of threads can run them at
+   once. */
+
+typedef struct {
+    nfdresult_t result;
+    const nfdchar_t *text;   /* the paths, or the error message */
+} HeadlessAnswer;
+
+static const char HEADLESS_NO_SCRIPT_MSG[] = "NFD_HEADLESS_SCRIPT could not be read or has no answers";
+static const char HEADLESS_BAD_LINE_MSG[] = "NFD_HEADLESS_SCRIPT has a line that is not okay, cancel or error";
+static const char HEADLESS_CALLBACK_MSG[] = "the headless callback returned an error";
+
+static nfdheadlessfn_t g_headlessCallback = NULL;
+static void *g_headlessUserData = NULL;
+#ifdef _WIN32
+static INIT_ONCE g_headlessOnce = INIT_ONCE_STATIC_INIT;
+#else
+static pthread_once_t g_headlessOnce = PTHREAD_ONCE_INIT;
+#endif
+static int g_headlessScript = 0;
+static HeadlessAnswer *g_headlessAnswers = NULL;
+static size_t g_headlessAnswerCount = 0;
+static uint64_t g_headlessNext = 0;
+
+static const char *const PHASE_NAMES[NFD_PHASE_COUNT] = {
+    "init", "filter_build", "spawn", "show", "user_wait",
+    "capture", "parse", "alloc", "cleanup"
+};
+
+static const nfdcontext_t *Context_Settings( void )
+{
+    return t_context ? t_context : &g_defaults;
+}
+
+static void *Context_Alloc( const nfdcontext_t *context, size_t bytes )
+{
+    return context->allocFn ? context->allocFn( bytes, context->allocUserData ) : malloc(bytes);
+}
+
+static void Context_Free( const nfdcontext_t *context, void *ptr )
+{
+    if ( context->freeFn )
+        context->freeFn( ptr, context->allocUserData );
+    else
+        free(ptr);
+}
+
+/* compact path sets
+
+   When built with NFD_COMPACT_PATHSET, NFDi_PathSet_Alloc places the
+   whole set in a single allocation pointed to by buf and leaves
+   indices NULL:
+
+     [width][offsets x count][lengths x count][path bytes]
+
+   width is the size of one offset or length entry: 4 bytes when the
+   path bytes fit in 32 bits, sizeof(size_t) otherwise. */
+
+static size_t PathSet_ArenaWidth( const nfdpathset_t *pathset )
+{
+    return *(const size_t*)pathset->buf;
+}
+
+static size_t PathSet_ArenaHeaderSize( size_t count, size_t width )
+{
+    return sizeof(size_t) + 2 * count * width;
+}
+
+static size_t PathSet_ArenaGet( const nfdpathset_t *pathset, size_t slot )
+{
+    const char *table = pathset->buf + sizeof(size_t);
+    if ( PathSet_ArenaWidth(pathset) == sizeof(uint32_t) )
+        return ((const uint32_t*)table)[slot];
+    
+    return ((const size_t*)table)[slot];
+}
+
+static void PathSet_ArenaPut( nfdpathset_t *pathset, size_t slot, size_t value )
+{
+    char *table = pathset->buf + sizeof(size_t);
+    if ( PathSet_ArenaWidth(pathset) == sizeof(uint32_t) )
+        ((uint32_t*)table)[slot] = (uint32_t)value;
+    else
+        ((size_t*)table)[slot] = value;
+}
+
+static nfdchar_t *PathSet_ArenaBytes( const nfdpathset_t *pathset )
+{
+    return pathset->buf +
+        PathSet_ArenaHeaderSize( pathset->count, PathSet_ArenaWidth(pathset) );
+}
+
+/* public routines */
+
+const char *NFD_GetError( void )
+{
+    return t_context ? t_context->errorstr : t_errorstr;
+}
+
+nfderror_t NFD_GetErrorCode( void )
+{
+    return t_context ? t_context->errorCode : t_errorCode;
+}
+
+void NFD_SetTimeout( int timeoutMs )
+{
+    NFD_Context_SetTimeout( &g_defaults, timeoutMs );
+}
+
+void NFD_SetAllocator( nfdallocfn_t allocFn, nfdfreefn_t freeFn, void *userData )
+{
+    NFD_Context_SetAllocator( &g_defaults, allocFn, freeFn, userData );
+}
+
+void NFD_SetTraceHook( nfdtracefn_t hook, void *userData )
+{
+    g_traceUserData = userData;
+    g_traceHook = hook;
+}
+
+void NFD_Headless_SetCallback( nfdheadlessfn_t callback, void *userData )
+{
+    g_headlessUserData = userData;
+    g_headlessCallback = callback;
+}
+
+static void Stats_Copy( const uint64_t *counts, nfdstatcounts_t *out )
+{
+    out->calls            = counts[NFD_STAT_CALLS];
+    out->allocs           = counts[NFD_STAT_ALLOCS];
+    out->allocBytes       = counts[NFD_STAT_ALLOC_BYTES];
+    out->peakPathSetBytes = counts[NFD_STAT_PEAK_PATHSET_BYTES];
+    out->captureReallocs  = counts[NFD_STAT_CAPTURE_REALLOCS];
+    out->reads            = counts[NFD_STAT_READS];
+    out->spawnNs          = counts[NFD_STAT_SPAWN_NS];
+    out->paths            = counts[NFD_STAT_PATHS];
+}
+
+void NFD_GetStats( nfdstats_t *outStats )
+{
+    uint64_t totals[NFD_STAT_COUNT];
+    int i;
+
+    assert(outStats);
+
+    for ( i = 0; i < NFD_STAT_COUNT; ++i )
+        totals[i] = NFD_ATOMIC_LOAD( &g_stats[i] );
+
+    Stats_Copy( t_lastCallStats, &outStats->lastCall );
+    Stats_Copy( totals, &outStats->total );
+}
+
+const char *NFD_GetPhaseName( nfdphase_t phase )
+{
+    assert( phase < NFD_PHASE_COUNT );
+    return PHASE_NAMES[phase];
+}
+
+nfdresult_t NFD_Context_Create( nfdcontext_t **outContext )
+{
+    nfdcontext_t *context;
+
+    assert(outContext);
+
+    context = Context_Alloc( &g_defaults, sizeof(nfdcontext_t) );
+    *outContext = context;
+    if ( !context )
+    {
+        NFDi_SetErrorCode( NFD_ERR_OUT_OF_MEMORY, "NFD_Context_Create failed." );
+        return NFD_ERROR;
+    }
+
+    memcpy( context, &g_defaults, sizeof(nfdcontext_t) );
+    context->errorstr[0] = '\0';
+    context->errorCode = NFD_ERR_NONE;
+
+    return NFD_OKAY;
+}
+
+void NFD_Context_Free( nfdcontext_t *context )
+{
+    if ( !context )
+        return;
+
+    assert( context != t_context );
+    Context_Free( &g_defaults, context );
+}
+
+void NFD_Context_SetAllocator( nfdcontext_t *context, nfdallocfn_t allocFn,
+                               nfdfreefn_t freeFn, void *userData )
+{
+    assert(context);
+    assert( (allocFn == NULL) == (freeFn == NULL) );
+    context->allocFn = allocFn;
+    context->freeFn = freeFn;
+    context->allocUserData = userData;
+}
+
+void NFD_Context_SetTimeout( nfdcontext_t *context, int timeoutMs )
+{
+    assert(context);
+    assert( timeoutMs >= 0 );
+    context->timeoutMs = timeoutMs;
+}
+
+const char *NFD_Context_GetError( const nfdcontext_t *context )
+{
+    assert(context);
+    return context->errorstr;
+}
+
+nfderror_t NFD_Context_GetErrorCode( const nfdcontext_t *context )
+{
+    assert(context);
+    return context->errorCode;
+}
+
+nfdcontext_t *NFD_SetThreadContext( nfdcontext_t *context )
+{
+    nfdcontext_t *previous = t_context;
+    t_context = context;
+    return previous;
+}
+
+size_t NFD_PathSet_GetCount( const nfdpathset_t *pathset )
+{
+    assert(pathset);
+    return pathset->count;
+}
+
+nfdchar_t *NFD_PathSet_GetPath( const nfdpathset_t *pathset, size_t num )
+{
+    assert(pathset);
+    assert(num < pathset->count);
+
+    if ( !pathset->indices )
+        return PathSet_ArenaBytes(pathset) + PathSet_ArenaGet(pathset, num);
+    
+    return pathset->buf + pathset->indices[num];
+}
+
+nfdchar_t *NFD_PathSet_GetPathN( const nfdpathset_t *pathset, size_t num, size_t *outLen )
+{
+    nfdchar_t *path;
+    
+    assert(pathset);
+    assert(outLen);
+    assert(num < pathset->count);
+
+    if ( !pathset->indices )
+    {
+        *outLen = PathSet_ArenaGet(pathset, pathset->count + num);
+        return PathSet_ArenaBytes(pathset) + PathSet_ArenaGet(pathset, num);
+    }
+
+    path = pathset->buf + pathset->indices[num];
+    *outLen = strlen(path);
+    return path;
+}
+
+void NFD_PathSet_Free( nfdpathset_t *pathset )
+{
+    assert(pathset);
+    if ( pathset->indices )
+        NFDi_Free( pathset->indices );
+    NFDi_Free( pathset->buf );
+}
+
+/* Makes room for one more entry of size bytes in a table holding
+   count entries, doubling its capacity when full. */
+static int Filter_Reserve( void **table, size_t *capacity, size_t count, size_t size )
+{
+    void *grown;
+    size_t newCapacity;
+
+    if ( count < *capacity )
+        return 1;
+
+    newCapacity = *capacity ? *capacity * 2 : 8;
+    grown = NFDi_Realloc( *table, *capacity * size, newCapacity * size );
+    if ( !grown )
+        return 0;
+
+    *table = grown;
+    *capacity = newCapacity;
+    return 1;
+}
+
+/* Splits filter->list in place at every separator in a single pass,
+   recording each extension's offset and length.  The offsets are the
+   same in the source string.  Empty extensions and groups are
+   skipped. */
+static int Filter_Split( nfdfilter_t *filter )
+{
+    nfdchar_t *list = filter->list;
+    size_t specCapacity = 0;
+    size_t groupCapacity = 0;
+    size_t start = 0;
+    size_t groupStart = 0;
+    size_t i;
+
+    if ( strncmp( list, NFD_FILTER_IGNORE_CASE, sizeof(NFD_FILTER_IGNORE_CASE) - 1 ) == 0 )
+    {
+        filter->ignoreCase = 1;
+        start = sizeof(NFD_FILTER_IGNORE_CASE) - 1;
+    }
+
+    for ( i = start; ; ++i )
+    {
+        char ch = list[i];
+        if ( !NFDi_IsFilterSegmentChar( ch ) )
+            continue;
+
+        if ( i > start )
+        {
+            if ( !Filter_Reserve( (void**)&filter->specs, &specCapacity,
+                                  filter->specCount, sizeof(nfdfilterspec_t) ) )
+                return 0;
+
+            memset( &filter->specs[filter->specCount], 0, sizeof(nfdfilterspec_t) );
+            filter->specs[filter->specCount].offset = start;
+            filter->specs[filter->specCount].len = i - start;
+            ++filter->specCount;
+            list[i] = '\0';
+        }
+        start = i + 1;
+
+        if ( (ch == ';' || ch == '\0') && filter->specCount > groupStart )
+        {
+            if ( !Filter_Reserve( (void**)&filter->groups, &groupCapacity,
+                                  filter->groupCount, sizeof(nfdfiltergroup_t) ) )
+                return 0;
+
+            filter->groups[filter->groupCount].firstSpec = groupStart;
+            filter->groups[filter->groupCount].specCount = filter->specCount - groupStart;
+            ++filter->groupCount;
+            groupStart = filter->specCount;
+        }
+
+        if ( ch == '\0' )
+            return 1;
+    }
+}
+
+static nfdchar_t Filter_Fold( nfdchar_t ch )
+{
+    return ( ch >= 'A' && ch <= 'Z' ) ? (nfdchar_t)(ch - 'A' + 'a') : ch;
+}
+
+/* FNV-1a of the case folded extension */
+static size_t Filter_Hash( const nfdchar_t *ext, size_t len )
+{
+    uint32_t hash = 2166136261u;
+    size_t i;
+
+    for ( i = 0; i < len; ++i )
+    {
+        hash ^= (unsigned char)Filter_Fold( ext[i] );
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static int Filter_Equal( const nfdchar_t *a, const nfdchar_t *b, size_t len, int foldCase )
+{
+    size_t i;
+
+    if ( !foldCase )
+        return memcmp( a, b, len ) == 0;
+
+    for ( i = 0; i < len; ++i )
+    {
+        if ( Filter_Fold( a[i] ) != Filter_Fold( b[i] ) )
+            return 0;
+    }
+
+    return 1;
+}
+
+/* The extension set: plain extensions by case folded hash, with
+   linear probing.  Extensions that appear in several groups have an
+   entry for each, and the table is never more than half full. */
+static int Filter_BuildMatchTable( nfdfilter_t *filter )
+{
+    size_t size = 16;
+    size_t i;
+
+    while ( size < filter->specCount * 2 )
+        size *= 2;
+
+    filter->matchTable = NFDi_Malloc( sizeof(size_t) * size );
+    if ( !filter->matchTable )
+        return 0;
+    memset( filter->matchTable, 0, sizeof(size_t) * size );
+    filter->matchTableSize = size;
+
+    for ( i = 0; i < filter->specCount; ++i )
+    {
+        const nfdfilterspec_t *spec = &filter->specs[i];
+        size_t slot;
+
+        if ( spec->opCount > 0 )
+            continue;
+
+        slot = Filter_Hash( filter->list + spec->offset, spec->len ) & (size - 1);
+        while ( filter->matchTable[slot] != 0 )
+            slot = (slot + 1) & (size - 1);
+        filter->matchTable[slot] = i + 1;
+    }
+
+    return 1;
+}
+
+/* non-zero if ext is a plain extension among specs [firstSpec, endSpec) */
+static int Filter_HasExtension( const nfdfilter_t *filter, size_t firstSpec, size_t endSpec,
+                                const nfdchar_t *ext, size_t len, int foldCase )
+{
+    size_t mask = filter->matchTableSize - 1;
+    size_t slot = Filter_Hash( ext, len ) & mask;
+
+    while ( filter->matchTable[slot] != 0 )
+    {
+        size_t index = filter->matchTable[slot] - 1;
+        const nfdfilterspec_t *spec = &filter->specs[index];
+
+        if ( index >= firstSpec && index < endSpec && spec->len == len &&
+             Filter_Equal( filter->list + spec->offset, ext, len, foldCase ) )
+            return 1;
+        slot = (slot + 1) & mask;
+    }
+
+    return 0;
+}
+
+static void Glob_AddByte( uint32_t *set, unsigned char ch )
+{
+    set[ch >> 5] |= (uint32_t)1 << (ch & 31);
+}
+
+static int Glob_InSet( const uint32_t *set, unsigned char ch )
+{
+    return (set[ch >> 5] & ((uint32_t)1 << (ch & 31))) != 0;
+}
+
+/* A name is matched against foldSet by lowercasing it first, so an
+   upper case letter is in foldSet if its lower case is. */
+static void Glob_FoldUpperCase( uint32_t *foldSet )
+{
+    unsigned int ch;
+
+    for ( ch = 'A'; ch <= 'Z'; ++ch )
+    {
+        if ( Glob_InSet( foldSet, (unsigned char)(ch - 'A' + 'a') ) )
+            Glob_AddByte( foldSet, (unsigned char)ch );
+    }
+}
+
+static int Glob_HasByte( const nfdglobop_t *op, unsigned char ch, int foldCase )
+{
+    return Glob_InSet( foldCase ? op->foldSet : op->set, ch );
+}
+
+/* the ']' closing the class that opens at p, or NULL if there is none */
+static const nfdchar_t *Glob_ClassEnd( const nfdchar_t *p, const nfdchar_t *end )
+{
+    ++p;
+    if ( p < end && (*p == '!' || *p == '^') )
+        ++p;
+    /* a ']' straight after the '[' is part of the class */
+    if ( p < end && *p == ']' )
+        ++p;
+
+    while ( p < end && *p != ']' )
+        ++p;
+
+    return p < end ? p : NULL;
+}
+
+/* Fills set from the class between p and close.  Folding lowercases
+   each member of the class the way the name will be, as fnmatch does;
+   ranges are taken between the endpoints as written, so [A-z] still
+   holds the punctuation between 'Z' and 'a'. */
+static void Glob_AddClass( uint32_t *set, const nfdchar_t *p, const nfdchar_t *close, int foldCase )
+{
+    int negate = 0;
+    size_t i;
+
+    if ( *p == '!' || *p == '^' )
+    {
+        negate = 1;
+        ++p;
+    }
+
+    while ( p < close )
+    {
+        unsigned char first = (unsigned char)p[0];
+        unsigned char last = first;
+        unsigned int ch;
+
+        if ( p + 2 < close && p[1] == '-' )
+        {
+            last = (unsigned char)p[2];
+            p += 3;
+        }
+        else
+        {
+            ++p;
+        }
+
+        for ( ch = first; ch <= last; ++ch )
+        {
+            if ( foldCase )
+                Glob_AddByte( set, (unsigned char)Filter_Fold( (nfdchar_t)ch ) );
+            else
+                Glob_AddByte( set, (unsigned char)ch );
+        }
+    }
+
+    if ( foldCase )
+        Glob_FoldUpperCase( set );
+
+    if ( negate )
+    {
+        for ( i = 0; i < 8; ++i )
+            set[i] = ~set[i];
+    }
+}
+
+/* Compiles the glob spec into ops: '*' for any run of characters, '?'
+   for one character and [...] for a set of bytes.  Anything else
+   matches itself. */
+static int Filter_CompileGlob( nfdfilter_t *filter, size_t *opCapacity, nfdfilterspec_t *spec )
+{
+    const nfdchar_t *p = filter->list + spec->offset;
+    const nfdchar_t *end = p + spec->len;
+
+    spec->firstOp = filter->opCount;
+
+    while ( p < end )
+    {
+        nfdglobop_t *op;
+        const nfdchar_t *close;
+
+        if ( !Filter_Reserve( (void**)&filter->ops, opCapacity,
+                              filter->opCount, sizeof(nfdglobop_t) ) )
+            return 0;
+
+        op = &filter->ops[filter->opCount++];
+        memset( op, 0, sizeof(nfdglobop_t) );
+
+        if ( *p == '*' )
+        {
+            op->type = NFD_GLOB_STAR;
+            while ( p < end && *p == '*' )
+                ++p;
+        }
+        else if ( *p == '?' )
+        {
+            op->type = NFD_GLOB_ANY;
+            ++p;
+        }
+        else if ( *p == '[' && (close = Glob_ClassEnd( p, end )) != NULL )
+        {
+            op->type = NFD_GLOB_SET;
+            Glob_AddClass( op->set, p + 1, close, 0 );
+            Glob_AddClass( op->foldSet, p + 1, close, 1 );
+            p = close + 1;
+        }
+        else
+        {
+            op->type = NFD_GLOB_SET;
+            Glob_AddByte( op->set, (unsigned char)*p );
+            Glob_AddByte( op->foldSet, (unsigned char)Filter_Fold( *p ) );
+            Glob_FoldUpperCase( op->foldSet );
+            ++p;
+        }
+    }
+
+    spec->opCount = filter->opCount - spec->firstOp;
+    return 1;
+}
+
+static int Filter_CompileGlobs( nfdfilter_t *filter )
+{
+    size_t opCapacity = 0;
+    size_t globCapacity = 0;
+    size_t i;
+
+    for ( i = 0; i < filter->specCount; ++i )
+    {
+        nfdfilterspec_t *spec = &filter->specs[i];
+        const nfdchar_t *text = filter->list + spec->offset;
+
+        if ( strcspn( text, "*?[" ) == spec->len )
+            continue;
+
+        if ( !Filter_CompileGlob( filter, &opCapacity, spec ) ||
+             !Filter_Reserve( (void**)&filter->globSpecs, &globCapacity,
+                              filter->globCount, sizeof(size_t) ) )
+            return 0;
+
+        filter->globSpecs[filter->globCount++] = i;
+    }
+
+    return 1;
+}
+
+/* the position after the UTF-8 sequence at pos */
+static size_t Glob_NextChar( const nfdchar_t *name, size_t len, size_t pos )
+{
+    ++pos;
+    while ( pos < len && ((unsigned char)name[pos] & 0xC0) == 0x80 )
+        ++pos;
+    return pos;
+}
+
+/* Runs a glob's ops over the whole name.  A mismatch after a '*'
+   retries with the '*' taking one more character, so the cost is at
+   worst the name length times the glob length. */
+static int Glob_Match( const nfdglobop_t *ops, size_t opCount,
+                       const nfdchar_t *name, size_t len, int foldCase )
+{
+    size_t op = 0, pos = 0;
+    size_t starOp = opCount, starPos = 0;
+
+    while ( pos < len )
+    {
+        if ( op < opCount && ops[op].type == NFD_GLOB_STAR )
+        {
+            starOp = op++;
+            starPos = pos;
+            continue;
+        }
+
+        if ( op < opCount && ops[op].type == NFD_GLOB_ANY )
+        {
+            pos = Glob_NextChar( name, len, pos );
+            ++op;
+            continue;
+        }
+
+        if ( op < opCount && Glob_HasByte( &ops[op], (unsigned char)name[pos], foldCase ) )
+        {
+            ++pos;
+            ++op;
+            continue;
+        }
+
+        if ( starOp == opCount )
+            return 0;
+
+        op = starOp + 1;
+        starPos = Glob_NextChar( name, len, starPos );
+        pos = starPos;
+    }
+
+    while ( op < opCount && ops[op].type == NFD_GLOB_STAR )
+        ++op;
+
+    return op == opCount;
+}
+
+int NFDi_Filter_MatchName( const nfdfilter_t *filter, size_t group,
+                           const nfdchar_t *name, size_t len, int foldCase )
+{
+    size_t firstSpec = 0, endSpec = filter->specCount;
+    size_t i;
+
+    foldCase = foldCase || filter->ignoreCase;
+
+    if ( group != NFD_FILTER_ANY_GROUP )
+    {
+        assert(group < filter->groupCount);
+        firstSpec = filter->groups[group].firstSpec;
+        endSpec = firstSpec + filter->groups[group].specCount;
+    }
+
+    /* every suffix after a '.', longest first, so "a.tar.gz" matches
+       both "tar.gz" and "gz" */
+    for ( i = 0; i < len; ++i )
+    {
+        if ( name[i] == '.' &&
+             Filter_HasExtension( filter, firstSpec, endSpec, name + i + 1, len - i - 1, foldCase ) )
+            return 1;
+    }
+
+    for ( i = 0; i < filter->globCount; ++i )
+    {
+        const nfdfilterspec_t *spec;
+
+        if ( filter->globSpecs[i] < firstSpec || filter->globSpecs[i] >= endSpec )
+            continue;
+
+        spec = &filter->specs[filter->globSpecs[i]];
+        if ( Glob_Match( filter->ops + spec->firstOp, spec->opCount, name, len, foldCase ) )
+            return 1;
+    }
+
+    return 0;
+}
+
+int NFDi_Filter_IsGlob( const nfdfilter_t *filter, size_t index )
+{
+    assert(filter);
+    assert(index < filter->specCount);
+
+    return filter->specs[index].opCount > 0;
+}
+
+static nfdresult_t Filter_Compile( const nfdchar_t *filterList, nfdfilter_t **outFilter )
+{
+    nfdfilter_t *filter;
+    size_t len = filterList ? strlen(filterList) : 0;
+
+    assert(outFilter);
+    *outFilter = NULL;
+
+    filter = NFDi_Malloc( sizeof(nfdfilter_t) );
+    if ( !filter )
+        return NFD_ERROR;
+    memset( filter, 0, sizeof(nfdfilter_t) );
+
+    /* the source and the split copy share one allocation */
+    filter->source = NFDi_Malloc( 2 * (len + 1) );
+    if ( !filter->source )
+    {
+        NFD_Filter_Free( filter );
+        return NFD_ERROR;
+    }
+    memcpy( filter->source, filterList ? filterList : "", len + 1 );
+    filter->list = filter->source + len + 1;
+    memcpy( filter->list, filter->source, len + 1 );
+
+    if ( !Filter_Split( filter ) ||
+         !Filter_CompileGlobs( filter ) ||
+         !Filter_BuildMatchTable( filter ) )
+    {
+        NFD_Filter_Free( filter );
+        return NFD_ERROR;
+    }
+
+    *outFilter = filter;
+    return NFD_OKAY;
+}
+
+nfdresult_t NFD_Filter_Compile( const nfdchar_t *filterList, nfdfilter_t **outFilter )
+{
+    uint64_t traceStart = NFDi_Trace_Begin();
+    nfdresult_t result = Filter_Compile( filterList, outFilter );
+    NFDi_Trace_End( NFD_PHASE_FILTER_BUILD, traceStart );
+    return result;
+}
+
+static int Filter_IsPathSeparator( nfdchar_t ch )
+{
+#ifdef _WIN32
+    return ch == '\\' || ch == '/';
+#else
+    return ch == '/';
+#endif
+}
+
+nfdresult_t NFD_Filter_MatchPathSet( nfdfilter_t *filter,
+                                     const nfdpathset_t *pathSet,
+                                     unsigned char *outMask )
+{
+    size_t count = NFD_PathSet_GetCount( pathSet );
+    size_t i;
+
+    assert(outMask);
+
+    if ( !filter || filter->specCount == 0 )
+    {
+        memset( outMask, 1, count );
+        return NFD_OKAY;
+    }
+
+    for ( i = 0; i < count; ++i )
+    {
+        size_t len, nameStart;
+        const nfdchar_t *path = NFD_PathSet_GetPathN( pathSet, i, &len );
+
+        nameStart = len;
+        while ( nameStart > 0 && !Filter_IsPathSeparator( path[nameStart-1] ) )
+            --nameStart;
+
+        outMask[i] = (unsigned char)NFDi_Filter_MatchName( filter, NFD_FILTER_ANY_GROUP,
+                                                           path + nameStart, len - nameStart, 1 );
+    }
+
+    return NFD_OKAY;
+}
+
+void NFD_Filter_Free( nfdfilter_t *filter )
+{
+    if ( !filter )
+        return;
+
+    if ( filter->backendData && filter->freeBackendData )
+        filter->freeBackendData( filter->backendData );
+    if ( filter->matchTable )
+        NFDi_Free( filter->matchTable );
+    if ( filter->globSpecs )
+        NFDi_Free( filter->globSpecs );
+    if ( filter->ops )
+        NFDi_Free( filter->ops );
+    if ( filter->groups )
+        NFDi_Free( filter->groups );
+    if ( filter->specs )
+        NFDi_Free( filter->specs );
+    if ( filter->source )
+        NFDi_Free( filter->source );
+    NFDi_Free( filter );
+}
+
+/* internal routines */
+
+void *NFDi_Malloc( size_t bytes )
+{
+    void *ptr = Context_Alloc( Context_Settings(), bytes );
+    if ( !ptr )
+        NFDi_SetErrorCode( NFD_ERR_OUT_OF_MEMORY, "NFDi_Malloc failed." );
+
+    NFDi_Stats_Add( NFD_STAT_ALLOCS, 1 );
+    NFDi_Stats_Add( NFD_STAT_ALLOC_BYTES, bytes );
+    return ptr;
+}
+
+/* A caller's allocator has no realloc, so growing copies into a new
+   block; oldBytes says how much of ptr is worth copying. */
+void *NFDi_Realloc( void *ptr, size_t oldBytes, size_t bytes )
+{
+    void *grown;
+
+    if ( !Context_Settings()->allocFn )
+    {
+        grown = realloc(ptr, bytes);
+        if ( !grown )
+            NFDi_SetErrorCode( NFD_ERR_OUT_OF_MEMORY, "NFDi_Realloc failed." );
+
+        NFDi_Stats_Add( NFD_STAT_ALLOCS, 1 );
+        NFDi_Stats_Add( NFD_STAT_ALLOC_BYTES, bytes );
+        return grown;
+    }
+
+    grown = NFDi_Malloc( bytes );
+    if ( grown && ptr )
+    {
+        memcpy( grown, ptr, oldBytes < bytes ? oldBytes : bytes );
+        NFDi_Free( ptr );
+    }
+
+    return grown;
+}
+
+void NFDi_Free( void *ptr )
+{
+    assert(ptr);
+    Context_Free( Context_Settings(), ptr );
+}
+
+int NFDi_GetTimeout( void )
+{
+    return Context_Settings()->timeoutMs;
+}
+
+uint64_t NFDi_Trace_Now( void )
+{
+#ifdef _WIN32
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter( &counter );
+    QueryPerformanceFrequency( &frequency );
+    return (uint64_t)(counter.QuadPart / frequency.QuadPart) * 1000000000u +
+           (uint64_t)(counter.QuadPart % frequency.QuadPart) * 1000000000u / (uint64_t)frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+uint64_t NFDi_Trace_Begin( void )
+{
+#ifdef NFD_USDT
+    /* the phase probe cannot tell whether anything is attached, so a
+       USDT build always reads the clock */
+    return NFDi_Trace_Now();
+#else
+    return g_traceHook ? NFDi_Trace_Now() : 0;
+#endif
+}
+
+void NFDi_Trace_End( nfdphase_t phase, uint64_t start )
+{
+    nfdtracefn_t hook = g_traceHook;
+    uint64_t end;
+
+    /* a hook installed mid-phase sees the next one */
+    if ( !start )
+        return;
+
+    end = NFDi_Trace_Now();
+    NFDi_PROBE4( phase, PHASE_NAMES[phase], (int)phase, start, end );
+    if ( hook )
+        hook( phase, start, end, g_traceUserData );
+}
+
+void NFDi_Stats_Add( nfdstat_t stat, uint64_t value )
+{
+    if ( t_callDepth > 0 )
+        t_callStats[stat] += value;
+    NFD_ATOMIC_ADD( &g_stats[stat], value );
+}
+
+void NFDi_Stats_Max( nfdstat_t stat, uint64_t value )
+{
+    uint64_t current = NFD_ATOMIC_LOAD( &g_stats[stat] );
+
+    if ( t_callDepth > 0 && value > t_callStats[stat] )
+        t_callStats[stat] = value;
+
+    /* NFD_ATOMIC_CAS returns what it found; another thread may have
+       raised it first */
+    while ( value > current )
+    {
+        uint64_t seen = NFD_ATOMIC_CAS( &g_stats[stat], current, value );
+        if ( seen == current )
+            break;
+        current = seen;
+    }
+}
+
+void NFDi_Stats_BeginCall( void )
+{
+    if ( t_callDepth++ > 0 )
+        return;
+
+    memset( t_callStats, 0, sizeof(t_callStats) );
+    NFDi_Stats_Add( NFD_STAT_CALLS, 1 );
+}
+
+void NFDi_Stats_EndCall( void )
+{
+    assert( t_callDepth > 0 );
+    if ( --t_callDepth > 0 )
+        return;
+
+    memcpy( t_lastCallStats, t_callStats, sizeof(t_lastCallStats) );
+}
+
+uint64_t NFDi_Atomic_Load( uint64_t *value )
+{
+    /* acquire, unlike the statistics; NFD_ATOMIC_CAS is a full barrier */
+#if defined(_MSC_VER)
+    return NFD_ATOMIC_LOAD( value );
+#else
+    return __atomic_load_n( value, __ATOMIC_ACQUIRE );
+#endif
+}
+
+uint64_t NFDi_Atomic_CAS( uint64_t *value, uint64_t expected, uint64_t desired )
+{
+    return NFD_ATOMIC_CAS( value, expected, desired );
+}
+
+static HeadlessAnswer Headless_ParseLine( char *line )
+{
+    HeadlessAnswer answer;
+
+    if ( strncmp( line, "okay ", 5 ) == 0 )
+    {
+        answer.result = NFD_OKAY;
+        answer.text = line + 5;
+    }
+    else if ( strcmp( line, "cancel" ) == 0 )
+    {
+        answer.result = NFD_CANCEL;
+        answer.text = "";
+    }
+    else if ( strncmp( line, "error ", 6 ) == 0 )
+    {
+        answer.result = NFD_ERROR;
+        answer.text = line + 6;
+    }
+    else
+    {
+        answer.result = NFD_ERROR;
+        answer.text = HEADLESS_BAD_LINE_MSG;
+    }
+
+    return answer;
+}
+
+/* leaves no answers if the script cannot be read */
+static void Headless_ReadScript( const char *path )
+{
+    HeadlessAnswer *answers;
+    FILE *file;
+    char *buf, *line, *next, *p;
+    long size;
+    size_t count = 0, lines = 1;
+
+    if ( !path || !path[0] )
+        return;
+    g_headlessScript = 1;
+
+    file = fopen( path, "rb" );
+    if ( !file )
+        return;
+
+    if ( fseek( file, 0, SEEK_END ) != 0 || (size = ftell( file )) < 0 ||
+         fseek( file, 0, SEEK_SET ) != 0 )
+    {
+        fclose( file );
+        return;
+    }
+
+    /* kept until exit, so not from NFD_SetAllocator's functions, which
+       may be replaced once the caller's own blocks are freed */
+    buf = malloc( (size_t)size + 1 );
+    if ( !buf || fread( buf, 1, (size_t)size, file ) != (size_t)size )
+    {
+        free( buf );
+        fclose( file );
+        return;
+    }
+    fclose( file );
+    buf[size] = '\0';
+
+    for ( p = buf; (p = strchr( p, '\n' )) != NULL; ++p )
+        ++lines;
+
+    answers = malloc( sizeof(HeadlessAnswer) * lines );
+    if ( !answers )
+    {
+        free( buf );
+        return;
+    }
+
+    for ( line = buf; line; line = next )
+    {
+        char *end = strchr( line, '\n' );
+
+        next = end ? end + 1 : NULL;
+        if ( !end )
+            end = line + strlen( line );
+        *end = '\0';
+        if ( end > line && end[-1] == '\r' )
+            *--end = '\0';
+
+        if ( line != end && line[0] != '#' )
+            answers[count++] = Headless_ParseLine( line );
+    }
+
+    g_headlessAnswers = answers;
+    g_headlessAnswerCount = count;
+}
+
+#ifdef _WIN32
+static BOOL CALLBACK Headless_LoadOnce( PINIT_ONCE once, PVOID param, PVOID *context )
+{
+    (void)once;
+    (void)param;
+    (void)context;
+    Headless_ReadScript( getenv( "NFD_HEADLESS_SCRIPT" ) );
+    return TRUE;
+}
+#else
+static void Headless_LoadOnce( void )
+{
+    Headless_ReadScript( getenv( "NFD_HEADLESS_SCRIPT" ) );
+}
+#endif
+
+static void Headless_Load( void )
+{
+#ifdef _WIN32
+    InitOnceExecuteOnce( &g_headlessOnce, Headless_LoadOnce, NULL, NULL );
+#else
+    pthread_once( &g_headlessOnce, Headless_LoadOnce );
+#endif
+}
+
+static nfdresult_t Headless_Answer( nfddialogtype_t type, const nfdchar_t *filterList,
+                                    const nfdchar_t *defaultPath, const nfdchar_t **outAnswer )
+{
+    nfdheadlessfn_t callback = g_headlessCallback;
+    HeadlessAnswer *answer;
+
+    *outAnswer = NULL;
+    if ( callback )
+    {
+        nfdresult_t result = callback( type, filterList, defaultPath, outAnswer, g_headlessUserData );
+        if ( !*outAnswer )
+            *outAnswer = result == NFD_ERROR ? HEADLESS_CALLBACK_MSG : "";
+        return result;
+    }
+
+    Headless_Load();
+    if ( g_headlessAnswerCount == 0 )
+    {
+        *outAnswer = HEADLESS_NO_SCRIPT_MSG;
+        return g_headlessScript ? NFD_ERROR : NFD_CANCEL;
+    }
+
+    answer = &g_headlessAnswers[NFD_ATOMIC_ADD( &g_headlessNext, 1 ) % g_headlessAnswerCount];
+    *outAnswer = answer->text;
+    return answer->result;
+}
 
-/* public routines */
+static nfdresult_t Headless_CopyPath( const nfdchar_t *answer, nfdchar_t **outPath )
+{
+    size_t len = strlen( answer );
+    uint64_t traceStart;
 
-const char *NFD_GetError( void )
+    if ( len == 0 || memchr( answer, '|', len ) )
+    {
+        NFDi_SetErrorCode( NFD_ERR_USAGE, "a headless single path dialog must be answered with one path" );
+        return NFD_ERROR;
+    }
+
+    if ( !NFDi_UTF8_CheckPath( answer, len ) )
+        return NFD_ERROR;
+
+    traceStart = NFDi_Trace_Begin();
+    *outPath = NFDi_Malloc( len + 1 );
+    if ( *outPath )
+    {
+        memcpy( *outPath, answer, len + 1 );
+        NFDi_Stats_Add( NFD_STAT_PATHS, 1 );
+    }
+    NFDi_Trace_End( NFD_PHASE_ALLOC, traceStart );
+
+    return *outPath ? NFD_OKAY : NFD_ERROR;
+}
+
+/* the answer goes through the parser zenity's output does */
+static nfdresult_t Headless_CopyPaths( const nfdchar_t *answer, nfdpathset_t *outPaths )
 {
-    return g_errorstr;
+    nfdpathparser_t parser;
+
+    NFDi_PathParser_Init( &parser, '|' );
+    NFDi_PathParser_Feed( &parser, answer, strlen( answer ) );
+    if ( NFDi_PathParser_Finish( &parser, outPaths ) != NFD_OKAY )
+        return NFD_ERROR;
+
+    return NFDi_PathSet_CheckUTF8( outPaths );
 }
 
-size_t NFD_PathSet_GetCount( const nfdpathset_t *pathset )
+int NFDi_Headless_IsEnabled( void )
 {
-    assert(pathset);
-    return pathset->count;
+    if ( g_headlessCallback )
+        return 1;
+
+    Headless_Load();
+    return g_headlessScript;
 }
 
-nfdchar_t *NFD_PathSet_GetPath( const nfdpathset_t *pathset, size_t num )
+nfdresult_t NFDi_Headless_Dialog( nfddialogtype_t type,
+                                  const nfdchar_t *filterList,
+                                  nfdfilter_t *filter,
+                                  const nfdchar_t *defaultPath,
+                                  nfdchar_t **outPath,
+                                  nfdpathset_t *outPaths )
 {
-    assert(pathset);
-    assert(num < pathset->count);
+    nfdfilter_t *compiled = NULL;
+    const nfdchar_t *source;
+    const nfdchar_t *answer;
+    uint64_t traceStart;
+    nfdresult_t result;
+
+    assert( type == NFD_DIALOG_OPEN_MULTIPLE ? outPaths != NULL : outPath != NULL );
+    if ( outPath )
+        *outPath = NULL;
+
+    if ( !filter )
+    {
+        if ( NFD_Filter_Compile( filterList, &compiled ) != NFD_OKAY )
+            return NFD_ERROR;
+        filter = compiled;
+    }
+    source = NFDi_Filter_GetSource( filter );
+
+    traceStart = NFDi_Trace_Begin();
+    result = Headless_Answer( type, source[0] ? source : NULL, defaultPath, &answer );
+    NFDi_Trace_End( NFD_PHASE_USER_WAIT, traceStart );
+
+    if ( result == NFD_OKAY && type == NFD_DIALOG_OPEN_MULTIPLE )
+    {
+        result = Headless_CopyPaths( answer, outPaths );
+    }
+    else if ( result == NFD_OKAY )
+    {
+        result = Headless_CopyPath( answer, outPath );
+    }
+    else if ( result == NFD_ERROR )
+    {
+        char message[NFD_MAX_STRLEN];
+        NFDi_SafeStrncpy( message, answer, NFD_MAX_STRLEN );
+        NFDi_SetError( message );
+    }
+
+    if ( compiled )
+        NFD_Filter_Free( compiled );
+    return result;
+}
+
+nfdcontext_t *NFDi_GetContext( void )
+{
+    return t_context;
+}
+
+void NFDi_SetError( const char *msg )
+{
+    NFDi_SetErrorCode( NFD_ERR_PLATFORM, msg );
+}
+
+void NFDi_SetErrorCode( nfderror_t code, const char *msg )
+{
+    char *errorstr = t_context ? t_context->errorstr : t_errorstr;
+    int bTruncate = NFDi_SafeStrncpy( errorstr, msg, NFD_MAX_STRLEN );
+    assert( !bTruncate );  _NFD_UNUSED(bTruncate);
+
+    if ( t_context )
+        t_context->errorCode = code;
+    else
+        t_errorCode = code;
+}
+
+
+static nfdchar_t *PathSet_Alloc( nfdpathset_t *pathSet, size_t count, size_t bufSize )
+{
+#ifdef NFD_COMPACT_PATHSET
+    size_t width = bufSize <= UINT32_MAX ? sizeof(uint32_t) : sizeof(size_t);
+    size_t headerSize = PathSet_ArenaHeaderSize( count, width );
     
-    return pathset->buf + pathset->indices[num];
+    assert(pathSet);
+
+    pathSet->buf = NFDi_Malloc( headerSize + bufSize );
+    if ( !pathSet->buf )
+        return NULL;
+
+    NFDi_Stats_Max( NFD_STAT_PEAK_PATHSET_BYTES, headerSize + bufSize );
+
+    *(size_t*)pathSet->buf = width;
+    pathSet->indices = NULL;
+    pathSet->count = count;
+
+    return pathSet->buf + headerSize;
+#else
+    assert(pathSet);
+
+    pathSet->indices = NFDi_Malloc( sizeof(size_t)*count );
+    if ( !pathSet->indices )
+        return NULL;
+
+    pathSet->buf = NFDi_Malloc( sizeof(nfdchar_t) * bufSize );
+    if ( !pathSet->buf )
+    {
+        NFDi_Free( pathSet->indices );
+        return NULL;
+    }
+
+    NFDi_Stats_Max( NFD_STAT_PEAK_PATHSET_BYTES, sizeof(size_t)*count + sizeof(nfdchar_t)*bufSize );
+
+    pathSet->count = count;
+
+    return pathSet->buf;
+#endif
 }
 
-void NFD_PathSet_Free( nfdpathset_t *pathset )
+nfdchar_t *NFDi_PathSet_Alloc( nfdpathset_t *pathSet, size_t count, size_t bufSize )
 {
-    assert(pathset);
-    NFDi_Free( pathset->indices );
-    NFDi_Free( pathset->buf );
+    uint64_t traceStart = NFDi_Trace_Begin();
+    nfdchar_t *buf;
+
+    NFDi_PROBE2( pathset_start, count, bufSize );
+    buf = PathSet_Alloc( pathSet, count, bufSize );
+    NFDi_PROBE3( pathset_end, count, bufSize, buf != NULL );
+    if ( buf )
+        NFDi_Stats_Add( NFD_STAT_PATHS, count );
+    NFDi_Trace_End( NFD_PHASE_ALLOC, traceStart );
+    return buf;
 }
 
-/* internal routines */
+void NFDi_PathSet_SetEntry( nfdpathset_t *pathSet, size_t index, size_t offset, size_t len )
+{
+    assert(pathSet);
+    assert(index < pathSet->count);
 
-void *NFDi_Malloc( size_t bytes )
+    if ( !pathSet->indices )
+    {
+        PathSet_ArenaPut( pathSet, index, offset );
+        PathSet_ArenaPut( pathSet, pathSet->count + index, len );
+        return;
+    }
+
+    pathSet->indices[index] = offset;
+    _NFD_UNUSED(len);
+}
+
+
+static int PathParser_Grow( nfdpathparser_t *parser, void **ptr, size_t *size,
+                            size_t needed, size_t elemSize )
 {
-    void *ptr = malloc(bytes);
-    if ( !ptr )
-        NFDi_SetError("NFDi_Malloc failed.");
+    size_t newSize = *size ? *size : 256;
+    void *newPtr;
+    
+    if ( needed <= *size )
+        return 1;
 
-    return ptr;
+    while ( newSize < needed )
+        newSize *= 2;
+
+    newPtr = NFDi_Realloc( *ptr, *size * elemSize, newSize * elemSize );
+    if ( !newPtr )
+    {
+        NFDi_SetErrorCode( NFD_ERR_OUT_OF_MEMORY, "NFDi_PathParser_Feed failed to grow its buffer." );
+        parser->failed = 1;
+        return 0;
+    }
+
+    /* the first allocation is not a realloc */
+    if ( *ptr )
+        NFDi_Stats_Add( NFD_STAT_CAPTURE_REALLOCS, 1 );
+
+    *ptr = newPtr;
+    *size = newSize;
+    return 1;
 }
 
-void NFDi_Free( void *ptr )
+static int PathParser_PushStart( nfdpathparser_t *parser, size_t start )
 {
-    assert(ptr);
-    free(ptr);
+    if ( !PathParser_Grow( parser, (void**)&parser->starts, &parser->startsSize,
+                           parser->count + 1, sizeof(size_t) ) )
+        return 0;
+
+    parser->starts[parser->count++] = start;
+    return 1;
 }
 
-void NFDi_SetError( const char *msg )
+void NFDi_PathParser_Init( nfdpathparser_t *parser, char separator )
 {
-    int bTruncate = NFDi_SafeStrncpy( g_errorstr, msg, NFD_MAX_STRLEN );
-    assert( !bTruncate );  _NFD_UNUSED(bTruncate);
+    assert(parser);
+    memset( parser, 0, sizeof(nfdpathparser_t) );
+    parser->separator = separator;
+}
+
+void NFDi_PathParser_Feed( nfdpathparser_t *parser, const char *data, size_t len )
+{
+    char *p, *end;
+    
+    assert(parser);
+    assert(data || len == 0);
+
+    if ( parser->failed || len == 0 )
+        return;
+
+    if ( parser->count == 0 && !PathParser_PushStart( parser, 0 ) )
+        return;
+
+    /* reserve a byte for the final null terminator */
+    if ( !PathParser_Grow( parser, (void**)&parser->buf, &parser->bufSize,
+                           parser->bufUsed + len + 1, sizeof(nfdchar_t) ) )
+        return;
+
+    p = parser->buf + parser->bufUsed;
+    end = p + len;
+    memcpy( p, data, len );
+    parser->bufUsed += len;
+
+    while ( (p = memchr( p, parser->separator, (size_t)(end - p) )) != NULL )
+    {
+        *p++ = '\0';
+        if ( !PathParser_PushStart( parser, (size_t)(p - parser->buf) ) )
+            return;
+    }
+}
+
+static nfdresult_t PathParser_Finish( nfdpathparser_t *parser, nfdpathset_t *pathSet )
+{
+    nfdchar_t *buf;
+    size_t i;
+    
+    assert(parser);
+    assert(pathSet);
+
+    if ( parser->failed )
+    {
+        NFDi_PathParser_Free( parser );
+        return NFD_ERROR;
+    }
+
+    if ( parser->count == 0 )
+    {
+        NFDi_SetError("No paths were returned.");
+        NFDi_PathParser_Free( parser );
+        return NFD_ERROR;
+    }
+
+    if ( parser->buf[parser->bufUsed-1] == '\n' )
+        parser->bufUsed--;
+    parser->buf[parser->bufUsed++] = '\0';
+
+    buf = NFDi_PathSet_Alloc( pathSet, parser->count, parser->bufUsed );
+    if ( !buf )
+    {
+        NFDi_PathParser_Free( parser );
+        return NFD_ERROR;
+    }
+
+    memcpy( buf, parser->buf, parser->bufUsed );
+    for ( i = 0; i < parser->count; ++i )
+    {
+        size_t end = i + 1 < parser->count ? parser->starts[i+1] : parser->bufUsed;
+        NFDi_PathSet_SetEntry( pathSet, i, parser->starts[i], end - parser->starts[i] - 1 );
+    }
+
+    NFDi_PathParser_Free( parser );
+    return NFD_OKAY;
+}
+
+nfdresult_t NFDi_PathParser_Finish( nfdpathparser_t *parser, nfdpathset_t *pathSet )
+{
+    uint64_t traceStart = NFDi_Trace_Begin();
+    nfdresult_t result = PathParser_Finish( parser, pathSet );
+    NFDi_Trace_End( NFD_PHASE_PARSE, traceStart );
+    return result;
+}
+
+void NFDi_PathParser_Free( nfdpathparser_t *parser )
+{
+    assert(parser);
+    if ( parser->buf )
+        NFDi_Free( parser->buf );
+    if ( parser->starts )
+        NFDi_Free( parser->starts );
+    memset( parser, 0, sizeof(nfdpathparser_t) );
 }
 
 
@@ -91,48 +1548,451 @@ int NFDi_SafeStrncpy( char *dst, const char *src, size_t maxCopy )
 }
 
 
-/* adapted from microutf8 */
+/* UTF-8 validation
+
+   NFDi_UTF8_ValidateScalar checks one sequence at a time against
+   Table 3-7 of the Unicode standard, so overlong forms, surrogates and
+   code points past U+10FFFF are rejected.
+
+   The vector versions check 16 or 32 bytes at a time, whatever they
+   hold, with the lookup algorithm of Keiser and Lemire, "Validating
+   UTF-8 In Less Than One Instruction Per Byte" (2021).  Every error is
+   visible in a byte and the one before it, so three 16 entry tables,
+   indexed by the high and low nibble of the previous byte and the high
+   nibble of this one, give a mask of the errors each could be part of;
+   the byte pair is an error if all three agree.  Which bytes must be
+   the second or third continuation of a 3 or 4 byte sequence is found
+   from the bytes two and three back.  A block that is all ASCII only
+   has to check that the block before did not end in the middle of a
+   sequence.  The tables need pshufb, so the versions are SSSE3 and
+   AVX2, picked at run time on GCC and Clang for x86. */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define NFD_UTF8_SIMD
+#include <immintrin.h>
+#endif
+
+/* the length of the valid sequence at s, or 0 if it is invalid */
+static size_t UTF8_SequenceLen( const unsigned char *s, size_t avail )
+{
+    unsigned char lead = s[0];
+    unsigned char lo = 0x80, hi = 0xBF;
+
+    if ( lead < 0x80 )
+        return 1;
+
+    if ( lead < 0xC2 )
+        return 0;
+
+    if ( lead < 0xE0 )
+        return ( avail >= 2 && (s[1] & 0xC0) == 0x80 ) ? 2 : 0;
+
+    if ( lead < 0xF0 )
+    {
+        if ( lead == 0xE0 )
+            lo = 0xA0;
+        else if ( lead == 0xED )
+            hi = 0x9F;
+
+        return ( avail >= 3 && s[1] >= lo && s[1] <= hi &&
+                 (s[2] & 0xC0) == 0x80 ) ? 3 : 0;
+    }
+
+    if ( lead < 0xF5 )
+    {
+        if ( lead == 0xF0 )
+            lo = 0x90;
+        else if ( lead == 0xF4 )
+            hi = 0x8F;
+
+        return ( avail >= 4 && s[1] >= lo && s[1] <= hi &&
+                 (s[2] & 0xC0) == 0x80 && (s[3] & 0xC0) == 0x80 ) ? 4 : 0;
+    }
+
+    return 0;
+}
+
+/* Decodes from *pos up to at least end, so a sequence that straddles
+   end is finished.  Returns 0 on an invalid sequence. */
+static int UTF8_ValidateRun( const unsigned char *s, size_t len, size_t *pos, size_t end, size_t *count )
+{
+    /* in locals, as s could alias them */
+    size_t p = *pos, n = *count;
+
+    while ( p < end )
+    {
+        size_t seqLen = UTF8_SequenceLen( s + p, len - p );
+        if ( seqLen == 0 )
+            return 0;
+
+        p += seqLen;
+        ++n;
+    }
+
+    *pos = p;
+    *count = n;
+    return 1;
+}
+
+int NFDi_UTF8_ValidateScalar( const nfdchar_t *str, size_t len, size_t *outCount )
+{
+    size_t pos = 0, count = 0;
+
+    if ( !UTF8_ValidateRun( (const unsigned char*)str, len, &pos, len, &count ) )
+        return 0;
+
+    if ( outCount )
+        *outCount = count;
+    return 1;
+}
+
+#ifdef NFD_UTF8_SIMD
+/* the errors a byte pair can be part of */
+#define UTF8_TOO_SHORT    (1 << 0)    /* a lead not followed by a continuation */
+#define UTF8_TOO_LONG     (1 << 1)    /* a continuation after ASCII */
+#define UTF8_OVERLONG_3   (1 << 2)    /* E0 80..9F */
+#define UTF8_TOO_LARGE    (1 << 3)    /* F4 90..BF, F5..FF */
+#define UTF8_SURROGATE    (1 << 4)    /* ED A0..BF */
+#define UTF8_OVERLONG_2   (1 << 5)    /* C0, C1 */
+#define UTF8_TOO_LARGE_1000 (1 << 6)  /* F5..FF 80..8F */
+#define UTF8_OVERLONG_4   (1 << 6)    /* F0 80..8F */
+#define UTF8_TWO_CONTS    (1 << 7)    /* a continuation after a continuation */
+#define UTF8_CARRY        (UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS)
+
+/* by the high nibble of the previous byte */
+static const unsigned char UTF8_BYTE1_HIGH[16] = {
+    UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+    UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+    UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS,
+    UTF8_TOO_SHORT | UTF8_OVERLONG_2,
+    UTF8_TOO_SHORT,
+    UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+    UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4
+};
+
+/* by the low nibble of the previous byte */
+static const unsigned char UTF8_BYTE1_LOW[16] = {
+    UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4,
+    UTF8_CARRY | UTF8_OVERLONG_2,
+    UTF8_CARRY,
+    UTF8_CARRY,
+    UTF8_CARRY | UTF8_TOO_LARGE,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000
+};
+
+/* by the high nibble of this byte */
+static const unsigned char UTF8_BYTE2_HIGH[16] = {
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE,
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE,
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE,
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT
+};
+
+/* a block ending in a lead byte more than this, counting from the end,
+   is in the middle of a sequence: the last three bytes against
+   F0, E0 and C0 */
+static const unsigned char UTF8_INCOMPLETE_MAX[32] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xF0 - 1, 0xE0 - 1, 0xC0 - 1
+};
+
+static unsigned UTF8_PopCount( unsigned mask )
+{
+    return (unsigned)__builtin_popcount( mask );
+}
+
+__attribute__((target("ssse3")))
+static __m128i UTF8_BlockErrorsSSSE3( __m128i block, __m128i prev )
+{
+    const __m128i nibble = _mm_set1_epi8( 0x0F );
+    __m128i prev1 = _mm_alignr_epi8( block, prev, 15 );
+    __m128i prev2 = _mm_alignr_epi8( block, prev, 14 );
+    __m128i prev3 = _mm_alignr_epi8( block, prev, 13 );
+    __m128i byte1High = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i*)UTF8_BYTE1_HIGH ),
+                                          _mm_and_si128( _mm_srli_epi16( prev1, 4 ), nibble ) );
+    __m128i byte1Low = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i*)UTF8_BYTE1_LOW ),
+                                         _mm_and_si128( prev1, nibble ) );
+    __m128i byte2High = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i*)UTF8_BYTE2_HIGH ),
+                                          _mm_and_si128( _mm_srli_epi16( block, 4 ), nibble ) );
+    __m128i special = _mm_and_si128( _mm_and_si128( byte1High, byte1Low ), byte2High );
+    /* the high bit where the byte two back is E0 or more, or the byte
+       three back is F0 or more */
+    __m128i third = _mm_subs_epu8( prev2, _mm_set1_epi8( (char)(0xE0 - 0x80) ) );
+    __m128i fourth = _mm_subs_epu8( prev3, _mm_set1_epi8( (char)(0xF0 - 0x80) ) );
+    __m128i must23 = _mm_and_si128( _mm_or_si128( third, fourth ), _mm_set1_epi8( (char)0x80 ) );
+
+    /* a continuation there is a TWO_CONTS the tables flagged in error */
+    return _mm_xor_si128( must23, special );
+}
+
+__attribute__((target("ssse3")))
+static int UTF8_ValidateSSSE3( const unsigned char *s, size_t len, size_t *outCount )
+{
+    /* bytes above BF as signed, so not continuations */
+    const __m128i continuationMax = _mm_set1_epi8( (char)0xBF );
+    const __m128i incompleteMax = _mm_loadu_si128( (const __m128i*)(UTF8_INCOMPLETE_MAX + 16) );
+    __m128i prev = _mm_setzero_si128();
+    __m128i errors = _mm_setzero_si128();
+    __m128i incomplete = _mm_setzero_si128();
+    __m128i block;
+    unsigned char tail[16];
+    size_t pos = 0, count = 0;
+
+    for ( ; pos + 16 <= len; pos += 16 )
+    {
+        block = _mm_loadu_si128( (const __m128i*)(s + pos) );
+        if ( _mm_movemask_epi8( block ) == 0 )
+        {
+            errors = _mm_or_si128( errors, incomplete );
+            count += 16;
+        }
+        else
+        {
+            errors = _mm_or_si128( errors, UTF8_BlockErrorsSSSE3( block, prev ) );
+            incomplete = _mm_subs_epu8( block, incompleteMax );
+            count += UTF8_PopCount( (unsigned)_mm_movemask_epi8(
+                         _mm_cmpgt_epi8( block, continuationMax ) ) );
+        }
+        prev = block;
+    }
+
+    /* the rest, padded with NULs, which also ends a sequence the last
+       block left open */
+    memset( tail, 0, sizeof(tail) );
+    if ( pos < len )
+        memcpy( tail, s + pos, len - pos );
+    block = _mm_loadu_si128( (const __m128i*)tail );
+    errors = _mm_or_si128( errors, UTF8_BlockErrorsSSSE3( block, prev ) );
+    count += UTF8_PopCount( (unsigned)_mm_movemask_epi8( _mm_cmpgt_epi8( block, continuationMax ) ) &
+                            ((1u << (len - pos)) - 1) );
+
+    if ( _mm_movemask_epi8( _mm_cmpeq_epi8( errors, _mm_setzero_si128() ) ) != 0xFFFF )
+        return 0;
+
+    *outCount = count;
+    return 1;
+}
+
+/* the 32 bytes that end n bytes before the end of block */
+#define UTF8_PREV_AVX2( block, prev, n ) \
+    _mm256_alignr_epi8( (block), _mm256_permute2x128_si256( (prev), (block), 0x21 ), 16 - (n) )
+
+__attribute__((target("avx2")))
+static __m256i UTF8_BlockErrorsAVX2( __m256i block, __m256i prev )
+{
+    const __m256i nibble = _mm256_set1_epi8( 0x0F );
+    __m256i prev1 = UTF8_PREV_AVX2( block, prev, 1 );
+    __m256i prev2 = UTF8_PREV_AVX2( block, prev, 2 );
+    __m256i prev3 = UTF8_PREV_AVX2( block, prev, 3 );
+    __m256i byte1High = _mm256_shuffle_epi8(
+        _mm256_broadcastsi128_si256( _mm_loadu_si128( (const __m128i*)UTF8_BYTE1_HIGH ) ),
+        _mm256_and_si256( _mm256_srli_epi16( prev1, 4 ), nibble ) );
+    __m256i byte1Low = _mm256_shuffle_epi8(
+        _mm256_broadcastsi128_si256( _mm_loadu_si128( (const __m128i*)UTF8_BYTE1_LOW ) ),
+        _mm256_and_si256( prev1, nibble ) );
+    __m256i byte2High = _mm256_shuffle_epi8(
+        _mm256_broadcastsi128_si256( _mm_loadu_si128( (const __m128i*)UTF8_BYTE2_HIGH ) ),
+        _mm256_and_si256( _mm256_srli_epi16( block, 4 ), nibble ) );
+    __m256i special = _mm256_and_si256( _mm256_and_si256( byte1High, byte1Low ), byte2High );
+    __m256i third = _mm256_subs_epu8( prev2, _mm256_set1_epi8( (char)(0xE0 - 0x80) ) );
+    __m256i fourth = _mm256_subs_epu8( prev3, _mm256_set1_epi8( (char)(0xF0 - 0x80) ) );
+    __m256i must23 = _mm256_and_si256( _mm256_or_si256( third, fourth ),
+                                       _mm256_set1_epi8( (char)0x80 ) );
+
+    return _mm256_xor_si256( must23, special );
+}
+
+__attribute__((target("avx2")))
+static int UTF8_ValidateAVX2( const unsigned char *s, size_t len, size_t *outCount )
+{
+    const __m256i continuationMax = _mm256_set1_epi8( (char)0xBF );
+    const __m256i incompleteMax = _mm256_loadu_si256( (const __m256i*)UTF8_INCOMPLETE_MAX );
+    __m256i prev = _mm256_setzero_si256();
+    __m256i errors = _mm256_setzero_si256();
+    __m256i incomplete = _mm256_setzero_si256();
+    __m256i block;
+    unsigned char tail[32];
+    size_t pos = 0, count = 0;
+
+    for ( ; pos + 32 <= len; pos += 32 )
+    {
+        block = _mm256_loadu_si256( (const __m256i*)(s + pos) );
+        if ( _mm256_movemask_epi8( block ) == 0 )
+        {
+            errors = _mm256_or_si256( errors, incomplete );
+            count += 32;
+        }
+        else
+        {
+            errors = _mm256_or_si256( errors, UTF8_BlockErrorsAVX2( block, prev ) );
+            incomplete = _mm256_subs_epu8( block, incompleteMax );
+            count += UTF8_PopCount( (unsigned)_mm256_movemask_epi8(
+                         _mm256_cmpgt_epi8( block, continuationMax ) ) );
+        }
+        prev = block;
+    }
+
+    memset( tail, 0, sizeof(tail) );
+    if ( pos < len )
+        memcpy( tail, s + pos, len - pos );
+    block = _mm256_loadu_si256( (const __m256i*)tail );
+    errors = _mm256_or_si256( errors, UTF8_BlockErrorsAVX2( block, prev ) );
+    count += UTF8_PopCount( (unsigned)_mm256_movemask_epi8( _mm256_cmpgt_epi8( block, continuationMax ) ) &
+                            ((1u << (len - pos)) - 1) );
+
+    if ( !_mm256_testz_si256( errors, errors ) )
+        return 0;
+
+    *outCount = count;
+    return 1;
+}
+#endif
+
+/* 0 until checked, then the best validator the CPU has, or less after
+   NFDi_UTF8_SetISA; racing threads find the same answer */
+static uint64_t g_utf8ISA = 0;
+
+static int UTF8_SupportedISA( void )
+{
+#ifdef NFD_UTF8_SIMD
+    __builtin_cpu_init();
+    if ( __builtin_cpu_supports("avx2") )
+        return NFD_UTF8_AVX2;
+    if ( __builtin_cpu_supports("ssse3") )
+        return NFD_UTF8_SSSE3;
+#endif
+    return NFD_UTF8_SCALAR;
+}
+
+int NFDi_UTF8_GetISA( void )
+{
+    uint64_t isa = NFD_ATOMIC_LOAD( &g_utf8ISA );
+
+    if ( isa == 0 )
+    {
+        NFD_ATOMIC_CAS( &g_utf8ISA, 0, (uint64_t)UTF8_SupportedISA() );
+        isa = NFD_ATOMIC_LOAD( &g_utf8ISA );
+    }
+
+    return (int)isa;
+}
+
+int NFDi_UTF8_SetISA( int isa )
+{
+    int supported = UTF8_SupportedISA();
+    uint64_t old;
+
+    if ( isa > supported )
+        isa = supported;
+    do
+        old = NFD_ATOMIC_LOAD( &g_utf8ISA );
+    while ( NFD_ATOMIC_CAS( &g_utf8ISA, old, (uint64_t)isa ) != old );
+
+    return isa;
+}
+
+int NFDi_UTF8_Validate( const nfdchar_t *str, size_t len, size_t *outCount )
+{
+    size_t count = 0;
+    int valid;
+
+    switch ( NFDi_UTF8_GetISA() )
+    {
+#ifdef NFD_UTF8_SIMD
+    case NFD_UTF8_AVX2:
+        valid = UTF8_ValidateAVX2( (const unsigned char*)str, len, &count );
+        break;
+    case NFD_UTF8_SSSE3:
+        valid = UTF8_ValidateSSSE3( (const unsigned char*)str, len, &count );
+        break;
+#endif
+    default:
+        valid = NFDi_UTF8_ValidateScalar( str, len, &count );
+        break;
+    }
+
+    if ( valid && outCount )
+        *outCount = count;
+    return valid;
+}
+
 int32_t NFDi_UTF8_Strlen( const nfdchar_t *str )
 {
-	/* This function doesn't properly check validity of UTF-8 character 
-	sequence, it is supposed to use only with valid UTF-8 strings. */
-    
-	int32_t character_count = 0;
-	int32_t i = 0; /* Counter used to iterate over string. */
-	nfdchar_t maybe_bom[4];
-	
-	/* If there is UTF-8 BOM ignore it. */
-	if (strlen(str) > 2)
-	{
-		strncpy(maybe_bom, str, 3);
-		maybe_bom[3] = 0;
-		if (strcmp(maybe_bom, (nfdchar_t*)NFD_UTF8_BOM) == 0)
-			i += 3;
-	}
-	
-	while(str[i])
-	{
-		if (str[i] >> 7 == 0)
-        {
-            /* If bit pattern begins with 0 we have ascii character. */ 
-			++character_count;
-        }
-		else if (str[i] >> 6 == 3)
-        {
-		/* If bit pattern begins with 11 it is beginning of UTF-8 byte sequence. */
-			++character_count;
-        }
-		else if (str[i] >> 6 == 2)
-			;		/* If bit pattern begins with 10 it is middle of utf-8 byte sequence. */
-		else
-        {
-            /* In any other case this is not valid UTF-8. */
-			return -1;
-        }
-		++i;
-	}
-
-	return character_count;	
+    size_t len = strlen(str);
+    size_t count;
+
+    /* If there is UTF-8 BOM ignore it. */
+    if ( len >= 3 && memcmp( str, NFD_UTF8_BOM, 3 ) == 0 )
+    {
+        str += 3;
+        len -= 3;
+    }
+
+    if ( !NFDi_UTF8_Validate( str, len, &count ) || count > INT32_MAX )
+        return -1;
+
+    return (int32_t)count;
+}
+
+int NFDi_UTF8_CheckPath( const nfdchar_t *path, size_t len )
+{
+    if ( !NFDi_UTF8_Validate( path, len, NULL ) )
+    {
+        NFDi_SetErrorCode( NFD_ERR_INVALID_UTF8, INVALID_UTF8_MSG );
+        return 0;
+    }
+
+    return 1;
+}
+
+nfdresult_t NFDi_PathSet_CheckUTF8( nfdpathset_t *pathSet )
+{
+    size_t count = NFD_PathSet_GetCount( pathSet );
+    size_t i;
+
+    for ( i = 0; i < count; ++i )
+    {
+        size_t len;
+        const nfdchar_t *path = NFD_PathSet_GetPathN( pathSet, i, &len );
+
+        if ( !NFDi_UTF8_CheckPath( path, len ) )
+        {
+            NFD_PathSet_Free( pathSet );
+            return NFD_ERROR;
+        }
+    }
+
+    return NFD_OKAY;
+}
+
+const nfdchar_t *NFDi_Filter_GetSpec( const nfdfilter_t *filter, size_t index, size_t *outLen )
+{
+    assert(filter);
+    assert(index < filter->specCount);
+
+    if ( outLen )
+        *outLen = filter->specs[index].len;
+    return filter->list + filter->specs[index].offset;
+}
+
+const nfdchar_t *NFDi_Filter_GetSource( const nfdfilter_t *filter )
+{
+    return filter ? filter->source : NULL;
 }
 
 int NFDi_IsFilterSegmentChar( char ch )
@@ -23,13 +23,224 @@ extern "C" {
 
 #define NFD_UTF8_BOM "\xEF\xBB\xBF"
 
+/* USDT probes under the "nfd" provider, for bpftrace, perf and
+   SystemTap.  Built only with NFD_USDT defined (premake5 --usdt), which
+   needs <sys/sdt.h>; otherwise they compile to nothing and their
+   arguments are not evaluated.  A probe's name and arguments are part
+   of the interface tools/nfd_phases.bt relies on: add probes rather
+   than changing them.
+
+     call_entry(const char *function)
+     call_return(const char *function, int result)
+     phase(const char *name, int phase, uint64_t startNs, uint64_t endNs)
+     pathset_start(size_t count, size_t bytes)
+     pathset_end(size_t count, size_t bytes, int ok)
+     gtk_init_start()
+     gtk_init_end(int ok)
+     exec_spawn(const char *file)
+     exec_start(const char *file, int pid)
+     exec_eof(int pid)
+     exec_wait(int pid, int exitCode)
+*/
+#if defined(NFD_USDT) && defined(__linux__)
+#include <sys/sdt.h>
+#define NFDi_PROBE(name)                     DTRACE_PROBE(nfd, name)
+#define NFDi_PROBE1(name, a)                 DTRACE_PROBE1(nfd, name, a)
+#define NFDi_PROBE2(name, a, b)              DTRACE_PROBE2(nfd, name, a, b)
+#define NFDi_PROBE3(name, a, b, c)           DTRACE_PROBE3(nfd, name, a, b, c)
+#define NFDi_PROBE4(name, a, b, c, d)        DTRACE_PROBE4(nfd, name, a, b, c, d)
+#else
+#define NFDi_PROBE(name)
+#define NFDi_PROBE1(name, a)
+#define NFDi_PROBE2(name, a, b)
+#define NFDi_PROBE3(name, a, b, c)
+#define NFDi_PROBE4(name, a, b, c, d)
+#endif
+
+/* in backends, around the public NFD_* functions: fires the call probes
+   and scopes the lastCall statistics of NFD_GetStats */
+#define NFDi_CALL_ENTRY()          do { NFDi_Stats_BeginCall(); NFDi_PROBE1(call_entry, __func__); } while (0)
+#define NFDi_CALL_RETURN(result)   do { NFDi_PROBE2(call_return, __func__, (int)(result)); NFDi_Stats_EndCall(); } while (0)
+
+/* counters behind NFD_GetStats, in the order of nfdstatcounts_t */
+typedef enum {
+    NFD_STAT_CALLS,
+    NFD_STAT_ALLOCS,
+    NFD_STAT_ALLOC_BYTES,
+    NFD_STAT_PEAK_PATHSET_BYTES,
+    NFD_STAT_CAPTURE_REALLOCS,
+    NFD_STAT_READS,
+    NFD_STAT_SPAWN_NS,
+    NFD_STAT_PATHS,
+    NFD_STAT_COUNT
+} nfdstat_t;
+
+struct nfdcontext_s
+{
+    char errorstr[NFD_MAX_STRLEN];
+    nfderror_t errorCode;
+    nfdallocfn_t allocFn;      /* NULL for malloc and free */
+    nfdfreefn_t freeFn;
+    void *allocUserData;
+    int timeoutMs;
+};
+
 
 void  *NFDi_Malloc( size_t bytes );
+void  *NFDi_Realloc( void *ptr, size_t oldBytes, size_t bytes );
 void   NFDi_Free( void *ptr );
 void   NFDi_SetError( const char *msg );
+void   NFDi_SetErrorCode( nfderror_t code, const char *msg );
+int    NFDi_GetTimeout( void );
+/* the context bound to the calling thread, or NULL */
+nfdcontext_t *NFDi_GetContext( void );
+/* NFDi_Trace_Begin returns 0 when no trace hook is installed, and
+   NFDi_Trace_End then does nothing.  NFD_USDT builds always time
+   phases, for the phase probe. */
+uint64_t NFDi_Trace_Now( void );
+uint64_t NFDi_Trace_Begin( void );
+void   NFDi_Trace_End( nfdphase_t phase, uint64_t start );
+/* add to a counter, or raise it to value for the peak counters, in the
+   thread's current call and in the process totals */
+void   NFDi_Stats_Add( nfdstat_t stat, uint64_t value );
+void   NFDi_Stats_Max( nfdstat_t stat, uint64_t value );
+/* calls nest; the outermost one starts and ends the lastCall counts */
+void   NFDi_Stats_BeginCall( void );
+void   NFDi_Stats_EndCall( void );
+/* atomics for state that backends share between threads, as the
+   statistics are shared, but ordered: whatever a thread wrote before
+   its CAS is visible to one that loads the value it stored.
+   NFDi_Atomic_CAS returns the value it found, which equals expected if
+   desired was stored */
+uint64_t NFDi_Atomic_Load( uint64_t *value );
+uint64_t NFDi_Atomic_CAS( uint64_t *value, uint64_t expected, uint64_t desired );
+/* Headless dialogs -- see NFD_Headless_SetCallback.  Backends ask
+   NFDi_Headless_IsEnabled before showing a dialog, and have
+   NFDi_Headless_Dialog answer it instead if it is.  It compiles
+   filterList unless given filter, and fills outPaths for
+   NFD_DIALOG_OPEN_MULTIPLE, outPath otherwise. */
+int    NFDi_Headless_IsEnabled( void );
+nfdresult_t NFDi_Headless_Dialog( nfddialogtype_t type,
+                                  const nfdchar_t *filterList,
+                                  nfdfilter_t *filter,
+                                  const nfdchar_t *defaultPath,
+                                  nfdchar_t **outPath,
+                                  nfdpathset_t *outPaths );
 int    NFDi_SafeStrncpy( char *dst, const char *src, size_t maxCopy );
 int32_t NFDi_UTF8_Strlen( const nfdchar_t *str );
+/* non-zero if str is valid UTF-8, with the number of code points in
+   *outCount if it is not NULL.  Uses SSSE3 or AVX2 where available;
+   the scalar version gives the same answer everywhere. */
+int    NFDi_UTF8_Validate( const nfdchar_t *str, size_t len, size_t *outCount );
+int    NFDi_UTF8_ValidateScalar( const nfdchar_t *str, size_t len, size_t *outCount );
+/* the validator NFDi_UTF8_Validate uses, the best the CPU has unless
+   lowered, for benchmarks to compare them.  SetISA returns the one it
+   picked, which is never better than the CPU has. */
+#define NFD_UTF8_SCALAR  1
+#define NFD_UTF8_SSSE3   2
+#define NFD_UTF8_AVX2    3
+int    NFDi_UTF8_GetISA( void );
+int    NFDi_UTF8_SetISA( int isa );
+/* for paths returned by a dialog: sets the error and returns 0 if path
+   is not valid UTF-8 */
+int    NFDi_UTF8_CheckPath( const nfdchar_t *path, size_t len );
 int    NFDi_IsFilterSegmentChar( char ch );
+
+/* A filter list compiled by NFD_Filter_Compile.  list is a copy of the
+   filter list with every separator replaced by '\0', so each extension
+   is a string of its own, described by an offset and length in specs.
+   The offsets index source too.  A group is a run of specs that ends
+   at a ';'.  Every backend reads filter lists through this table, and
+   keeps what it builds from it in backendData, built on first use.
+
+   A spec holding '*', '?' or '[' is a glob matched against the whole
+   file name, and is compiled into ops; any other spec is an extension.
+   A list that starts with NFD_FILTER_IGNORE_CASE ignores ASCII case. */
+#define NFD_FILTER_IGNORE_CASE "(?i)"
+#define NFD_FILTER_ANY_GROUP   ((size_t)-1)
+
+typedef struct {
+    size_t offset;
+    size_t len;
+    size_t firstOp;    /* the glob's ops, opCount 0 for an extension */
+    size_t opCount;
+} nfdfilterspec_t;
+
+typedef struct {
+    size_t firstSpec;
+    size_t specCount;
+} nfdfiltergroup_t;
+
+typedef enum {
+    NFD_GLOB_SET,      /* one byte from set */
+    NFD_GLOB_ANY,      /* one UTF-8 character */
+    NFD_GLOB_STAR      /* any run of characters */
+} nfdglobtype_t;
+
+typedef struct {
+    nfdglobtype_t type;
+    uint32_t      set[8];
+    uint32_t      foldSet[8];  /* set when ignoring case */
+} nfdglobop_t;
+
+struct nfdfilter_s {
+    nfdchar_t        *source;     /* the filter list as passed in */
+    nfdchar_t        *list;
+    nfdfilterspec_t  *specs;
+    size_t            specCount;
+    nfdfiltergroup_t *groups;
+    size_t            groupCount;
+    int               ignoreCase;
+    nfdglobop_t      *ops;
+    size_t            opCount;
+    size_t           *globSpecs;  /* index of every glob in specs */
+    size_t            globCount;
+    size_t           *matchTable; /* spec index + 1 by extension hash, 0 if empty */
+    size_t            matchTableSize;
+    void             *backendData;
+    void            (*freeBackendData)( void *backendData );
+};
+
+/* the extension or glob at index in specs, null terminated */
+const nfdchar_t *NFDi_Filter_GetSpec( const nfdfilter_t *filter, size_t index, size_t *outLen );
+/* non-zero if the spec at index is a glob rather than an extension */
+int              NFDi_Filter_IsGlob( const nfdfilter_t *filter, size_t index );
+/* the filter list a filter was compiled from, NULL for a NULL filter */
+const nfdchar_t *NFDi_Filter_GetSource( const nfdfilter_t *filter );
+/* non-zero if a file name, without its directory, matches a spec of
+   group, or of any group for NFD_FILTER_ANY_GROUP.  ASCII case is
+   ignored if foldCase is set or the filter list asked for it. */
+int              NFDi_Filter_MatchName( const nfdfilter_t *filter, size_t group,
+                                        const nfdchar_t *name, size_t len, int foldCase );
+
+/* Path set construction shared by the backends.  Allocate room for
+   count paths totalling bufSize bytes including null terminators,
+   then fill the returned byte area and describe each path with
+   NFDi_PathSet_SetEntry. */
+nfdchar_t *NFDi_PathSet_Alloc( nfdpathset_t *pathSet, size_t count, size_t bufSize );
+void       NFDi_PathSet_SetEntry( nfdpathset_t *pathSet, size_t index, size_t offset, size_t len );
+/* frees pathSet and returns NFD_ERROR if a path is not valid UTF-8 */
+nfdresult_t NFDi_PathSet_CheckUTF8( nfdpathset_t *pathSet );
+
+/* Incremental parser for separator-delimited path lists, such as the
+   output of zenity --multiple.  Bytes are split as they are fed in,
+   so the list never has to be buffered and rescanned. */
+typedef struct {
+    nfdchar_t *buf;        /* path bytes, separators replaced by '\0' */
+    size_t     bufUsed;
+    size_t     bufSize;
+    size_t    *starts;     /* byte offset of each path in buf */
+    size_t     count;
+    size_t     startsSize;
+    char       separator;
+    int        failed;
+} nfdpathparser_t;
+
+void        NFDi_PathParser_Init( nfdpathparser_t *parser, char separator );
+void        NFDi_PathParser_Feed( nfdpathparser_t *parser, const char *data, size_t len );
+/* trims one trailing newline and moves the result into pathSet */
+nfdresult_t NFDi_PathParser_Finish( nfdpathparser_t *parser, nfdpathset_t *pathSet );
+void        NFDi_PathParser_Free( nfdpathparser_t *parser );
     
 #ifdef __cplusplus
 }
@@ -5,6 +5,7 @@
 */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <assert.h>
 #include <string.h>
 #include <gtk/gtk.h>
@@ -15,81 +16,166 @@
 const char INIT_FAIL_MSG[] = "gtk_init_check failed to initilaize GTK+";
 
 
-static void AddTypeToFilterName( const char *typebuf, char *filterName, size_t bufsize )
+/* what a group's custom GtkFileFilter matches names against */
+typedef struct {
+    const nfdfilter_t *filter;
+    size_t group;
+} GroupMatcher;
+
+/* a compiled filter's GtkFileFilters, one per group and then the
+   wildcard, built on first use and kept with the filter */
+typedef struct {
+    GtkFileFilter **fileFilters;
+    GroupMatcher *matchers;
+    size_t count;
+} CompiledFilters;
+
+static void FreeCompiledFilters( void *backendData )
 {
-    const char SEP[] = ", ";
+    CompiledFilters *compiled = (CompiledFilters*)backendData;
+    size_t i;
 
-    size_t len = strlen(filterName);
-    if ( len != 0 )
+    if ( compiled->fileFilters )
     {
-        strncat( filterName, SEP, bufsize - len - 1 );
-        len += strlen(SEP);
+        for ( i = 0; i < compiled->count; ++i )
+        {
+            if ( compiled->fileFilters[i] )
+                g_object_unref( compiled->fileFilters[i] );
+        }
+        NFDi_Free( compiled->fileFilters );
     }
-    
-    strncat( filterName, typebuf, bufsize - len - 1 );
+    if ( compiled->matchers )
+        NFDi_Free( compiled->matchers );
+    NFDi_Free( compiled );
 }
 
-static void AddFiltersToDialog( GtkWidget *dialog, const char *filterList )
+/* runs the filter's own matcher, which handles globs and ignoring case
+   where GTK's patterns cannot */
+static gboolean MatchGroup( const GtkFileFilterInfo *info, gpointer userData )
 {
-    GtkFileFilter *filter;
-    char typebuf[NFD_MAX_STRLEN] = {0};
-    const char *p_filterList = filterList;
-    char *p_typebuf = typebuf;
-    char filterName[NFD_MAX_STRLEN] = {0};
-    
-    if ( !filterList || strlen(filterList) == 0 )
-        return;
+    const GroupMatcher *matcher = (const GroupMatcher*)userData;
+
+    if ( !info->display_name )
+        return FALSE;
+
+    return NFDi_Filter_MatchName( matcher->filter, matcher->group,
+                                  info->display_name, strlen(info->display_name), 0 );
+}
 
-    filter = gtk_file_filter_new();
-    while ( 1 )
+static GtkFileFilter *NewGroupFilter( GroupMatcher *matcher )
+{
+    const nfdfilter_t *filter = matcher->filter;
+    const nfdfiltergroup_t *group = &filter->groups[matcher->group];
+    GtkFileFilter *fileFilter;
+    size_t nameSize = 1;
+    char *name, *p_name;
+    size_t i;
+
+    for ( i = 0; i < group->specCount; ++i )
+        nameSize += filter->specs[group->firstSpec + i].len + 2;
+
+    name = NFDi_Malloc( nameSize );
+    if ( !name )
+        return NULL;
+    p_name = name;
+
+    for ( i = 0; i < group->specCount; ++i )
     {
-        
-        if ( NFDi_IsFilterSegmentChar(*p_filterList) )
+        size_t len;
+        const nfdchar_t *spec = NFDi_Filter_GetSpec( filter, group->firstSpec + i, &len );
+
+        if ( i > 0 )
         {
-            char typebufWildcard[NFD_MAX_STRLEN];
-            /* add another type to the filter */
-            assert( strlen(typebuf) > 0 );
-            assert( strlen(typebuf) < NFD_MAX_STRLEN-1 );
-            
-            snprintf( typebufWildcard, NFD_MAX_STRLEN, "*.%s", typebuf );
-            AddTypeToFilterName( typebuf, filterName, NFD_MAX_STRLEN );
-            
-            gtk_file_filter_add_pattern( filter, typebufWildcard );
-            
-            p_typebuf = typebuf;
-            memset( typebuf, 0, sizeof(char) * NFD_MAX_STRLEN );
+            memcpy( p_name, ", ", 2 );
+            p_name += 2;
         }
-        
-        if ( *p_filterList == ';' || *p_filterList == '\0' )
-        {
-            /* end of filter -- add it to the dialog */
-            
-            gtk_file_filter_set_name( filter, filterName );
-            gtk_file_chooser_add_filter( GTK_FILE_CHOOSER(dialog), filter );
+        memcpy( p_name, spec, len );
+        p_name += len;
+    }
+    *p_name = '\0';
 
-            filterName[0] = '\0';
+    fileFilter = gtk_file_filter_new();
+    gtk_file_filter_set_name( fileFilter, name );
+    gtk_file_filter_add_custom( fileFilter, GTK_FILE_FILTER_DISPLAY_NAME,
+                                MatchGroup, matcher, NULL );
 
-            if ( *p_filterList == '\0' )
-                break;
+    NFDi_Free( name );
+
+    /* owned by the compiled filter, not the first dialog it is added to */
+    g_object_ref_sink( fileFilter );
+    return fileFilter;
+}
 
-            filter = gtk_file_filter_new();            
+static CompiledFilters *NewCompiledFilters( nfdfilter_t *filter )
+{
+    CompiledFilters *compiled;
+    GtkFileFilter *wildcard;
+    size_t i;
+
+    compiled = NFDi_Malloc( sizeof(CompiledFilters) );
+    if ( !compiled )
+        return NULL;
+
+    compiled->count = filter->groupCount + 1;
+    compiled->fileFilters = NFDi_Malloc( sizeof(GtkFileFilter*) * compiled->count );
+    compiled->matchers = NFDi_Malloc( sizeof(GroupMatcher) * filter->groupCount );
+    if ( compiled->fileFilters )
+        memset( compiled->fileFilters, 0, sizeof(GtkFileFilter*) * compiled->count );
+    if ( !compiled->fileFilters || !compiled->matchers )
+    {
+        FreeCompiledFilters( compiled );
+        return NULL;
+    }
+
+    for ( i = 0; i < filter->groupCount; ++i )
+    {
+        compiled->matchers[i].filter = filter;
+        compiled->matchers[i].group = i;
+        compiled->fileFilters[i] = NewGroupFilter( &compiled->matchers[i] );
+        if ( !compiled->fileFilters[i] )
+        {
+            FreeCompiledFilters( compiled );
+            return NULL;
         }
+    }
 
-        if ( !NFDi_IsFilterSegmentChar( *p_filterList ) )
+    wildcard = gtk_file_filter_new();
+    gtk_file_filter_set_name( wildcard, "*.*" );
+    gtk_file_filter_add_pattern( wildcard, "*" );
+    compiled->fileFilters[filter->groupCount] = g_object_ref_sink( wildcard );
+
+    return compiled;
+}
+
+static nfdresult_t AddCompiledFiltersToDialog( GtkWidget *dialog, nfdfilter_t *filter )
+{
+    CompiledFilters *compiled;
+    uint64_t traceStart;
+    size_t i;
+
+    if ( !filter || filter->groupCount == 0 )
+        return NFD_OKAY;
+
+    traceStart = NFDi_Trace_Begin();
+    compiled = (CompiledFilters*)filter->backendData;
+    if ( !compiled )
+    {
+        compiled = NewCompiledFilters( filter );
+        if ( !compiled )
         {
-            *p_typebuf = *p_filterList;
-            p_typebuf++;
+            NFDi_Trace_End( NFD_PHASE_FILTER_BUILD, traceStart );
+            return NFD_ERROR;
         }
 
-        p_filterList++;
+        filter->backendData = compiled;
+        filter->freeBackendData = FreeCompiledFilters;
     }
-    
-    /* always append a wildcard option to the end*/
 
-    filter = gtk_file_filter_new();
-    gtk_file_filter_set_name( filter, "*.*" );
-    gtk_file_filter_add_pattern( filter, "*" );
-    gtk_file_chooser_add_filter( GTK_FILE_CHOOSER(dialog), filter );
+    for ( i = 0; i < compiled->count; ++i )
+        gtk_file_chooser_add_filter( GTK_FILE_CHOOSER(dialog), compiled->fileFilters[i] );
+
+    NFDi_Trace_End( NFD_PHASE_FILTER_BUILD, traceStart );
+    return NFD_OKAY;
 }
 
 static void SetDefaultPath( GtkWidget *dialog, const char *defaultPath )
@@ -108,21 +194,17 @@ static void SetDefaultPath( GtkWidget *dialog, const char *defaultPath )
 static nfdresult_t AllocPathSet( GSList *fileList, nfdpathset_t *pathSet )
 {
     size_t bufSize = 0;
+    size_t count;
     GSList *node;
+    nfdchar_t *buf;
     nfdchar_t *p_buf;
-    size_t count = 0;
+    size_t index = 0;
     
     assert(fileList);
     assert(pathSet);
 
-    pathSet->count = (size_t)g_slist_length( fileList );
-    assert( pathSet->count > 0 );
-
-    pathSet->indices = NFDi_Malloc( sizeof(size_t)*pathSet->count );
-    if ( !pathSet->indices )
-    {
-        return NFD_ERROR;
-    }
+    count = (size_t)g_slist_length( fileList );
+    assert( count > 0 );
 
     /* count the total space needed for buf */
     for ( node = fileList; node; node = node->next )
@@ -131,25 +213,27 @@ static nfdresult_t AllocPathSet( GSList *fileList, nfdpathset_t *pathSet )
         bufSize += strlen( (const gchar*)node->data ) + 1;
     }
 
-    pathSet->buf = NFDi_Malloc( sizeof(nfdchar_t) * bufSize );
+    buf = NFDi_PathSet_Alloc( pathSet, count, bufSize );
+    if ( !buf )
+    {
+        g_slist_free_full( fileList, g_free );
+        return NFD_ERROR;
+    }
 
     /* fill buf */
-    p_buf = pathSet->buf;
+    p_buf = buf;
     for ( node = fileList; node; node = node->next )
     {
         nfdchar_t *path = (nfdchar_t*)(node->data);
-        size_t byteLen = strlen(path)+1;
-        ptrdiff_t index;
+        size_t len = strlen(path);
         
-        memcpy( p_buf, path, byteLen );
+        memcpy( p_buf, path, len+1 );
         g_free(node->data);
 
-        index = p_buf - pathSet->buf;
-        assert( index >= 0 );
-        pathSet->indices[count] = (size_t)index;
+        NFDi_PathSet_SetEntry( pathSet, index, (size_t)(p_buf - buf), len );
 
-        p_buf += byteLen;
-        ++count;
+        p_buf += len+1;
+        ++index;
     }
 
     g_slist_free( fileList );
@@ -157,192 +241,661 @@ static nfdresult_t AllocPathSet( GSList *fileList, nfdpathset_t *pathSet )
     return NFD_OKAY;
 }
 
+/* GTK returns file names in the file system's encoding, which need
+   not be UTF-8 */
+static nfdresult_t CopyFilename( GtkWidget *dialog, nfdchar_t **outPath )
+{
+    char *filename = gtk_file_chooser_get_filename( GTK_FILE_CHOOSER(dialog) );
+    size_t len = strlen(filename);
+    uint64_t traceStart;
+
+    if ( !NFDi_UTF8_CheckPath( filename, len ) )
+    {
+        g_free( filename );
+        return NFD_ERROR;
+    }
+
+    traceStart = NFDi_Trace_Begin();
+    *outPath = NFDi_Malloc( len + 1 );
+    if ( *outPath )
+    {
+        memcpy( *outPath, filename, len + 1 );
+        NFDi_Stats_Add( NFD_STAT_PATHS, 1 );
+    }
+    g_free( filename );
+    NFDi_Trace_End( NFD_PHASE_ALLOC, traceStart );
+
+    return *outPath ? NFD_OKAY : NFD_ERROR;
+}
+
+/* closes the dialog as though cancel was pressed once the timeout set
+   with NFD_SetTimeout expires */
+typedef struct {
+    GtkWidget *dialog;
+    guint sourceId;
+} DialogTimeout;
+
+/* the show phase lasts until the dialog's window is mapped, and the
+   user_wait phase from then until gtk_dialog_run returns */
+typedef struct {
+    uint64_t showStart;
+    uint64_t waitStart;
+} DialogTrace;
+
+static void OnDialogMapped( GtkWidget *dialog, gpointer userData )
+{
+    DialogTrace *trace = (DialogTrace*)userData;
+    _NFD_UNUSED(dialog);
+
+    if ( trace->showStart )
+    {
+        NFDi_Trace_End( NFD_PHASE_SHOW, trace->showStart );
+        trace->showStart = 0;
+        trace->waitStart = NFDi_Trace_Begin();
+    }
+}
+
+static gboolean OnDialogTimeout( gpointer userData )
+{
+    DialogTimeout *timeout = (DialogTimeout*)userData;
+    timeout->sourceId = 0;
+    gtk_dialog_response( GTK_DIALOG(timeout->dialog), GTK_RESPONSE_CANCEL );
+    return G_SOURCE_REMOVE;
+}
+
+static void StartDialogTimeout( DialogTimeout *timeout, GtkWidget *dialog )
+{
+    int timeoutMs = NFDi_GetTimeout();
+    
+    timeout->dialog = dialog;
+    timeout->sourceId = 0;
+    if ( timeoutMs > 0 )
+        timeout->sourceId = g_timeout_add( (guint)timeoutMs, OnDialogTimeout, timeout );
+}
+
+static void StopDialogTimeout( DialogTimeout *timeout )
+{
+    if ( timeout->sourceId )
+        g_source_remove( timeout->sourceId );
+    timeout->sourceId = 0;
+}
+
+/* a dialog in gtk_dialog_run and how many times NFD_CancelDialogs had
+   been called before it was run.  The list is only touched on the
+   thread that runs dialogs, which is also where the idle callbacks that
+   NFD_CancelDialogs adds are dispatched. */
+typedef struct {
+    GtkWidget *dialog;
+    gint cancelCount;
+} RunningDialog;
+
+static GSList *runningDialogs = NULL;
+static gint cancelCount = 0;
+
+/* closes the dialogs that were already running when NFD_CancelDialogs
+   was called, but none opened since, which the call did not see */
+static gboolean OnCancelDialogs( gpointer userData )
+{
+    gint count = GPOINTER_TO_INT( userData );
+    GSList *node;
+
+    for ( node = runningDialogs; node; node = node->next )
+    {
+        RunningDialog *running = (RunningDialog*)node->data;
+        if ( running->cancelCount < count )
+            gtk_dialog_response( GTK_DIALOG(running->dialog), GTK_RESPONSE_CANCEL );
+    }
+    return G_SOURCE_REMOVE;
+}
+
+static gint RunDialog( GtkWidget *dialog )
+{
+    RunningDialog running;
+    DialogTimeout timeout;
+    DialogTrace trace;
+    gulong mapHandler = 0;
+    gint response;
+
+    trace.showStart = NFDi_Trace_Begin();
+    trace.waitStart = 0;
+    if ( trace.showStart )
+        mapHandler = g_signal_connect( dialog, "map", G_CALLBACK(OnDialogMapped), &trace );
+
+    running.dialog = dialog;
+    running.cancelCount = g_atomic_int_get( &cancelCount );
+    runningDialogs = g_slist_prepend( runningDialogs, &running );
+
+    StartDialogTimeout( &timeout, dialog );
+    response = gtk_dialog_run( GTK_DIALOG(dialog) );
+    StopDialogTimeout( &timeout );
+
+    runningDialogs = g_slist_remove( runningDialogs, &running );
+
+    if ( mapHandler )
+        g_signal_handler_disconnect( dialog, mapHandler );
+    NFDi_Trace_End( NFD_PHASE_SHOW, trace.showStart );
+    NFDi_Trace_End( NFD_PHASE_USER_WAIT, trace.waitStart );
+
+    return response;
+}
+
 static void WaitForCleanup(void)
 {
     while (gtk_events_pending())
         gtk_main_iteration();
 }
+
+/* Dialogs are hidden instead of destroyed after use, and kept for the
+   next call with the same action.  Reopening one skips rebuilding the
+   widget tree and rereading a folder it has already shown.  Only the
+   title, filters, selection and select multiple mode are reset, so a
+   NULL defaultPath reopens the folder the dialog was last closed in.
+   Indexed by GtkFileChooserAction.  Setting NFD_GTK_NO_POOL in the
+   environment destroys every dialog instead, so benchmarks can measure
+   what the pool saves. */
+static GtkWidget *dialogPool[GTK_FILE_CHOOSER_ACTION_SELECT_FOLDER + 1];
+static gboolean poolDisabled = FALSE;
+
+static void RemoveFilters( GtkWidget *dialog )
+{
+    GSList *filters = gtk_file_chooser_list_filters( GTK_FILE_CHOOSER(dialog) );
+    GSList *node;
+
+    for ( node = filters; node; node = node->next )
+        gtk_file_chooser_remove_filter( GTK_FILE_CHOOSER(dialog), GTK_FILE_FILTER(node->data) );
+
+    g_slist_free( filters );
+}
+
+static GtkWidget *AcquireDialog( const gchar *title,
+                                 GtkFileChooserAction action,
+                                 const gchar *acceptLabel )
+{
+    GtkWidget *dialog = dialogPool[action];
+    uint64_t traceStart = NFDi_Trace_Begin();
+
+    if ( !dialog )
+    {
+        dialog = gtk_file_chooser_dialog_new( title,
+                                              NULL,
+                                              action,
+                                              "_Cancel", GTK_RESPONSE_CANCEL,
+                                              acceptLabel, GTK_RESPONSE_ACCEPT,
+                                              NULL );
+        NFDi_Trace_End( NFD_PHASE_SHOW, traceStart );
+        return dialog;
+    }
+
+    /* taken out while in use, so a dialog is never handed out twice */
+    dialogPool[action] = NULL;
+
+    gtk_window_set_title( GTK_WINDOW(dialog), title );
+    RemoveFilters( dialog );
+    gtk_file_chooser_unselect_all( GTK_FILE_CHOOSER(dialog) );
+    gtk_file_chooser_set_select_multiple( GTK_FILE_CHOOSER(dialog), FALSE );
+    if ( action == GTK_FILE_CHOOSER_ACTION_SAVE )
+        gtk_file_chooser_set_current_name( GTK_FILE_CHOOSER(dialog), "" );
+
+    NFDi_Trace_End( NFD_PHASE_SHOW, traceStart );
+    return dialog;
+}
+
+static void ReleaseDialog( GtkWidget *dialog, GtkFileChooserAction action )
+{
+    uint64_t traceStart = NFDi_Trace_Begin();
+
+    gtk_widget_hide( dialog );
+    /* the filters' matchers point into a filter that may be freed next */
+    RemoveFilters( dialog );
+    WaitForCleanup();
+
+    if ( !poolDisabled && !dialogPool[action] )
+        dialogPool[action] = dialog;
+    else
+    {
+        gtk_widget_destroy( dialog );
+        WaitForCleanup();
+    }
+
+    NFDi_Trace_End( NFD_PHASE_CLEANUP, traceStart );
+}
+
+static void DestroyDialogPool( void )
+{
+    gboolean destroyed = FALSE;
+    size_t i;
+
+    for ( i = 0; i < sizeof(dialogPool) / sizeof(dialogPool[0]); ++i )
+    {
+        if ( dialogPool[i] )
+        {
+            gtk_widget_destroy( dialogPool[i] );
+            dialogPool[i] = NULL;
+            destroyed = TRUE;
+        }
+    }
+
+    if ( destroyed )
+        WaitForCleanup();
+}
+
+/* State set up by NFD_Init.  Without it, every dialog calls
+   gtk_init_check, which only does real work the first time. */
+static GThread *prewarmThread = NULL;
+static gboolean initialized = FALSE;
+static gpointer chooserClass = NULL;
+
+/* Initializes GTK and pays the one-time costs of the first file chooser
+   up front: the dialog class and its children are initialized, and the
+   icon theme is loaded and indexed.  GTK is not thread safe, so this
+   runs on the thread that shows the dialogs. */
+static gboolean InitGtk( void )
+{
+    uint64_t traceStart = NFDi_Trace_Begin();
+    gboolean ok;
+
+    NFDi_PROBE( gtk_init_start );
+    ok = gtk_init_check( NULL, NULL );
+    NFDi_PROBE1( gtk_init_end, (int)ok );
+    if ( !ok )
+    {
+        NFDi_Trace_End( NFD_PHASE_INIT, traceStart );
+        return FALSE;
+    }
+
+    if ( !chooserClass )
+        chooserClass = g_type_class_ref( GTK_TYPE_FILE_CHOOSER_DIALOG );
+    poolDisabled = getenv( "NFD_GTK_NO_POOL" ) != NULL;
+    gtk_icon_theme_has_icon( gtk_icon_theme_get_default(), "folder" );
+
+    NFDi_Trace_End( NFD_PHASE_INIT, traceStart );
+    return TRUE;
+}
+
+/* The parts of the first dialog's cost that GLib, GIO and fontconfig
+   make safe to pay from another thread, while GTK may be starting on
+   the caller's: the GIO classes the chooser lists folders with, the GIO
+   modules the default VFS loads, the MIME database that content types
+   come from, and fontconfig's configuration and font cache.  Nothing
+   here touches GTK or GDK. */
+static gpointer PrewarmThread( gpointer userData )
+{
+    uint64_t traceStart = NFDi_Trace_Begin();
+    GType types[4];
+    gpointer classes[4];
+    GFile *home;
+    GFileInfo *info;
+    PangoFontMap *fontMap;
+    PangoFontFamily **families = NULL;
+    int familyCount = 0;
+    size_t i;
+
+    _NFD_UNUSED(userData);
+
+    types[0] = G_TYPE_FILE_INFO;
+    types[1] = G_TYPE_FILE_ENUMERATOR;
+    types[2] = G_TYPE_FILE_MONITOR;
+    types[3] = G_TYPE_CANCELLABLE;
+    for ( i = 0; i < sizeof(types) / sizeof(types[0]); ++i )
+        classes[i] = g_type_class_ref( types[i] );
+
+    /* g_vfs_get_default loads every GIO module; the query sniffs a
+       content type, which loads shared-mime-info */
+    home = g_vfs_get_file_for_path( g_vfs_get_default(), g_get_home_dir() );
+    info = g_file_query_info( home, G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE,
+                              G_FILE_QUERY_INFO_NONE, NULL, NULL );
+    if ( info )
+        g_object_unref( info );
+    g_object_unref( home );
+
+    /* a font map of our own, so no GTK state is shared; listing its
+       families loads fontconfig's process wide configuration */
+    fontMap = pango_cairo_font_map_new();
+    pango_font_map_list_families( fontMap, &families, &familyCount );
+    g_free( families );
+    g_object_unref( fontMap );
+
+    /* the classes stay initialized once their last reference goes */
+    for ( i = 0; i < sizeof(types) / sizeof(types[0]); ++i )
+        g_type_class_unref( classes[i] );
+
+    NFDi_Trace_End( NFD_PHASE_INIT, traceStart );
+    return NULL;
+}
+
+/* called by every dialog before touching GTK */
+static gboolean EnsureGtk( void )
+{
+    uint64_t traceStart;
+    gboolean ok;
+
+    if ( initialized )
+        return TRUE;
+
+    /* a pre-warm that has not finished needs no waiting for: what it
+       loads is locked, so GTK either finds it loaded or loads it */
+    traceStart = NFDi_Trace_Begin();
+    NFDi_PROBE( gtk_init_start );
+    ok = gtk_init_check( NULL, NULL );
+    NFDi_PROBE1( gtk_init_end, (int)ok );
+    NFDi_Trace_End( NFD_PHASE_INIT, traceStart );
+    return ok;
+}
                                  
 /* public */
 
-nfdresult_t NFD_OpenDialog( const nfdchar_t *filterList,
-                            const nfdchar_t *defaultPath,
-                            nfdchar_t **outPath )
-{    
+nfdresult_t NFD_Init( void )
+{
+    nfdresult_t result = NFD_OKAY;
+
+    NFDi_CALL_ENTRY();
+    if ( !initialized )
+    {
+        if ( InitGtk() )
+        {
+            initialized = TRUE;
+        }
+        else
+        {
+            NFDi_SetErrorCode( NFD_ERR_UNAVAILABLE, INIT_FAIL_MSG );
+            result = NFD_ERROR;
+        }
+    }
+
+    NFDi_CALL_RETURN( result );
+    return result;
+}
+
+nfdresult_t NFD_InitAsync( void )
+{
+    if ( prewarmThread || initialized )
+        return NFD_OKAY;
+
+    prewarmThread = g_thread_new( "nfd-prewarm", PrewarmThread, NULL );
+    return NFD_OKAY;
+}
+
+void NFD_Quit( void )
+{
+    if ( prewarmThread )
+    {
+        g_thread_join( prewarmThread );
+        prewarmThread = NULL;
+    }
+
+    /* GTK itself cannot be shut down; drop what NFD_Init and the dialog
+       pool hold */
+    DestroyDialogPool();
+
+    if ( !initialized )
+        return;
+
+    if ( chooserClass )
+    {
+        g_type_class_unref( chooserClass );
+        chooserClass = NULL;
+    }
+    WaitForCleanup();
+    initialized = FALSE;
+}
+
+void NFD_CancelDialogs( void )
+{
+    /* g_idle_add may be called from any thread; the dialogs are only
+       touched once the callback runs on theirs */
+    gint count = g_atomic_int_add( &cancelCount, 1 ) + 1;
+    g_idle_add( OnCancelDialogs, GINT_TO_POINTER(count) );
+}
+
+static nfdresult_t OpenDialog( nfdfilter_t *filter,
+                               const nfdchar_t *defaultPath,
+                               nfdchar_t **outPath )
+{
     GtkWidget *dialog;
     nfdresult_t result;
 
-    if ( !gtk_init_check( NULL, NULL ) )
+    if ( NFDi_Headless_IsEnabled() )
+        return NFDi_Headless_Dialog( NFD_DIALOG_OPEN, NULL, filter, defaultPath, outPath, NULL );
+
+    if ( !EnsureGtk() )
     {
-        NFDi_SetError(INIT_FAIL_MSG);
+        NFDi_SetErrorCode( NFD_ERR_UNAVAILABLE, INIT_FAIL_MSG );
         return NFD_ERROR;
     }
 
-    dialog = gtk_file_chooser_dialog_new( "Open File",
-                                          NULL,
-                                          GTK_FILE_CHOOSER_ACTION_OPEN,
-                                          "_Cancel", GTK_RESPONSE_CANCEL,
-                                          "_Open", GTK_RESPONSE_ACCEPT,
-                                          NULL );
+    dialog = AcquireDialog( "Open File", GTK_FILE_CHOOSER_ACTION_OPEN, "_Open" );
 
     /* Build the filter list */
-    AddFiltersToDialog(dialog, filterList);
+    if ( AddCompiledFiltersToDialog( dialog, filter ) == NFD_ERROR )
+    {
+        ReleaseDialog( dialog, GTK_FILE_CHOOSER_ACTION_OPEN );
+        return NFD_ERROR;
+    }
 
     /* Set the default path */
     SetDefaultPath(dialog, defaultPath);
 
     result = NFD_CANCEL;
-    if ( gtk_dialog_run( GTK_DIALOG(dialog) ) == GTK_RESPONSE_ACCEPT )
+    if ( RunDialog( dialog ) == GTK_RESPONSE_ACCEPT )
     {
-        char *filename;
-
-        filename = gtk_file_chooser_get_filename( GTK_FILE_CHOOSER(dialog) );
-
+        if ( CopyFilename( dialog, outPath ) == NFD_ERROR )
         {
-            size_t len = strlen(filename);
-            *outPath = NFDi_Malloc( len + 1 );
-            memcpy( *outPath, filename, len + 1 );
-            if ( !*outPath )
-            {
-                g_free( filename );
-                gtk_widget_destroy(dialog);
-                return NFD_ERROR;
-            }
+            ReleaseDialog( dialog, GTK_FILE_CHOOSER_ACTION_OPEN );
+            return NFD_ERROR;
         }
-        g_free( filename );
 
         result = NFD_OKAY;
     }
 
-    WaitForCleanup();
-    gtk_widget_destroy(dialog);
-    WaitForCleanup();
+    ReleaseDialog( dialog, GTK_FILE_CHOOSER_ACTION_OPEN );
 
     return result;
 }
 
 
-nfdresult_t NFD_OpenDialogMultiple( const nfdchar_t *filterList,
-                                    const nfdchar_t *defaultPath,
-                                    nfdpathset_t *outPaths )
+static nfdresult_t OpenDialogMultiple( nfdfilter_t *filter,
+                                       const nfdchar_t *defaultPath,
+                                       nfdpathset_t *outPaths )
 {
     GtkWidget *dialog;
     nfdresult_t result;
 
-    if ( !gtk_init_check( NULL, NULL ) )
+    if ( NFDi_Headless_IsEnabled() )
+        return NFDi_Headless_Dialog( NFD_DIALOG_OPEN_MULTIPLE, NULL, filter, defaultPath, NULL, outPaths );
+
+    if ( !EnsureGtk() )
     {
-        NFDi_SetError(INIT_FAIL_MSG);
+        NFDi_SetErrorCode( NFD_ERR_UNAVAILABLE, INIT_FAIL_MSG );
         return NFD_ERROR;
     }
 
-    dialog = gtk_file_chooser_dialog_new( "Open Files",
-                                          NULL,
-                                          GTK_FILE_CHOOSER_ACTION_OPEN,
-                                          "_Cancel", GTK_RESPONSE_CANCEL,
-                                          "_Open", GTK_RESPONSE_ACCEPT,
-                                          NULL );
+    dialog = AcquireDialog( "Open Files", GTK_FILE_CHOOSER_ACTION_OPEN, "_Open" );
     gtk_file_chooser_set_select_multiple( GTK_FILE_CHOOSER(dialog), TRUE );
 
     /* Build the filter list */
-    AddFiltersToDialog(dialog, filterList);
+    if ( AddCompiledFiltersToDialog( dialog, filter ) == NFD_ERROR )
+    {
+        ReleaseDialog( dialog, GTK_FILE_CHOOSER_ACTION_OPEN );
+        return NFD_ERROR;
+    }
 
     /* Set the default path */
     SetDefaultPath(dialog, defaultPath);
 
     result = NFD_CANCEL;
-    if ( gtk_dialog_run( GTK_DIALOG(dialog) ) == GTK_RESPONSE_ACCEPT )
+    if ( RunDialog( dialog ) == GTK_RESPONSE_ACCEPT )
     {
         GSList *fileList = gtk_file_chooser_get_filenames( GTK_FILE_CHOOSER(dialog) );
-        if ( AllocPathSet( fileList, outPaths ) == NFD_ERROR )
+        if ( AllocPathSet( fileList, outPaths ) == NFD_ERROR ||
+             NFDi_PathSet_CheckUTF8( outPaths ) == NFD_ERROR )
         {
-            gtk_widget_destroy(dialog);
+            ReleaseDialog( dialog, GTK_FILE_CHOOSER_ACTION_OPEN );
             return NFD_ERROR;
         }
         
         result = NFD_OKAY;
     }
 
-    WaitForCleanup();
-    gtk_widget_destroy(dialog);
-    WaitForCleanup();
+    ReleaseDialog( dialog, GTK_FILE_CHOOSER_ACTION_OPEN );
 
     return result;
 }
 
-nfdresult_t NFD_SaveDialog( const nfdchar_t *filterList,
-                            const nfdchar_t *defaultPath,
-                            nfdchar_t **outPath )
+static nfdresult_t SaveDialog( nfdfilter_t *filter,
+                               const nfdchar_t *defaultPath,
+                               nfdchar_t **outPath )
 {
     GtkWidget *dialog;
     nfdresult_t result;
 
-    if ( !gtk_init_check( NULL, NULL ) )
+    if ( NFDi_Headless_IsEnabled() )
+        return NFDi_Headless_Dialog( NFD_DIALOG_SAVE, NULL, filter, defaultPath, outPath, NULL );
+
+    if ( !EnsureGtk() )
     {
-        NFDi_SetError(INIT_FAIL_MSG);
+        NFDi_SetErrorCode( NFD_ERR_UNAVAILABLE, INIT_FAIL_MSG );
         return NFD_ERROR;
     }
 
-    dialog = gtk_file_chooser_dialog_new( "Save File",
-                                          NULL,
-                                          GTK_FILE_CHOOSER_ACTION_SAVE,
-                                          "_Cancel", GTK_RESPONSE_CANCEL,
-                                          "_Save", GTK_RESPONSE_ACCEPT,
-                                          NULL ); 
+    dialog = AcquireDialog( "Save File", GTK_FILE_CHOOSER_ACTION_SAVE, "_Save" );
     gtk_file_chooser_set_do_overwrite_confirmation( GTK_FILE_CHOOSER(dialog), TRUE );
 
     /* Build the filter list */    
-    AddFiltersToDialog(dialog, filterList);
+    if ( AddCompiledFiltersToDialog( dialog, filter ) == NFD_ERROR )
+    {
+        ReleaseDialog( dialog, GTK_FILE_CHOOSER_ACTION_SAVE );
+        return NFD_ERROR;
+    }
 
     /* Set the default path */
     SetDefaultPath(dialog, defaultPath);
     
     result = NFD_CANCEL;    
-    if ( gtk_dialog_run( GTK_DIALOG(dialog) ) == GTK_RESPONSE_ACCEPT )
+    if ( RunDialog( dialog ) == GTK_RESPONSE_ACCEPT )
     {
-        char *filename;
-        filename = gtk_file_chooser_get_filename( GTK_FILE_CHOOSER(dialog) );
-        
+        if ( CopyFilename( dialog, outPath ) == NFD_ERROR )
         {
-            size_t len = strlen(filename);
-            *outPath = NFDi_Malloc( len + 1 );
-            memcpy( *outPath, filename, len + 1 );
-            if ( !*outPath )
-            {
-                g_free( filename );
-                gtk_widget_destroy(dialog);
-                return NFD_ERROR;
-            }
+            ReleaseDialog( dialog, GTK_FILE_CHOOSER_ACTION_SAVE );
+            return NFD_ERROR;
         }
-        g_free(filename);
 
         result = NFD_OKAY;
     }
 
-    WaitForCleanup();
-    gtk_widget_destroy(dialog);
-    WaitForCleanup();
+    ReleaseDialog( dialog, GTK_FILE_CHOOSER_ACTION_SAVE );
     
     return result;
 }
 
-nfdresult_t NFD_PickFolder(const nfdchar_t *defaultPath,
-    nfdchar_t **outPath)
+nfdresult_t NFD_OpenDialog( const nfdchar_t *filterList,
+                            const nfdchar_t *defaultPath,
+                            nfdchar_t **outPath )
+{
+    nfdfilter_t *filter;
+    nfdresult_t result;
+
+    NFDi_CALL_ENTRY();
+    result = NFD_Filter_Compile( filterList, &filter );
+    if ( result == NFD_OKAY )
+    {
+        result = OpenDialog( filter, defaultPath, outPath );
+        NFD_Filter_Free( filter );
+    }
+
+    NFDi_CALL_RETURN( result );
+    return result;
+}
+
+nfdresult_t NFD_OpenDialogMultiple( const nfdchar_t *filterList,
+                                    const nfdchar_t *defaultPath,
+                                    nfdpathset_t *outPaths )
+{
+    nfdfilter_t *filter;
+    nfdresult_t result;
+
+    NFDi_CALL_ENTRY();
+    result = NFD_Filter_Compile( filterList, &filter );
+    if ( result == NFD_OKAY )
+    {
+        result = OpenDialogMultiple( filter, defaultPath, outPaths );
+        NFD_Filter_Free( filter );
+    }
+
+    NFDi_CALL_RETURN( result );
+    return result;
+}
+
+nfdresult_t NFD_SaveDialog( const nfdchar_t *filterList,
+                            const nfdchar_t *defaultPath,
+                            nfdchar_t **outPath )
+{
+    nfdfilter_t *filter;
+    nfdresult_t result;
+
+    NFDi_CALL_ENTRY();
+    result = NFD_Filter_Compile( filterList, &filter );
+    if ( result == NFD_OKAY )
+    {
+        result = SaveDialog( filter, defaultPath, outPath );
+        NFD_Filter_Free( filter );
+    }
+
+    NFDi_CALL_RETURN( result );
+    return result;
+}
+
+nfdresult_t NFD_OpenDialogF( nfdfilter_t *filter,
+                             const nfdchar_t *defaultPath,
+                             nfdchar_t **outPath )
+{
+    nfdresult_t result;
+
+    NFDi_CALL_ENTRY();
+    result = OpenDialog( filter, defaultPath, outPath );
+    NFDi_CALL_RETURN( result );
+    return result;
+}
+
+nfdresult_t NFD_OpenDialogMultipleF( nfdfilter_t *filter,
+                                     const nfdchar_t *defaultPath,
+                                     nfdpathset_t *outPaths )
+{
+    nfdresult_t result;
+
+    NFDi_CALL_ENTRY();
+    result = OpenDialogMultiple( filter, defaultPath, outPaths );
+    NFDi_CALL_RETURN( result );
+    return result;
+}
+
+nfdresult_t NFD_SaveDialogF( nfdfilter_t *filter,
+                             const nfdchar_t *defaultPath,
+                             nfdchar_t **outPath )
+{
+    nfdresult_t result;
+
+    NFDi_CALL_ENTRY();
+    result = SaveDialog( filter, defaultPath, outPath );
+    NFDi_CALL_RETURN( result );
+    return result;
+}
+
+static nfdresult_t PickFolder( const nfdchar_t *defaultPath,
+                               nfdchar_t **outPath )
 {
     GtkWidget *dialog;
     nfdresult_t result;
 
-    if (!gtk_init_check(NULL, NULL))
+    if ( NFDi_Headless_IsEnabled() )
+        return NFDi_Headless_Dialog( NFD_DIALOG_PICK_FOLDER, NULL, NULL, defaultPath, outPath, NULL );
+
+    if (!EnsureGtk())
     {
-        NFDi_SetError(INIT_FAIL_MSG);
+        NFDi_SetErrorCode( NFD_ERR_UNAVAILABLE, INIT_FAIL_MSG );
         return NFD_ERROR;
     }
 
-    dialog = gtk_file_chooser_dialog_new( "Select folder",
-                                          NULL,
-                                          GTK_FILE_CHOOSER_ACTION_SELECT_FOLDER,
-                                          "_Cancel", GTK_RESPONSE_CANCEL,
-                                          "_Select", GTK_RESPONSE_ACCEPT,
-                                          NULL ); 
+    dialog = AcquireDialog( "Select folder", GTK_FILE_CHOOSER_ACTION_SELECT_FOLDER, "_Select" );
     gtk_file_chooser_set_do_overwrite_confirmation( GTK_FILE_CHOOSER(dialog), TRUE );
 
 
@@ -350,30 +903,29 @@ nfdresult_t NFD_PickFolder(const nfdchar_t *defaultPath,
     SetDefaultPath(dialog, defaultPath);
     
     result = NFD_CANCEL;    
-    if ( gtk_dialog_run( GTK_DIALOG(dialog) ) == GTK_RESPONSE_ACCEPT )
+    if ( RunDialog( dialog ) == GTK_RESPONSE_ACCEPT )
     {
-        char *filename;
-        filename = gtk_file_chooser_get_filename( GTK_FILE_CHOOSER(dialog) );
-        
+        if ( CopyFilename( dialog, outPath ) == NFD_ERROR )
         {
-            size_t len = strlen(filename);
-            *outPath = NFDi_Malloc( len + 1 );
-            memcpy( *outPath, filename, len + 1 );
-            if ( !*outPath )
-            {
-                g_free( filename );
-                gtk_widget_destroy(dialog);
-                return NFD_ERROR;
-            }
+            ReleaseDialog( dialog, GTK_FILE_CHOOSER_ACTION_SELECT_FOLDER );
+            return NFD_ERROR;
         }
-        g_free(filename);
 
         result = NFD_OKAY;
     }
 
-    WaitForCleanup();
-    gtk_widget_destroy(dialog);
-    WaitForCleanup();
+    ReleaseDialog( dialog, GTK_FILE_CHOOSER_ACTION_SELECT_FOLDER );
     
     return result;
 }
+
+nfdresult_t NFD_PickFolder(const nfdchar_t *defaultPath,
+    nfdchar_t **outPath)
+{
+    nfdresult_t result;
+
+    NFDi_CALL_ENTRY();
+    result = PickFolder( defaultPath, outPath );
+    NFDi_CALL_RETURN( result );
+    return result;
+}
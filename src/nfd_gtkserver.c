@@ -0,0 +1,432 @@
+/*
+  Native File Dialog
+
+  GTK dialogs run by a resident nfd-server process, so the host never
+  links or initializes GTK itself.
+
+  http://www.frogtoss.com/labs
+*/
+
+/* struct ucred for SO_PEERCRED, in nfd_server.h */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "nfd.h"
+#include "nfd_common.h"
+
+#define NFD_SERVER_IMPLEMENTATION
+#include "nfd_server.h"
+
+
+extern char **environ;
+
+const char NO_SERVER_MSG[] = "could not start " NFD_SERVER_NAME;
+const char SERVER_LOST_MSG[] = "lost the connection to " NFD_SERVER_NAME;
+const char FOREIGN_SERVER_MSG[] = NFD_SERVER_NAME " socket belongs to another user";
+const char OTHER_VERSION_MSG[] = NFD_SERVER_NAME " from another release is running; it exits once idle";
+
+#define FOREIGN_SERVER -2
+
+
+/* Returns the connected socket, FOREIGN_SERVER if another user's
+   process is listening on socketPath, or -1 if nothing is. */
+static int ConnectToServer( const char *socketPath )
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+    if ( fd == -1 )
+        return -1;
+    fcntl( fd, F_SETFD, FD_CLOEXEC );
+
+    memset( &addr, 0, sizeof(addr) );
+    addr.sun_family = AF_UNIX;
+    NFDi_SafeStrncpy( addr.sun_path, socketPath, sizeof(addr.sun_path) );
+
+    if ( connect( fd, (struct sockaddr*)&addr, sizeof(addr) ) != 0 )
+    {
+        close( fd );
+        return -1;
+    }
+
+    /* it would see the paths we pass and choose the ones we open */
+    if ( !NFDi_Server_PeerIsSameUser( fd ) )
+    {
+        close( fd );
+        return FOREIGN_SERVER;
+    }
+
+    return fd;
+}
+
+/* nfd-server --daemon exits once the socket is listening, leaving the
+   server itself running detached.  $NFD_SERVER names the binary, which
+   is otherwise looked up in PATH. */
+static int StartServer( void )
+{
+    const char *server = getenv("NFD_SERVER");
+    char *args[3];
+    pid_t pid;
+    int status;
+
+    if ( !server || !*server )
+        server = NFD_SERVER_NAME;
+
+    args[0] = (char*)server;
+    args[1] = "--daemon";
+    args[2] = NULL;
+
+    if ( posix_spawnp( &pid, server, NULL, NULL, args, environ ) != 0 )
+        return 0;
+
+    while ( waitpid( pid, &status, 0 ) == -1 )
+    {
+        /* a host that ignores SIGCHLD has its children reaped for it,
+           and waitpid only returns once they have exited; connecting
+           tells whether the server came up */
+        if ( errno == ECHILD )
+            return 1;
+        if ( errno != EINTR )
+            return 0;
+    }
+
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static int ConnectOrStartServer( void )
+{
+    char socketPath[NFD_MAX_STRLEN];
+    uint64_t traceStart;
+    int fd;
+
+    if ( !NFDi_Server_GetSocketPath( socketPath, sizeof(socketPath) ) )
+    {
+        NFDi_SetError("nfd-server socket path is too long, or its directory in /tmp is not private");
+        return -1;
+    }
+
+    traceStart = NFDi_Trace_Begin();
+    fd = ConnectToServer( socketPath );
+    if ( fd == FOREIGN_SERVER )
+    {
+        NFDi_Trace_End( NFD_PHASE_INIT, traceStart );
+        NFDi_SetErrorCode( NFD_ERR_UNAVAILABLE, FOREIGN_SERVER_MSG );
+        return -1;
+    }
+    if ( fd == -1 )
+    {
+        uint64_t spawnStart = NFDi_Trace_Begin();
+        uint64_t statStart = NFDi_Trace_Now();
+        int started = StartServer();
+        NFDi_Stats_Add( NFD_STAT_SPAWN_NS, NFDi_Trace_Now() - statStart );
+        NFDi_Trace_End( NFD_PHASE_SPAWN, spawnStart );
+
+        if ( started )
+            fd = ConnectToServer( socketPath );
+    }
+    NFDi_Trace_End( NFD_PHASE_INIT, traceStart );
+
+    if ( fd == FOREIGN_SERVER )
+    {
+        NFDi_SetErrorCode( NFD_ERR_UNAVAILABLE, FOREIGN_SERVER_MSG );
+        return -1;
+    }
+    if ( fd == -1 )
+        NFDi_SetErrorCode( NFD_ERR_UNAVAILABLE, NO_SERVER_MSG );
+
+    return fd;
+}
+
+/* Reads count null terminated paths, bufSize bytes in all, straight
+   into the path set's storage. */
+static nfdresult_t ReadPathSet( int fd, nfdpathset_t *pathSet )
+{
+    uint32_t count, bufSize;
+    nfdchar_t *buf;
+    size_t offset, i;
+    uint64_t traceStart;
+    nfdresult_t result;
+    int received;
+
+    if ( !NFDi_Server_ReadUint32( fd, &count ) ||
+         !NFDi_Server_ReadUint32( fd, &bufSize ) ||
+         count == 0 || bufSize < count || bufSize >= NFD_SERVER_MAX_SIZE )
+    {
+        NFDi_SetError(SERVER_LOST_MSG);
+        return NFD_ERROR;
+    }
+
+    buf = NFDi_PathSet_Alloc( pathSet, count, bufSize );
+    if ( !buf )
+        return NFD_ERROR;
+
+    traceStart = NFDi_Trace_Begin();
+    received = NFDi_Server_ReadAll( fd, buf, bufSize );
+    NFDi_Trace_End( NFD_PHASE_CAPTURE, traceStart );
+    if ( !received || buf[bufSize-1] != '\0' )
+    {
+        NFD_PathSet_Free( pathSet );
+        NFDi_SetError(SERVER_LOST_MSG);
+        return NFD_ERROR;
+    }
+
+    traceStart = NFDi_Trace_Begin();
+    offset = 0;
+    for ( i = 0; i < count; ++i )
+    {
+        const nfdchar_t *end = memchr( buf + offset, '\0', bufSize - offset );
+        if ( !end )
+        {
+            NFDi_Trace_End( NFD_PHASE_PARSE, traceStart );
+            NFD_PathSet_Free( pathSet );
+            NFDi_SetError(SERVER_LOST_MSG);
+            return NFD_ERROR;
+        }
+
+        NFDi_PathSet_SetEntry( pathSet, i, offset, (size_t)(end - (buf + offset)) );
+        offset = (size_t)(end - buf) + 1;
+    }
+
+    result = NFDi_PathSet_CheckUTF8( pathSet );
+    NFDi_Trace_End( NFD_PHASE_PARSE, traceStart );
+    return result;
+}
+
+static nfdresult_t RunServerDialog( nfdserverop_t op,
+                                    const nfdchar_t *filterList,
+                                    const nfdchar_t *defaultPath,
+                                    nfdpathset_t *outPaths )
+{
+    nfdresult_t result = NFD_ERROR;
+    uint64_t traceStart;
+    uint32_t reply;
+    int replied, header = 0;
+    int fd;
+
+    /* single path dialogs are answered by RunServerDialogSingle */
+    if ( NFDi_Headless_IsEnabled() )
+        return NFDi_Headless_Dialog( NFD_DIALOG_OPEN_MULTIPLE, filterList, NULL, defaultPath, NULL, outPaths );
+
+    fd = ConnectOrStartServer();
+    if ( fd == -1 )
+        return NFD_ERROR;
+
+    /* nfd-server builds, shows and runs the dialog before it replies */
+    traceStart = NFDi_Trace_Begin();
+    replied = NFDi_Server_WriteHeader( fd ) &&
+              NFDi_Server_WriteUint32( fd, (uint32_t)op ) &&
+              NFDi_Server_WriteUint32( fd, (uint32_t)NFDi_GetTimeout() ) &&
+              NFDi_Server_WriteString( fd, filterList ) &&
+              NFDi_Server_WriteString( fd, defaultPath ) &&
+              (header = NFDi_Server_ReadHeader( fd )) == 1 &&
+              NFDi_Server_ReadUint32( fd, &reply );
+    NFDi_Trace_End( NFD_PHASE_USER_WAIT, traceStart );
+
+    if ( !replied )
+    {
+        NFDi_SetError( header == -1 ? OTHER_VERSION_MSG : SERVER_LOST_MSG );
+        close( fd );
+        return NFD_ERROR;
+    }
+
+    switch ( reply )
+    {
+    case NFD_OKAY:
+        result = ReadPathSet( fd, outPaths );
+        break;
+    case NFD_CANCEL:
+        result = NFD_CANCEL;
+        break;
+    default:
+    {
+        char *message = NULL;
+        if ( NFDi_Server_ReadString( fd, &message ) && message )
+        {
+            NFDi_SetError( message );
+            NFDi_Free( message );
+        }
+        else
+        {
+            NFDi_SetError(SERVER_LOST_MSG);
+        }
+        result = NFD_ERROR;
+        break;
+    }
+    }
+
+    close( fd );
+    return result;
+}
+
+static nfdresult_t RunServerDialogSingle( nfdserverop_t op,
+                                          const nfdchar_t *filterList,
+                                          const nfdchar_t *defaultPath,
+                                          nfdchar_t **outPath )
+{
+    nfdpathset_t pathSet;
+    const nfdchar_t *path;
+    uint64_t traceStart;
+    size_t len;
+    nfdresult_t result;
+
+    if ( NFDi_Headless_IsEnabled() )
+    {
+        nfddialogtype_t type = op == NFD_SERVER_SAVE ? NFD_DIALOG_SAVE :
+                               op == NFD_SERVER_PICK_FOLDER ? NFD_DIALOG_PICK_FOLDER : NFD_DIALOG_OPEN;
+        return NFDi_Headless_Dialog( type, filterList, NULL, defaultPath, outPath, NULL );
+    }
+
+    result = RunServerDialog( op, filterList, defaultPath, &pathSet );
+    if ( result != NFD_OKAY )
+        return result;
+
+    traceStart = NFDi_Trace_Begin();
+    path = NFD_PathSet_GetPathN( &pathSet, 0, &len );
+    *outPath = NFDi_Malloc( len + 1 );
+    if ( *outPath )
+        memcpy( *outPath, path, len + 1 );
+    NFDi_Trace_End( NFD_PHASE_ALLOC, traceStart );
+
+    if ( !*outPath )
+    {
+        NFD_PathSet_Free( &pathSet );
+        return NFD_ERROR;
+    }
+
+    NFD_PathSet_Free( &pathSet );
+    return NFD_OKAY;
+}
+
+/* public */
+
+nfdresult_t NFD_Init( void )
+{
+    int fd;
+
+    NFDi_CALL_ENTRY();
+    fd = ConnectOrStartServer();
+    if ( fd == -1 )
+    {
+        NFDi_CALL_RETURN( NFD_ERROR );
+        return NFD_ERROR;
+    }
+
+    /* the server warms up GTK as soon as it starts */
+    close( fd );
+    NFDi_CALL_RETURN( NFD_OKAY );
+    return NFD_OKAY;
+}
+
+nfdresult_t NFD_InitAsync( void )
+{
+    nfdresult_t result;
+
+    NFDi_CALL_ENTRY();
+    result = NFD_Init();
+    NFDi_CALL_RETURN( result );
+    return result;
+}
+
+/* nfd-server is shared by every host and exits once idle */
+void NFD_Quit( void )
+{
+}
+
+nfdresult_t NFD_OpenDialog( const nfdchar_t *filterList,
+                            const nfdchar_t *defaultPath,
+                            nfdchar_t **outPath )
+{
+    nfdresult_t result;
+
+    NFDi_CALL_ENTRY();
+    result = RunServerDialogSingle( NFD_SERVER_OPEN, filterList, defaultPath, outPath );
+    NFDi_CALL_RETURN( result );
+    return result;
+}
+
+
+nfdresult_t NFD_OpenDialogMultiple( const nfdchar_t *filterList,
+                                    const nfdchar_t *defaultPath,
+                                    nfdpathset_t *outPaths )
+{
+    nfdresult_t result;
+
+    NFDi_CALL_ENTRY();
+    result = RunServerDialog( NFD_SERVER_OPEN_MULTIPLE, filterList, defaultPath, outPaths );
+    NFDi_CALL_RETURN( result );
+    return result;
+}
+
+nfdresult_t NFD_SaveDialog( const nfdchar_t *filterList,
+                            const nfdchar_t *defaultPath,
+                            nfdchar_t **outPath )
+{
+    nfdresult_t result;
+
+    NFDi_CALL_ENTRY();
+    result = RunServerDialogSingle( NFD_SERVER_SAVE, filterList, defaultPath, outPath );
+    NFDi_CALL_RETURN( result );
+    return result;
+}
+
+/* nfd-server is a separate process, so it gets the filter's source and
+   compiles it there */
+nfdresult_t NFD_OpenDialogF( nfdfilter_t *filter,
+                             const nfdchar_t *defaultPath,
+                             nfdchar_t **outPath )
+{
+    nfdresult_t result;
+
+    NFDi_CALL_ENTRY();
+    result = NFD_OpenDialog( NFDi_Filter_GetSource( filter ), defaultPath, outPath );
+    NFDi_CALL_RETURN( result );
+    return result;
+}
+
+nfdresult_t NFD_OpenDialogMultipleF( nfdfilter_t *filter,
+                                     const nfdchar_t *defaultPath,
+                                     nfdpathset_t *outPaths )
+{
+    nfdresult_t result;
+
+    NFDi_CALL_ENTRY();
+    result = NFD_OpenDialogMultiple( NFDi_Filter_GetSource( filter ), defaultPath, outPaths );
+    NFDi_CALL_RETURN( result );
+    return result;
+}
+
+nfdresult_t NFD_SaveDialogF( nfdfilter_t *filter,
+                             const nfdchar_t *defaultPath,
+                             nfdchar_t **outPath )
+{
+    nfdresult_t result;
+
+    NFDi_CALL_ENTRY();
+    result = NFD_SaveDialog( NFDi_Filter_GetSource( filter ), defaultPath, outPath );
+    NFDi_CALL_RETURN( result );
+    return result;
+}
+
+nfdresult_t NFD_PickFolder(const nfdchar_t *defaultPath,
+    nfdchar_t **outPath)
+{
+    nfdresult_t result;
+
+    NFDi_CALL_ENTRY();
+    result = RunServerDialogSingle( NFD_SERVER_PICK_FOLDER, NULL, defaultPath, outPath );
+    NFDi_CALL_RETURN( result );
+    return result;
+}
@@ -0,0 +1,117 @@
+/*
+  Native File Dialog
+
+  Headless backend: every dialog is answered by the callback set with
+  NFD_Headless_SetCallback or the script named by NFD_HEADLESS_SCRIPT,
+  and nothing is ever shown.
+
+  http://www.frogtoss.com/labs
+ */
+
+#include "nfd.h"
+#include "nfd_common.h"
+
+/* public */
+
+nfdresult_t NFD_Init( void )
+{
+    NFDi_CALL_ENTRY();
+
+    /* reads the script now rather than in the first dialog */
+    NFDi_Headless_IsEnabled();
+
+    NFDi_CALL_RETURN( NFD_OKAY );
+    return NFD_OKAY;
+}
+
+nfdresult_t NFD_InitAsync( void )
+{
+    return NFD_Init();
+}
+
+void NFD_Quit( void )
+{
+}
+
+nfdresult_t NFD_OpenDialog( const nfdchar_t *filterList,
+                            const nfdchar_t *defaultPath,
+                            nfdchar_t **outPath )
+{
+    nfdresult_t result;
+
+    NFDi_CALL_ENTRY();
+    result = NFDi_Headless_Dialog( NFD_DIALOG_OPEN, filterList, NULL, defaultPath, outPath, NULL );
+    NFDi_CALL_RETURN( result );
+    return result;
+}
+
+nfdresult_t NFD_OpenDialogMultiple( const nfdchar_t *filterList,
+                                    const nfdchar_t *defaultPath,
+                                    nfdpathset_t *outPaths )
+{
+    nfdresult_t result;
+
+    NFDi_CALL_ENTRY();
+    result = NFDi_Headless_Dialog( NFD_DIALOG_OPEN_MULTIPLE, filterList, NULL, defaultPath, NULL, outPaths );
+    NFDi_CALL_RETURN( result );
+    return result;
+}
+
+nfdresult_t NFD_SaveDialog( const nfdchar_t *filterList,
+                            const nfdchar_t *defaultPath,
+                            nfdchar_t **outPath )
+{
+    nfdresult_t result;
+
+    NFDi_CALL_ENTRY();
+    result = NFDi_Headless_Dialog( NFD_DIALOG_SAVE, filterList, NULL, defaultPath, outPath, NULL );
+    NFDi_CALL_RETURN( result );
+    return result;
+}
+
+nfdresult_t NFD_OpenDialogF( nfdfilter_t *filter,
+                             const nfdchar_t *defaultPath,
+                             nfdchar_t **outPath )
+{
+    nfdresult_t result;
+
+    NFDi_CALL_ENTRY();
+    result = NFDi_Headless_Dialog( NFD_DIALOG_OPEN, NULL, filter, defaultPath, outPath, NULL );
+    NFDi_CALL_RETURN( result );
+    return result;
+}
+
+nfdresult_t NFD_OpenDialogMultipleF( nfdfilter_t *filter,
+                                     const nfdchar_t *defaultPath,
+                                     nfdpathset_t *outPaths )
+{
+    nfdresult_t result;
+
+    NFDi_CALL_ENTRY();
+    result = NFDi_Headless_Dialog( NFD_DIALOG_OPEN_MULTIPLE, NULL, filter, defaultPath, NULL, outPaths );
+    NFDi_CALL_RETURN( result );
+    return result;
+}
+
+nfdresult_t NFD_SaveDialogF( nfdfilter_t *filter,
+                             const nfdchar_t *defaultPath,
+                             nfdchar_t **outPath )
+{
+    nfdresult_t result;
+
+    NFDi_CALL_ENTRY();
+    result = NFDi_Headless_Dialog( NFD_DIALOG_SAVE, NULL, filter, defaultPath, outPath, NULL );
+    NFDi_CALL_RETURN( result );
+    return result;
+}
+
+nfdresult_t NFD_PickFolder(const nfdchar_t *defaultPath,
+    nfdchar_t **outPath)
+{
+    nfdresult_t result;
+
+    NFDi_CALL_ENTRY();
+    result = NFDi_Headless_Dialog( NFD_DIALOG_PICK_FOLDER, NULL, NULL, defaultPath, outPath, NULL );
+    NFDi_CALL_RETURN( result );
+    return result;
+}
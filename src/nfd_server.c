@@ -0,0 +1,379 @@
+/*
+  Native File Dialog
+
+  nfd-server: keeps GTK initialized and runs dialogs on behalf of hosts
+  built with the nfd_gtkserver.c backend.  Linked with nfd_gtk.c.
+
+  usage: nfd-server [--daemon]
+
+  With --daemon, the process that was started exits as soon as the
+  socket is listening, and the server keeps running in the background.
+  The server exits by itself after sitting idle for a while.
+
+  http://www.frogtoss.com/labs
+*/
+
+/* struct ucred for SO_PEERCRED, in nfd_server.h */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <gtk/gtk.h>
+#include "nfd.h"
+#include "nfd_common.h"
+
+#define NFD_SERVER_IMPLEMENTATION
+#include "nfd_server.h"
+
+
+#define IDLE_TIMEOUT_MS (10*60*1000)
+#define ALREADY_RUNNING -2
+
+
+/* the host that started us may have leaked fds into the spawn */
+static void CloseInheritedFds( void )
+{
+    DIR *dir = opendir("/proc/self/fd");
+    struct dirent *entry;
+
+    if ( !dir )
+        return;
+
+    while ( (entry = readdir(dir)) != NULL )
+    {
+        int fd = atoi(entry->d_name);
+        if ( fd > STDERR_FILENO && fd != dirfd(dir) )
+            close( fd );
+    }
+
+    closedir( dir );
+}
+
+static int ServerIsListening( const struct sockaddr_un *addr )
+{
+    int fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+    int listening;
+
+    if ( fd == -1 )
+        return 0;
+
+    listening = connect( fd, (const struct sockaddr*)addr, sizeof(*addr) ) == 0;
+    close( fd );
+    return listening;
+}
+
+/* Returns the listening socket, ALREADY_RUNNING if another server owns
+   socketPath, or -1 on error.  A socket file left behind by a server
+   that died is replaced. */
+static int Listen( const char *socketPath )
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    memset( &addr, 0, sizeof(addr) );
+    addr.sun_family = AF_UNIX;
+    NFDi_SafeStrncpy( addr.sun_path, socketPath, sizeof(addr.sun_path) );
+
+    fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+    if ( fd == -1 )
+        return -1;
+    fcntl( fd, F_SETFD, FD_CLOEXEC );
+
+    if ( bind( fd, (struct sockaddr*)&addr, sizeof(addr) ) != 0 )
+    {
+        if ( errno != EADDRINUSE )
+        {
+            close( fd );
+            return -1;
+        }
+
+        if ( ServerIsListening( &addr ) )
+        {
+            close( fd );
+            return ALREADY_RUNNING;
+        }
+
+        unlink( socketPath );
+        if ( bind( fd, (struct sockaddr*)&addr, sizeof(addr) ) != 0 )
+        {
+            close( fd );
+            return -1;
+        }
+    }
+
+    if ( listen( fd, 8 ) != 0 )
+    {
+        close( fd );
+        return -1;
+    }
+
+    return fd;
+}
+
+static void Daemonize( void )
+{
+    int devNull;
+    pid_t pid = fork();
+
+    if ( pid == -1 )
+        exit( 1 );
+
+    /* the socket is listening, so the host can connect now */
+    if ( pid != 0 )
+        _exit( 0 );
+
+    setsid();
+
+    devNull = open( "/dev/null", O_RDWR );
+    if ( devNull != -1 )
+    {
+        dup2( devNull, STDIN_FILENO );
+        dup2( devNull, STDOUT_FILENO );
+        dup2( devNull, STDERR_FILENO );
+        if ( devNull > STDERR_FILENO )
+            close( devNull );
+    }
+}
+
+/* Realizes one file chooser before the first request arrives, on top
+   of what NFD_Init loads, so the first dialog opens as quickly as the
+   rest. */
+static int WarmUp( void )
+{
+    GtkWidget *dialog;
+
+    if ( NFD_Init() != NFD_OKAY )
+        return 0;
+
+    dialog = gtk_file_chooser_dialog_new( "Open File",
+                                          NULL,
+                                          GTK_FILE_CHOOSER_ACTION_OPEN,
+                                          "_Cancel", GTK_RESPONSE_CANCEL,
+                                          "_Open", GTK_RESPONSE_ACCEPT,
+                                          NULL );
+    gtk_widget_realize( dialog );
+    gtk_widget_destroy( dialog );
+
+    while ( gtk_events_pending() )
+        gtk_main_iteration();
+
+    return 1;
+}
+
+static int WriteError( int fd, const char *message )
+{
+    return NFDi_Server_WriteHeader( fd ) &&
+           NFDi_Server_WriteUint32( fd, NFD_ERROR ) &&
+           NFDi_Server_WriteString( fd, message );
+}
+
+static void WritePath( int fd, const nfdchar_t *path )
+{
+    size_t size = strlen(path) + 1;
+
+    if ( NFDi_Server_WriteHeader( fd ) &&
+         NFDi_Server_WriteUint32( fd, NFD_OKAY ) &&
+         NFDi_Server_WriteUint32( fd, 1 ) &&
+         NFDi_Server_WriteUint32( fd, (uint32_t)size ) )
+    {
+        NFDi_Server_WriteAll( fd, path, size );
+    }
+}
+
+/* paths are packed back to back so the reply is sent in one write */
+static void WritePathSet( int fd, const nfdpathset_t *pathSet )
+{
+    size_t count = NFD_PathSet_GetCount( pathSet );
+    size_t bufSize = 0, offset = 0, len, i;
+    nfdchar_t *buf;
+
+    for ( i = 0; i < count; ++i )
+    {
+        NFD_PathSet_GetPathN( pathSet, i, &len );
+        bufSize += len + 1;
+    }
+
+    if ( bufSize >= NFD_SERVER_MAX_SIZE )
+    {
+        WriteError( fd, "too many paths selected" );
+        return;
+    }
+
+    buf = NFDi_Malloc( bufSize );
+    if ( !buf )
+    {
+        WriteError( fd, NFD_GetError() );
+        return;
+    }
+
+    for ( i = 0; i < count; ++i )
+    {
+        const nfdchar_t *path = NFD_PathSet_GetPathN( pathSet, i, &len );
+        memcpy( buf + offset, path, len + 1 );
+        offset += len + 1;
+    }
+
+    if ( NFDi_Server_WriteHeader( fd ) &&
+         NFDi_Server_WriteUint32( fd, NFD_OKAY ) &&
+         NFDi_Server_WriteUint32( fd, (uint32_t)count ) &&
+         NFDi_Server_WriteUint32( fd, (uint32_t)bufSize ) )
+    {
+        NFDi_Server_WriteAll( fd, buf, bufSize );
+    }
+
+    NFDi_Free( buf );
+}
+
+static void HandleRequest( int fd )
+{
+    uint32_t op, timeoutMs;
+    char *filterList = NULL;
+    char *defaultPath = NULL;
+    nfdchar_t *outPath = NULL;
+    nfdpathset_t pathSet;
+    nfdresult_t result;
+
+    /* a host from another release cannot parse our reply either, but
+       the header at its front tells it why */
+    switch ( NFDi_Server_ReadHeader( fd ) )
+    {
+    case 1:
+        break;
+    case -1:
+        WriteError( fd, "nfd-server speaks another protocol version" );
+        return;
+    default:
+        return;
+    }
+
+    if ( !NFDi_Server_ReadUint32( fd, &op ) ||
+         !NFDi_Server_ReadUint32( fd, &timeoutMs ) ||
+         !NFDi_Server_ReadString( fd, &filterList ) ||
+         !NFDi_Server_ReadString( fd, &defaultPath ) )
+    {
+        if ( filterList )
+            NFDi_Free( filterList );
+        return;
+    }
+
+    NFD_SetTimeout( (int)timeoutMs );
+
+    switch ( op )
+    {
+    case NFD_SERVER_OPEN:
+        result = NFD_OpenDialog( filterList, defaultPath, &outPath );
+        break;
+    case NFD_SERVER_OPEN_MULTIPLE:
+        result = NFD_OpenDialogMultiple( filterList, defaultPath, &pathSet );
+        break;
+    case NFD_SERVER_SAVE:
+        result = NFD_SaveDialog( filterList, defaultPath, &outPath );
+        break;
+    case NFD_SERVER_PICK_FOLDER:
+        result = NFD_PickFolder( defaultPath, &outPath );
+        break;
+    default:
+        NFDi_SetError("unknown nfd-server request");
+        result = NFD_ERROR;
+        break;
+    }
+
+    if ( result == NFD_OKAY && op == NFD_SERVER_OPEN_MULTIPLE )
+    {
+        WritePathSet( fd, &pathSet );
+        NFD_PathSet_Free( &pathSet );
+    }
+    else if ( result == NFD_OKAY )
+    {
+        WritePath( fd, outPath );
+        NFDi_Free( outPath );
+    }
+    else if ( result == NFD_CANCEL )
+    {
+        if ( NFDi_Server_WriteHeader( fd ) )
+            NFDi_Server_WriteUint32( fd, NFD_CANCEL );
+    }
+    else
+    {
+        WriteError( fd, NFD_GetError() );
+    }
+
+    if ( filterList )
+        NFDi_Free( filterList );
+    if ( defaultPath )
+        NFDi_Free( defaultPath );
+}
+
+int main( int argc, char **argv )
+{
+    char socketPath[NFD_MAX_STRLEN];
+    int daemonize = argc > 1 && strcmp( argv[1], "--daemon" ) == 0;
+    int listenFd;
+
+    CloseInheritedFds();
+
+    /* the socket is only for this user */
+    umask( 077 );
+
+    if ( !NFDi_Server_GetSocketPath( socketPath, sizeof(socketPath) ) )
+    {
+        fprintf( stderr, "%s: socket path is too long, or /tmp/%s-%u is not private\n",
+                 argv[0], NFD_SERVER_NAME, (unsigned)getuid() );
+        return 1;
+    }
+
+    listenFd = Listen( socketPath );
+    if ( listenFd == ALREADY_RUNNING )
+        return 0;
+    if ( listenFd == -1 )
+    {
+        fprintf( stderr, "%s: could not listen on %s: %s\n", argv[0], socketPath, strerror(errno) );
+        return 1;
+    }
+
+    if ( daemonize )
+        Daemonize();
+
+    if ( !WarmUp() )
+    {
+        unlink( socketPath );
+        return 1;
+    }
+
+    while ( 1 )
+    {
+        struct pollfd pfd;
+        int fd;
+
+        pfd.fd = listenFd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+
+        if ( poll( &pfd, 1, IDLE_TIMEOUT_MS ) == 0 )
+            break;
+
+        fd = accept( listenFd, NULL, NULL );
+        if ( fd == -1 )
+            continue;
+
+        if ( NFDi_Server_PeerIsSameUser( fd ) )
+            HandleRequest( fd );
+
+        close( fd );
+    }
+
+    unlink( socketPath );
+    close( listenFd );
+    return 0;
+}
@@ -0,0 +1,263 @@
+/*
+  Native File Dialog
+
+  Wire format shared by the nfd_gtkserver.c backend and nfd-server
+
+  http://www.frogtoss.com/labs
+ */
+
+/* The backend connects to nfd-server over a Unix stream socket and
+   sends one request per connection:
+
+     header, uint32 op, int32 timeoutMs, string filterList,
+     string defaultPath
+
+   A header is uint32 NFD_SERVER_MAGIC then uint32 NFD_SERVER_VERSION,
+   so that a server left running from another release is told apart
+   from a broken connection.  A string is a uint32 byte count followed
+   by that many bytes, or NFD_SERVER_NULL_STRING and no bytes for NULL.
+   The server answers with a header and a uint32 nfdresult_t followed
+   by
+
+     NFD_OKAY:   uint32 count, uint32 bufSize, then bufSize bytes
+                 holding count null terminated paths back to back
+     NFD_ERROR:  string error message
+     NFD_CANCEL: nothing
+
+   Both ends run on the same machine, so integers are sent in host
+   byte order.  Each end checks that the other runs as the same user
+   before it trusts what the socket says.
+
+   Define NFD_SERVER_IMPLEMENTATION before including this file in one
+   source file of each program, and _GNU_SOURCE before that file's
+   first include, for struct ucred. */
+
+#ifndef _NFD_SERVER_H
+#define _NFD_SERVER_H
+
+#include "nfd.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define NFD_SERVER_NAME         "nfd-server"
+#define NFD_SERVER_MAGIC        0x3044464Eu     /* "NFD0" */
+#define NFD_SERVER_VERSION      1u
+#define NFD_SERVER_NULL_STRING  0xFFFFFFFFu
+/* requests and replies larger than this are rejected */
+#define NFD_SERVER_MAX_SIZE     (256u*1024u*1024u)
+
+typedef enum {
+    NFD_SERVER_OPEN = 1,
+    NFD_SERVER_OPEN_MULTIPLE,
+    NFD_SERVER_SAVE,
+    NFD_SERVER_PICK_FOLDER
+} nfdserverop_t;
+
+/* $NFD_SERVER_SOCKET, else nfd-server.sock in $XDG_RUNTIME_DIR, else
+   nfd-server.sock in a per-user directory in /tmp, which is created
+   mode 0700.  Returns 0 if the path does not fit, or if that directory
+   is not a real directory that only this user can get into. */
+int NFDi_Server_GetSocketPath( char *buf, size_t bufSize );
+
+/* non-zero if the process at the other end of fd runs as this user */
+int NFDi_Server_PeerIsSameUser( int fd );
+
+/* each returns 0 if the peer went away or sent something malformed */
+int NFDi_Server_WriteAll( int fd, const void *data, size_t size );
+int NFDi_Server_ReadAll( int fd, void *data, size_t size );
+int NFDi_Server_WriteUint32( int fd, uint32_t value );
+int NFDi_Server_ReadUint32( int fd, uint32_t *value );
+int NFDi_Server_WriteString( int fd, const char *str );
+/* *outStr is NULL for a NULL string, else free it with NFDi_Free */
+int NFDi_Server_ReadString( int fd, char **outStr );
+int NFDi_Server_WriteHeader( int fd );
+/* 1 if the peer speaks this version, -1 if it sent something else,
+   0 if it went away */
+int NFDi_Server_ReadHeader( int fd );
+
+#endif
+
+#ifdef NFD_SERVER_IMPLEMENTATION
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "nfd_common.h"
+
+/* Creates /tmp/nfd-server-<uid> unless it exists, then checks that it
+   is a directory rather than a link, owned by this user and closed to
+   everyone else, since anyone can create it first. */
+static int NFDi_Server_MakePrivateDir( const char *dir )
+{
+    struct stat info;
+
+    if ( mkdir( dir, 0700 ) != 0 && errno != EEXIST )
+        return 0;
+
+    if ( lstat( dir, &info ) != 0 )
+        return 0;
+
+    return S_ISDIR(info.st_mode) && info.st_uid == getuid() &&
+           (info.st_mode & 077) == 0;
+}
+
+int NFDi_Server_GetSocketPath( char *buf, size_t bufSize )
+{
+    const char *path = getenv("NFD_SERVER_SOCKET");
+    const char *runtimeDir = getenv("XDG_RUNTIME_DIR");
+    struct sockaddr_un addr;
+    char dir[64];
+    int len;
+
+    /* must fit in sun_path */
+    if ( bufSize > sizeof(addr.sun_path) )
+        bufSize = sizeof(addr.sun_path);
+
+    if ( path && *path )
+        len = snprintf( buf, bufSize, "%s", path );
+    else if ( runtimeDir && *runtimeDir )
+        len = snprintf( buf, bufSize, "%s/%s.sock", runtimeDir, NFD_SERVER_NAME );
+    else
+    {
+        snprintf( dir, sizeof(dir), "/tmp/%s-%u", NFD_SERVER_NAME, (unsigned)getuid() );
+        if ( !NFDi_Server_MakePrivateDir( dir ) )
+            return 0;
+        len = snprintf( buf, bufSize, "%s/%s.sock", dir, NFD_SERVER_NAME );
+    }
+
+    return len > 0 && (size_t)len < bufSize;
+}
+
+int NFDi_Server_PeerIsSameUser( int fd )
+{
+#ifdef SO_PEERCRED
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+
+    if ( getsockopt( fd, SOL_SOCKET, SO_PEERCRED, &cred, &len ) != 0 )
+        return 0;
+
+    return cred.uid == getuid();
+#else
+    /* the socket's directory is the only protection */
+    _NFD_UNUSED(fd);
+    return 1;
+#endif
+}
+
+int NFDi_Server_WriteAll( int fd, const void *data, size_t size )
+{
+    const char *p = (const char*)data;
+
+    while ( size > 0 )
+    {
+        ssize_t written = send( fd, p, size, MSG_NOSIGNAL );
+        if ( written == -1 && errno == EINTR )
+            continue;
+        if ( written <= 0 )
+            return 0;
+
+        p += written;
+        size -= (size_t)written;
+    }
+
+    return 1;
+}
+
+int NFDi_Server_ReadAll( int fd, void *data, size_t size )
+{
+    char *p = (char*)data;
+
+    while ( size > 0 )
+    {
+        ssize_t bytesRead = read( fd, p, size );
+        NFDi_Stats_Add( NFD_STAT_READS, 1 );
+        if ( bytesRead == -1 && errno == EINTR )
+            continue;
+        if ( bytesRead <= 0 )
+            return 0;
+
+        p += bytesRead;
+        size -= (size_t)bytesRead;
+    }
+
+    return 1;
+}
+
+int NFDi_Server_WriteUint32( int fd, uint32_t value )
+{
+    return NFDi_Server_WriteAll( fd, &value, sizeof(value) );
+}
+
+int NFDi_Server_ReadUint32( int fd, uint32_t *value )
+{
+    return NFDi_Server_ReadAll( fd, value, sizeof(*value) );
+}
+
+int NFDi_Server_WriteString( int fd, const char *str )
+{
+    size_t len;
+
+    if ( !str )
+        return NFDi_Server_WriteUint32( fd, NFD_SERVER_NULL_STRING );
+
+    len = strlen(str);
+    if ( len >= NFD_SERVER_MAX_SIZE )
+        return 0;
+
+    return NFDi_Server_WriteUint32( fd, (uint32_t)len ) &&
+           NFDi_Server_WriteAll( fd, str, len );
+}
+
+int NFDi_Server_ReadString( int fd, char **outStr )
+{
+    uint32_t len;
+
+    *outStr = NULL;
+    if ( !NFDi_Server_ReadUint32( fd, &len ) )
+        return 0;
+
+    if ( len == NFD_SERVER_NULL_STRING )
+        return 1;
+    if ( len >= NFD_SERVER_MAX_SIZE )
+        return 0;
+
+    *outStr = NFDi_Malloc( len + 1 );
+    if ( !*outStr )
+        return 0;
+
+    if ( !NFDi_Server_ReadAll( fd, *outStr, len ) )
+    {
+        NFDi_Free( *outStr );
+        *outStr = NULL;
+        return 0;
+    }
+    (*outStr)[len] = '\0';
+
+    return 1;
+}
+
+int NFDi_Server_WriteHeader( int fd )
+{
+    return NFDi_Server_WriteUint32( fd, NFD_SERVER_MAGIC ) &&
+           NFDi_Server_WriteUint32( fd, NFD_SERVER_VERSION );
+}
+
+int NFDi_Server_ReadHeader( int fd )
+{
+    uint32_t magic, version;
+
+    if ( !NFDi_Server_ReadUint32( fd, &magic ) ||
+         !NFDi_Server_ReadUint32( fd, &version ) )
+        return 0;
+
+    return magic == NFD_SERVER_MAGIC && version == NFD_SERVER_VERSION ? 1 : -1;
+}
+
+#endif /* NFD_SERVER_IMPLEMENTATION */
@@ -55,7 +55,7 @@ static void COMUninit(HRESULT coResult)
         ::CoUninitialize();
 }
 
-// allocs the space in outPath -- call free()
+// allocs the space in outPath -- call NFDi_Free()
 static void CopyWCharToNFDChar( const wchar_t *inStr, nfdchar_t **outStr )
 {
     int inStrCharacterCount = static_cast<int>(wcslen(inStr)); 
@@ -103,7 +103,7 @@ static int CopyWCharToExistingNFDCharBuffer( const wchar_t *inStr, nfdchar_t *ou
 }
 
 
-// allocs the space in outStr -- call free()
+// allocs the space in outStr -- call NFDi_Free()
 static void CopyNFDCharToWChar( const nfdchar_t *inStr, wchar_t **outStr )
 {
     int inStrByteCount = static_cast<int>(strlen(inStr));
@@ -132,116 +132,129 @@ static void CopyNFDCharToWChar( const nfdchar_t *inStr, wchar_t **outStr )
 }
 
 
-/* ext is in format "jpg", no wildcards or separators */
-static int AppendExtensionToSpecBuf( const char *ext, char *specBuf, size_t specBufLen )
+/* "*.png;*.jpg" for a group of a compiled filter, with globs such as
+   "Makefile*" as written -- call NFDi_Free().  The dialog ignores case
+   by itself. */
+static char *BuildSpecBuf( const nfdfilter_t *filter, const nfdfiltergroup_t *group )
 {
-    const char SEP[] = ";";
-    assert( specBufLen > strlen(ext)+3 );
-    
-    if ( strlen(specBuf) > 0 )
+    size_t specBufLen = 1;
+    for ( size_t i = 0; i < group->specCount; ++i )
+        specBufLen += filter->specs[group->firstSpec + i].len + 3; /* "*." and ';' */
+
+    char *specBuf = (char*)NFDi_Malloc( specBufLen );
+    if ( !specBuf )
+        return NULL;
+
+    char *p_specBuf = specBuf;
+    for ( size_t i = 0; i < group->specCount; ++i )
     {
-        strncat( specBuf, SEP, specBufLen - strlen(specBuf) - 1 );
-        specBufLen += strlen(SEP);
-    }
+        size_t extLen;
+        const nfdchar_t *ext = NFDi_Filter_GetSpec( filter, group->firstSpec + i, &extLen );
 
-    char extWildcard[NFD_MAX_STRLEN];
-    int bytesWritten = sprintf_s( extWildcard, NFD_MAX_STRLEN, "*.%s", ext );
-    assert( bytesWritten == (int)(strlen(ext)+2) );
-    _NFD_UNUSED(bytesWritten);
-    
-    strncat( specBuf, extWildcard, specBufLen - strlen(specBuf) - 1 );
+        if ( i > 0 )
+            *p_specBuf++ = ';';
+        if ( !NFDi_Filter_IsGlob( filter, group->firstSpec + i ) )
+        {
+            *p_specBuf++ = '*';
+            *p_specBuf++ = '.';
+        }
+        memcpy( p_specBuf, ext, extLen );
+        p_specBuf += extLen;
+    }
+    *p_specBuf = '\0';
 
-    return NFD_OKAY;
+    return specBuf;
 }
 
-static nfdresult_t AddFiltersToDialog( ::IFileDialog *fileOpenDialog, const char *filterList )
-{
-    const wchar_t WILDCARD[] = L"*.*";
+/* a compiled filter's COMDLG_FILTERSPECs, one per group and then the
+   wildcard, built on first use and kept with the filter */
+typedef struct {
+    COMDLG_FILTERSPEC *specList;
+    size_t count;           /* not counting the wildcard */
+} FilterSpecs;
 
-    if ( !filterList || strlen(filterList) == 0 )
-        return NFD_OKAY;
+static const wchar_t WILDCARD[] = L"*.*";
 
-    // Count rows to alloc
-    UINT filterCount = 1; /* guaranteed to have one filter on a correct, non-empty parse */
-    const char *p_filterList;
-    for ( p_filterList = filterList; *p_filterList; ++p_filterList )
-    {
-        if ( *p_filterList == ';' )
-            ++filterCount;
-    }    
+static void FreeFilterSpecs( void *backendData )
+{
+    FilterSpecs *specs = (FilterSpecs*)backendData;
 
-    assert(filterCount);
-    if ( !filterCount )
+    /* the spec doubles as its name */
+    for ( size_t i = 0; i < specs->count; ++i )
     {
-        NFDi_SetError("Error parsing filters.");
-        return NFD_ERROR;
+        if ( specs->specList[i].pszSpec )
+            NFDi_Free( (void*)specs->specList[i].pszSpec );
     }
+    NFDi_Free( specs->specList );
+    NFDi_Free( specs );
+}
+
+static FilterSpecs *NewFilterSpecs( const nfdfilter_t *filter )
+{
+    size_t filterCount = filter->groupCount;
 
-    /* filterCount plus 1 because we hardcode the *.* wildcard after the while loop */
-    COMDLG_FILTERSPEC *specList = (COMDLG_FILTERSPEC*)NFDi_Malloc( sizeof(COMDLG_FILTERSPEC) * ((size_t)filterCount + 1) );
-    if ( !specList )
+    FilterSpecs *specs = (FilterSpecs*)NFDi_Malloc( sizeof(FilterSpecs) );
+    if ( !specs )
+        return NULL;
+
+    /* filterCount plus 1 because we hardcode the *.* wildcard after the loop */
+    specs->count = filterCount;
+    specs->specList = (COMDLG_FILTERSPEC*)NFDi_Malloc( sizeof(COMDLG_FILTERSPEC) * (filterCount + 1) );
+    if ( !specs->specList )
     {
-        return NFD_ERROR;
+        NFDi_Free( specs );
+        return NULL;
     }
-    for (UINT i = 0; i < filterCount+1; ++i )
+    for ( size_t i = 0; i < filterCount+1; ++i )
     {
-        specList[i].pszName = NULL;
-        specList[i].pszSpec = NULL;
+        specs->specList[i].pszName = NULL;
+        specs->specList[i].pszSpec = NULL;
     }
 
-    size_t specIdx = 0;
-    p_filterList = filterList;
-    char typebuf[NFD_MAX_STRLEN] = {0};  /* one per comma or semicolon */
-    char *p_typebuf = typebuf;
-
-    char specbuf[NFD_MAX_STRLEN] = {0}; /* one per semicolon */
-
-    while ( 1 ) 
+    for ( size_t i = 0; i < filterCount; ++i )
     {
-        if ( NFDi_IsFilterSegmentChar(*p_filterList) )
+        char *specBuf = BuildSpecBuf( filter, &filter->groups[i] );
+        if ( !specBuf )
         {
-            /* append a type to the specbuf (pending filter) */
-            AppendExtensionToSpecBuf( typebuf, specbuf, NFD_MAX_STRLEN );            
-
-            p_typebuf = typebuf;
-            memset( typebuf, 0, sizeof(char)*NFD_MAX_STRLEN );
+            FreeFilterSpecs( specs );
+            return NULL;
         }
 
-        if ( *p_filterList == ';' || *p_filterList == '\0' )
+        CopyNFDCharToWChar( specBuf, (wchar_t**)&specs->specList[i].pszSpec );
+        specs->specList[i].pszName = specs->specList[i].pszSpec;
+        NFDi_Free( specBuf );
+        if ( !specs->specList[i].pszSpec )
         {
-            /* end of filter -- add it to specList */
-                                
-            CopyNFDCharToWChar( specbuf, (wchar_t**)&specList[specIdx].pszName );
-            CopyNFDCharToWChar( specbuf, (wchar_t**)&specList[specIdx].pszSpec );
-                        
-            memset( specbuf, 0, sizeof(char)*NFD_MAX_STRLEN );
-            ++specIdx;
-            if ( specIdx == filterCount )
-                break;
-        }
-
-        if ( !NFDi_IsFilterSegmentChar( *p_filterList ))
-        {
-            *p_typebuf = *p_filterList;
-            ++p_typebuf;
+            FreeFilterSpecs( specs );
+            return NULL;
         }
-
-        ++p_filterList;
     }
 
     /* Add wildcard */
-    specList[specIdx].pszSpec = WILDCARD;
-    specList[specIdx].pszName = WILDCARD;
-    
-    fileOpenDialog->SetFileTypes( filterCount+1, specList );
+    specs->specList[filterCount].pszSpec = WILDCARD;
+    specs->specList[filterCount].pszName = WILDCARD;
 
-    /* free speclist */
-    for ( size_t i = 0; i < filterCount; ++i )
+    return specs;
+}
+
+static nfdresult_t AddFiltersToDialog( ::IFileDialog *fileOpenDialog, nfdfilter_t *filter )
+{
+    if ( !filter || filter->groupCount == 0 )
+        return NFD_OKAY;
+
+    FilterSpecs *specs = (FilterSpecs*)filter->backendData;
+    if ( !specs )
     {
-        NFDi_Free( (void*)specList[i].pszSpec );
+        specs = NewFilterSpecs( filter );
+        if ( !specs )
+            return NFD_ERROR;
+
+        filter->backendData = specs;
+        filter->freeBackendData = FreeFilterSpecs;
     }
-    NFDi_Free( specList );    
 
+    /* the dialog copies the specs */
+    fileOpenDialog->SetFileTypes( static_cast<UINT>(specs->count+1), specs->specList );
     return NFD_OKAY;
 }
 
@@ -383,10 +396,25 @@ static nfdresult_t SetDefaultPath( IFileDialog *dialog, const char *defaultPath
 
 /* public */
 
+/* nothing to prepare ahead of the first dialog */
+nfdresult_t NFD_Init( void )
+{
+    return NFD_OKAY;
+}
 
-nfdresult_t NFD_OpenDialog( const nfdchar_t *filterList,
-                            const nfdchar_t *defaultPath,
-                            nfdchar_t **outPath )
+nfdresult_t NFD_InitAsync( void )
+{
+    return NFD_OKAY;
+}
+
+void NFD_Quit( void )
+{
+}
+
+
+static nfdresult_t OpenDialog( nfdfilter_t *filter,
+                               const nfdchar_t *defaultPath,
+                               nfdchar_t **outPath )
 {
     nfdresult_t nfdResult = NFD_ERROR;
 
@@ -411,7 +439,7 @@ nfdresult_t NFD_OpenDialog( const nfdchar_t *filterList,
     }
 
     // Build the filter list
-    if ( !AddFiltersToDialog( fileOpenDialog, filterList ) )
+    if ( !AddFiltersToDialog( fileOpenDialog, filter ) )
     {
         goto end;
     }
@@ -474,9 +502,9 @@ end:
     return nfdResult;
 }
 
-nfdresult_t NFD_OpenDialogMultiple( const nfdchar_t *filterList,
-                                    const nfdchar_t *defaultPath,
-                                    nfdpathset_t *outPaths )
+static nfdresult_t OpenDialogMultiple( nfdfilter_t *filter,
+                                       const nfdchar_t *defaultPath,
+                                       nfdpathset_t *outPaths )
 {
     nfdresult_t nfdResult = NFD_ERROR;
 
@@ -502,7 +530,7 @@ nfdresult_t NFD_OpenDialogMultiple( const nfdchar_t *filterList,
     }
 
     // Build the filter list
-    if ( !AddFiltersToDialog( fileOpenDialog, filterList ) )
+    if ( !AddFiltersToDialog( fileOpenDialog, filter ) )
     {
         goto end;
     }
@@ -568,9 +596,9 @@ end:
     return nfdResult;
 }
 
-nfdresult_t NFD_SaveDialog( const nfdchar_t *filterList,
-                            const nfdchar_t *defaultPath,
-                            nfdchar_t **outPath )
+static nfdresult_t SaveDialog( nfdfilter_t *filter,
+                               const nfdchar_t *defaultPath,
+                               nfdchar_t **outPath )
 {
     nfdresult_t nfdResult = NFD_ERROR;
 
@@ -595,7 +623,7 @@ nfdresult_t NFD_SaveDialog( const nfdchar_t *filterList,
     }
 
     // Build the filter list
-    if ( !AddFiltersToDialog( fileSaveDialog, filterList ) )
+    if ( !AddFiltersToDialog( fileSaveDialog, filter ) )
     {
         goto end;
     }
@@ -660,6 +688,74 @@ end:
 
 
 
+nfdresult_t NFD_OpenDialog( const nfdchar_t *filterList,
+                            const nfdchar_t *defaultPath,
+                            nfdchar_t **outPath )
+{
+    nfdfilter_t *filter;
+    nfdresult_t result = NFD_Filter_Compile( filterList, &filter );
+    if ( result == NFD_OKAY )
+    {
+        result = OpenDialog( filter, defaultPath, outPath );
+        NFD_Filter_Free( filter );
+    }
+
+    return result;
+}
+
+nfdresult_t NFD_OpenDialogMultiple( const nfdchar_t *filterList,
+                                    const nfdchar_t *defaultPath,
+                                    nfdpathset_t *outPaths )
+{
+    nfdfilter_t *filter;
+    nfdresult_t result = NFD_Filter_Compile( filterList, &filter );
+    if ( result == NFD_OKAY )
+    {
+        result = OpenDialogMultiple( filter, defaultPath, outPaths );
+        NFD_Filter_Free( filter );
+    }
+
+    return result;
+}
+
+nfdresult_t NFD_SaveDialog( const nfdchar_t *filterList,
+                            const nfdchar_t *defaultPath,
+                            nfdchar_t **outPath )
+{
+    nfdfilter_t *filter;
+    nfdresult_t result = NFD_Filter_Compile( filterList, &filter );
+    if ( result == NFD_OKAY )
+    {
+        result = SaveDialog( filter, defaultPath, outPath );
+        NFD_Filter_Free( filter );
+    }
+
+    return result;
+}
+
+/* the specs built from a compiled filter are kept with it, so reusing
+   the filter skips rebuilding them */
+nfdresult_t NFD_OpenDialogF( nfdfilter_t *filter,
+                             const nfdchar_t *defaultPath,
+                             nfdchar_t **outPath )
+{
+    return OpenDialog( filter, defaultPath, outPath );
+}
+
+nfdresult_t NFD_OpenDialogMultipleF( nfdfilter_t *filter,
+                                     const nfdchar_t *defaultPath,
+                                     nfdpathset_t *outPaths )
+{
+    return OpenDialogMultiple( filter, defaultPath, outPaths );
+}
+
+nfdresult_t NFD_SaveDialogF( nfdfilter_t *filter,
+                             const nfdchar_t *defaultPath,
+                             nfdchar_t **outPath )
+{
+    return SaveDialog( filter, defaultPath, outPath );
+}
+
 nfdresult_t NFD_PickFolder(const nfdchar_t *defaultPath,
     nfdchar_t **outPath)
 {
@@ -4,12 +4,28 @@
   http://www.frogtoss.com/labs
 */
 
+/* pipe2 and posix_spawn_file_actions_addclosefrom_np in simple_exec.h */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <stdio.h>
 #include <assert.h>
 #include <string.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
 #include "nfd.h"
 #include "nfd_common.h"
 
+/* zenity's output buffers come from the allocator set with
+   NFD_SetAllocator, like everything else */
+#define SIMPLE_EXEC_MALLOC(size) NFDi_Malloc(size)
+#define SIMPLE_EXEC_REALLOC(ptr, oldSize, newSize) NFDi_Realloc(ptr, oldSize, newSize)
+#define SIMPLE_EXEC_FREE(ptr) NFDi_Free(ptr)
+#define SIMPLE_EXEC_PROBE1(name, a) NFDi_PROBE1(exec_##name, a)
+#define SIMPLE_EXEC_PROBE2(name, a, b) NFDi_PROBE2(exec_##name, a, b)
 #define SIMPLE_EXEC_IMPLEMENTATION
 #include "simple_exec.h"
 
@@ -17,85 +33,147 @@
 const char NO_ZENITY_MSG[] = "zenity not installed";
 
 
-static void AddTypeToFilterName( const char *typebuf, char *filterName, size_t bufsize )
+static char* ZenityStrdup(const char* str)
 {
-    size_t len = strlen(filterName);
-    if( len > 0 )
-        strncat( filterName, " *.", bufsize - len - 1 );
-    else
-        strncat( filterName, "--file-filter=*.", bufsize - len - 1 );
-    
-    len = strlen(filterName);
-    strncat( filterName, typebuf, bufsize - len - 1 );
+    size_t len = strlen(str) + 1;
+    char* copy = (char*)NFDi_Malloc(len);
+    release_assert(copy != NULL);
+    memcpy(copy, str, len);
+    return copy;
 }
 
-static void AddFiltersToCommandArgs(char** commandArgs, int commandArgsLen, const char *filterList )
+
+static void FreeFilterArgs(void* backendData)
 {
-    char typebuf[NFD_MAX_STRLEN] = {0};
-    const char *p_filterList = filterList;
-    char *p_typebuf = typebuf;
-    char filterName[NFD_MAX_STRLEN] = {0};
-    int i;
-    
-    if ( !filterList || strlen(filterList) == 0 )
-        return;
+    char** args = (char**)backendData;
+    for(size_t i = 0; args[i] != NULL; i++)
+        NFDi_Free(args[i]);
+    NFDi_Free(args);
+}
+
+/* Writes the zenity pattern for the spec at index to out, if out is
+   not NULL, and returns its length: "*.ext" for an extension, the glob
+   itself otherwise.  zenity matches case sensitively, so when the
+   filter ignores case each letter outside a [...] class becomes "[xX]";
+   classes are passed on as written. */
+static size_t WriteFilterPattern(const nfdfilter_t* filter, size_t index, char* out)
+{
+    size_t specLen;
+    const nfdchar_t* spec = NFDi_Filter_GetSpec(filter, index, &specLen);
+    int inClass = 0;
+    size_t len = 0;
 
-    while ( 1 )
+    if(!NFDi_Filter_IsGlob(filter, index))
     {
-        
-        if ( NFDi_IsFilterSegmentChar(*p_filterList) )
+        if(out)
+            memcpy(out, "*.", 2);
+        len = 2;
+    }
+
+    for(size_t i = 0; i < specLen; i++)
+    {
+        char ch = spec[i];
+        char lower = (ch >= 'A' && ch <= 'Z') ? (char)(ch - 'A' + 'a') : ch;
+
+        if(ch == '[' && !inClass)
+            inClass = 1;
+        else if(ch == ']' && inClass)
+            inClass = 0;
+
+        if(filter->ignoreCase && !inClass && lower >= 'a' && lower <= 'z')
         {
-            char typebufWildcard[NFD_MAX_STRLEN];
-            /* add another type to the filter */
-            assert( strlen(typebuf) > 0 );
-            assert( strlen(typebuf) < NFD_MAX_STRLEN-1 );
-            
-            snprintf( typebufWildcard, NFD_MAX_STRLEN, "*.%s", typebuf );
-
-            AddTypeToFilterName( typebuf, filterName, NFD_MAX_STRLEN );
-            
-            p_typebuf = typebuf;
-            memset( typebuf, 0, sizeof(char) * NFD_MAX_STRLEN );
+            if(out)
+            {
+                out[len] = '[';
+                out[len + 1] = lower;
+                out[len + 2] = (char)(lower - 'a' + 'A');
+                out[len + 3] = ']';
+            }
+            len += 4;
         }
-        
-        if ( *p_filterList == ';' || *p_filterList == '\0' )
+        else
         {
-            /* end of filter -- add it to the dialog */
+            if(out)
+                out[len] = ch;
+            len++;
+        }
+    }
 
-            for(i = 0; commandArgs[i] != NULL && i < commandArgsLen; i++);
+    return len;
+}
 
-            commandArgs[i] = strdup(filterName);
-            
-            filterName[0] = '\0';
+/* a "--file-filter=*.png *.jpg" argument for each group of a compiled
+   filter and then the wildcard, built on first use and kept in the
+   filter; NULL terminated */
+static char** GetFilterArgs(nfdfilter_t* filter)
+{
+    if(filter->backendData)
+        return (char**)filter->backendData;
 
-            if ( *p_filterList == '\0' )
-                break;
-        }
+    const char prefix[] = "--file-filter=";
+    char** args = (char**)NFDi_Malloc((filter->groupCount + 2) * sizeof(char*));
+    release_assert(args != NULL);
+    memset(args, 0, (filter->groupCount + 2) * sizeof(char*));
+
+    for(size_t g = 0; g < filter->groupCount; g++)
+    {
+        const nfdfiltergroup_t* group = &filter->groups[g];
+
+        size_t len = sizeof(prefix);
+        for(size_t i = 0; i < group->specCount; i++)
+            len += 1 + WriteFilterPattern(filter, group->firstSpec + i, NULL);
 
-        if ( !NFDi_IsFilterSegmentChar( *p_filterList ) )
+        char* arg = (char*)NFDi_Malloc(len);
+        release_assert(arg != NULL);
+
+        char* p = arg;
+        memcpy(p, prefix, sizeof(prefix) - 1);
+        p += sizeof(prefix) - 1;
+        for(size_t i = 0; i < group->specCount; i++)
         {
-            *p_typebuf = *p_filterList;
-            p_typebuf++;
+            if(i > 0)
+                *p++ = ' ';
+            p += WriteFilterPattern(filter, group->firstSpec + i, p);
         }
+        *p = '\0';
 
-        p_filterList++;
+        args[g] = arg;
     }
-    
-    /* always append a wildcard option to the end*/
-    
+
+    if(filter->groupCount > 0)
+        args[filter->groupCount] = ZenityStrdup("--file-filter=*.*");
+
+    filter->backendData = args;
+    filter->freeBackendData = FreeFilterArgs;
+    return args;
+}
+
+static int FilterArgCount(nfdfilter_t* filter)
+{
+    return filter && filter->groupCount > 0 ? (int)filter->groupCount + 1 : 0;
+}
+
+static void AddCompiledFiltersToCommandArgs(char** commandArgs, int commandArgsLen, nfdfilter_t* filter)
+{
+    char** args = GetFilterArgs(filter);
+
+    int i;
     for(i = 0; commandArgs[i] != NULL && i < commandArgsLen; i++);
 
-    commandArgs[i] = strdup("--file-filter=*.*");
+    for(size_t j = 0; args[j] != NULL && i < commandArgsLen - 1; j++, i++)
+        commandArgs[i] = ZenityStrdup(args[j]);
 }
 
-static nfdresult_t ZenityCommon(char** command, int commandLen, const char* defaultPath, const char* filterList, char** stdOut)
+static void ZenityAddCommonArgs(char** command, int commandLen, const char* defaultPath, nfdfilter_t* filter)
 {
     if(defaultPath != NULL)
     {
         char* prefix = "--filename=";
         int len = strlen(prefix) + strlen(defaultPath) + 1;
 
-        char* tmp = (char*) calloc(len, 1);
+        char* tmp = (char*)NFDi_Malloc(len);
+        release_assert(tmp != NULL);
+        tmp[0] = '\0';
         strcat(tmp, prefix);
         strcat(tmp, defaultPath);
 
@@ -105,203 +183,655 @@ static nfdresult_t ZenityCommon(char** command, int commandLen, const char* defa
         command[i] = tmp;
     }
 
-    AddFiltersToCommandArgs(command, commandLen, filterList);
-
-    int byteCount = 0;
-    int exitCode = 0;
-    int processInvokeError = runCommandArray(stdOut, &byteCount, &exitCode, 0, command);
+    if(filter)
+        AddCompiledFiltersToCommandArgs(command, commandLen, filter);
+}
 
+/* A handle's state is shared with NFD_Cancel, which may run on another
+   thread.  zenity is only killed while the handle is open or closing,
+   and NFD_Handle_Finish never reaps it while a kill is under way, so it
+   is never signalled after being reaped. */
+enum
+{
+    HANDLE_OPEN,               /* zenity may still be running */
+    HANDLE_CLOSED,             /* zenity closed its output; nothing to cancel */
+    HANDLE_KILLING,            /* NFD_Cancel is killing zenity */
+    HANDLE_CANCELLED,          /* zenity was killed by NFD_Cancel */
+    HANDLE_REAPING             /* NFD_Handle_Finish is reaping zenity */
+};
+
+struct nfdhandle_s
+{
+    runCommandProcess process;
+    int pollFd;                /* epoll set of zenity's stdout and pidfd */
+    int multiple;              /* output is a '|' separated path list */
+    int done;                  /* zenity has exited or closed stdout */
+    uint64_t state;            /* HANDLE_*, only through NFDi_Atomic_* */
+    long long startMs;         /* when zenity was launched */
+    int timeoutMs;             /* cancel after this long, 0 for never */
+    runCommandCapture capture; /* output of single path dialogs */
+    nfdpathparser_t parser;    /* output of multiple selection dialogs */
+    nfdcontext_t* context;     /* bound while the handle reads or finishes */
+};
+
+static void ZenityFreeArgs(char** command, int commandLen)
+{
     for(int i = 0; command[i] != NULL && i < commandLen; i++)
-        free(command[i]);
+        NFDi_Free(command[i]);
+}
 
-    nfdresult_t result = NFD_OKAY;
+static long long NowMs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* milliseconds until the handle times out, or -1 if it never does */
+static int RemainingMs(const nfdhandle_t* handle)
+{
+    if(handle->timeoutMs == 0)
+        return -1;
+
+    long long remaining = handle->startMs + handle->timeoutMs - NowMs();
+    return remaining > 0 ? (int)remaining : 0;
+}
+
+static void ParsePathListOutput(const char* data, int byteCount, void* userData)
+{
+    NFDi_PathParser_Feed((nfdpathparser_t*)userData, data, (size_t)byteCount);
+}
+
+/* Watching the pidfd as well as stdout lets a handle complete when
+   zenity exits, even if something it launched still holds stdout. */
+static int CreatePollSet(const runCommandProcess* process)
+{
+    int pollFd = epoll_create1(EPOLL_CLOEXEC);
+    if(pollFd == -1)
+        return -1;
+
+    int fds[2] = { process->stdoutFd, process->pidFd };
+    for(int i = 0; i < 2; i++)
+    {
+        if(fds[i] == -1)
+            continue;
+
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.fd = fds[i];
+        if(epoll_ctl(pollFd, EPOLL_CTL_ADD, fds[i], &event) != 0)
+        {
+            close(pollFd);
+            return -1;
+        }
+    }
+
+    return pollFd;
+}
+
+/* launches zenity without waiting for it; '|' separated output of
+   multiple selections is split into paths while it is being read */
+static nfdresult_t ZenityCommonStart(char** command, int commandLen, const char* defaultPath, nfdfilter_t* filter, int multiple, nfdhandle_t** outHandle)
+{
+    uint64_t traceStart = NFDi_Trace_Begin();
+    ZenityAddCommonArgs(command, commandLen, defaultPath, filter);
+    NFDi_Trace_End(NFD_PHASE_FILTER_BUILD, traceStart);
+
+    nfdhandle_t* handle = NFDi_Malloc(sizeof(nfdhandle_t));
+    if(!handle)
+    {
+        ZenityFreeArgs(command, commandLen);
+        return NFD_ERROR;
+    }
+    memset(handle, 0, sizeof(nfdhandle_t));
+
+    traceStart = NFDi_Trace_Begin();
+    uint64_t spawnStart = NFDi_Trace_Now();
+    int processInvokeError = runCommandStart(&handle->process, 0, 1, command);
+    NFDi_Stats_Add(NFD_STAT_SPAWN_NS, NFDi_Trace_Now() - spawnStart);
+    NFDi_Trace_End(NFD_PHASE_SPAWN, traceStart);
+    ZenityFreeArgs(command, commandLen);
 
     if(processInvokeError == COMMAND_NOT_FOUND)
     {
-        NFDi_SetError(NO_ZENITY_MSG);
-        result = NFD_ERROR;
+        NFDi_SetErrorCode(NFD_ERR_UNAVAILABLE, NO_ZENITY_MSG);
+        NFDi_Free(handle);
+        return NFD_ERROR;
+    }
+
+    handle->pollFd = CreatePollSet(&handle->process);
+    handle->multiple = multiple;
+    handle->startMs = NowMs();
+    handle->timeoutMs = NFDi_GetTimeout();
+    handle->context = NFDi_GetContext();
+    if(multiple)
+    {
+        NFDi_PathParser_Init(&handle->parser, '|');
     }
     else
     {
-        if(exitCode == 1)
-            result = NFD_CANCEL;
+        handle->capture.size = 4096;
+        handle->capture.data = (char*)NFDi_Malloc(handle->capture.size);
+        release_assert(handle->capture.data != NULL);
     }
 
-    return result;
+    *outHandle = handle;
+    return NFD_OKAY;
+}
+
+static int ZenityIsCancelled(nfdhandle_t* handle)
+{
+    uint64_t state = NFDi_Atomic_Load(&handle->state);
+    return state == HANDLE_KILLING || state == HANDLE_CANCELLED;
 }
- 
 
-static nfdresult_t AllocPathSet(char* zenityList, nfdpathset_t *pathSet )
+/* reads whatever zenity has written; non-zero once it has closed */
+static int ZenityPoll(nfdhandle_t* handle)
 {
-    assert(zenityList);
-    assert(pathSet);
-    
-    size_t len = strlen(zenityList) + 1;
-    pathSet->buf = NFDi_Malloc(len);
+    if(!handle->done && RemainingMs(handle) == 0)
+        NFD_Cancel(handle);
 
-    int numEntries = 1;
+    /* output of a killed dialog is discarded */
+    if(ZenityIsCancelled(handle))
+        return 1;
 
-    for(size_t i = 0; i < len; i++)
+    uint64_t traceStart = NFDi_Trace_Begin();
+    while(!handle->done)
     {
-        char ch = zenityList[i];
+        /* checked before reading, so output written just before exit
+           is drained first */
+        int exited = runCommandHasExited(&handle->process);
 
-        if(ch == '|')
+        /* each runCommandRead is one read(), or more after EINTR */
+        int status;
+        if(handle->multiple)
         {
-            numEntries++;
-            ch = '\0';
+            status = runCommandRead(&handle->process, ParsePathListOutput, &handle->parser);
         }
+        else
+        {
+            size_t captureSize = handle->capture.size;
+            status = runCommandRead(&handle->process, runCommandCaptureOutput, &handle->capture);
+            if(handle->capture.size != captureSize)
+                NFDi_Stats_Add(NFD_STAT_CAPTURE_REALLOCS, 1);
+        }
+        NFDi_Stats_Add(NFD_STAT_READS, 1);
 
-        pathSet->buf[i] = ch;
+        if(status == 0)
+            handle->done = 1;
+        else if(status == -1)
+        {
+            handle->done = exited;
+            break;
+        }
     }
+    NFDi_Trace_End(NFD_PHASE_CAPTURE, traceStart);
 
-    pathSet->count = numEntries;
-    assert( pathSet->count > 0 );
+    if(handle->done)
+        NFDi_Atomic_CAS(&handle->state, HANDLE_OPEN, HANDLE_CLOSED);
+    return handle->done;
+}
 
-    pathSet->indices = NFDi_Malloc( sizeof(size_t)*pathSet->count );
+/* Takes the handle from NFD_Cancel before zenity is reaped, waiting out
+   a kill that is under way.  Returns non-zero if zenity was cancelled. */
+static int ZenityBeginReap(nfdhandle_t* handle)
+{
+    while(1)
+    {
+        uint64_t state = NFDi_Atomic_Load(&handle->state);
+        if(state == HANDLE_CANCELLED)
+            return 1;
+        if(state != HANDLE_KILLING && NFDi_Atomic_CAS(&handle->state, state, HANDLE_REAPING) == state)
+            return 0;
+    }
+}
 
-    int entry = 0;
-    pathSet->indices[0] = 0;
-    for(size_t i = 0; i < len; i++)
+/* waits for zenity to exit and maps its exit code to a result */
+static nfdresult_t ZenityCommonFinish(nfdhandle_t* handle)
+{
+    uint64_t traceStart = NFDi_Trace_Begin();
+    while(!ZenityPoll(handle))
     {
-        char ch = zenityList[i];
+        struct pollfd pfds[2];
+        memset(pfds, 0, sizeof(pfds));
+        pfds[0].fd = handle->process.stdoutFd;
+        pfds[0].events = POLLIN;
+        pfds[1].fd = handle->process.pidFd;
+        pfds[1].events = POLLIN;
+        poll(pfds, handle->process.pidFd != -1 ? 2 : 1, RemainingMs(handle));
+    }
+    NFDi_Trace_End(NFD_PHASE_USER_WAIT, traceStart);
 
-        if(ch == '|')
-        {
-            entry++;
-            pathSet->indices[entry] = i + 1;
-        }
+    traceStart = NFDi_Trace_Begin();
+    int cancelled = ZenityBeginReap(handle);
+    int exitCode = 0;
+    int processInvokeError = runCommandFinish(&handle->process, &exitCode);
+    NFDi_Trace_End(NFD_PHASE_CLEANUP, traceStart);
+
+    nfdresult_t result = NFD_OKAY;
+
+    if(cancelled)
+    {
+        result = NFD_CANCEL;
     }
-    
-    return NFD_OKAY;
+    else if(processInvokeError == COMMAND_NOT_FOUND)
+    {
+        NFDi_SetErrorCode(NFD_ERR_UNAVAILABLE, NO_ZENITY_MSG);
+        result = NFD_ERROR;
+    }
+    else if(exitCode == -1)
+    {
+        /* another reaper in the host took the exit code; zenity only
+           prints a path when the user accepts */
+        int hasOutput = handle->multiple ? handle->parser.count > 0 : handle->capture.used > 0;
+        if(!hasOutput)
+            result = NFD_CANCEL;
+    }
+    else
+    {
+        if(exitCode == 1)
+            result = NFD_CANCEL;
+    }
+
+    return result;
+}
+
+static void ZenityFreeHandle(nfdhandle_t* handle)
+{
+    uint64_t traceStart = NFDi_Trace_Begin();
+
+    if(handle->pollFd != -1)
+        close(handle->pollFd);
+
+    if(handle->multiple)
+        NFDi_PathParser_Free(&handle->parser);
+    else
+        NFDi_Free(handle->capture.data);
+
+    NFDi_Free(handle);
+    NFDi_Trace_End(NFD_PHASE_CLEANUP, traceStart);
+}
+
+static nfdresult_t CopyPathOutput(const runCommandCapture* capture, nfdchar_t** outPath)
+{
+    uint64_t traceStart = NFDi_Trace_Begin();
+    size_t len = capture->used;
+    if(len > 0 && capture->data[len-1] == '\n')
+        len--; // trim out the final \n
+
+    int valid = len > 0 && NFDi_UTF8_CheckPath(capture->data, len);
+    NFDi_Trace_End(NFD_PHASE_PARSE, traceStart);
+
+    if(len == 0)
+    {
+        NFDi_SetError("zenity returned no path");
+        return NFD_ERROR;
+    }
+
+    if(!valid)
+        return NFD_ERROR;
+
+    traceStart = NFDi_Trace_Begin();
+    *outPath = NFDi_Malloc(len + 1);
+    if(*outPath)
+    {
+        memcpy(*outPath, capture->data, len);
+        (*outPath)[len] = '\0';
+        NFDi_Stats_Add(NFD_STAT_PATHS, 1);
+    }
+    NFDi_Trace_End(NFD_PHASE_ALLOC, traceStart);
+
+    return *outPath ? NFD_OKAY : NFD_ERROR;
 }
                                  
 /* public */
 
-nfdresult_t NFD_OpenDialog( const char *filterList,
-                            const nfdchar_t *defaultPath,
-                            nfdchar_t **outPath )
-{    
-    int commandLen = 100;
+nfdresult_t NFD_Init( void )
+{
+    NFDi_CALL_ENTRY();
+    uint64_t traceStart = NFDi_Trace_Begin();
+    int launcherError = runCommandLauncherStart();
+    NFDi_Trace_End(NFD_PHASE_INIT, traceStart);
+
+    nfdresult_t result = NFD_OKAY;
+    if(launcherError != 0)
+    {
+        NFDi_SetErrorCode(NFD_ERR_UNAVAILABLE, "could not start the zenity launcher");
+        result = NFD_ERROR;
+    }
+
+    NFDi_CALL_RETURN(result);
+    return result;
+}
+
+/* forking the launcher is quick, so there is nothing to gain from a thread */
+nfdresult_t NFD_InitAsync( void )
+{
+    return NFD_Init();
+}
+
+void NFD_Quit( void )
+{
+    runCommandLauncherStop();
+}
+
+static nfdresult_t ZenityOpenDialogStart(nfdfilter_t* filter, const char* defaultPath, nfdhandle_t** outHandle)
+{
+    int commandLen = 100 + FilterArgCount(filter);
     char* command[commandLen];
     memset(command, 0, commandLen * sizeof(char*));
 
-    command[0] = strdup("zenity");
-    command[1] = strdup("--file-selection");
-    command[2] = strdup("--title=Open File");
+    command[0] = ZenityStrdup("zenity");
+    command[1] = ZenityStrdup("--file-selection");
+    command[2] = ZenityStrdup("--title=Open File");
+
+    return ZenityCommonStart(command, commandLen, defaultPath, filter, 0, outHandle);
+}
 
-    char* stdOut = NULL;
-    nfdresult_t result = ZenityCommon(command, commandLen, defaultPath, filterList, &stdOut);
-            
-    if(stdOut != NULL)
+static nfdresult_t ZenityOpenDialogMultipleStart(nfdfilter_t* filter, const char* defaultPath, nfdhandle_t** outHandle)
+{
+    int commandLen = 100 + FilterArgCount(filter);
+    char* command[commandLen];
+    memset(command, 0, commandLen * sizeof(char*));
+
+    command[0] = ZenityStrdup("zenity");
+    command[1] = ZenityStrdup("--file-selection");
+    command[2] = ZenityStrdup("--title=Open Files");
+    command[3] = ZenityStrdup("--multiple");
+
+    return ZenityCommonStart(command, commandLen, defaultPath, filter, 1, outHandle);
+}
+
+static nfdresult_t ZenitySaveDialogStart(nfdfilter_t* filter, const char* defaultPath, nfdhandle_t** outHandle)
+{
+    int commandLen = 100 + FilterArgCount(filter);
+    char* command[commandLen];
+    memset(command, 0, commandLen * sizeof(char*));
+
+    command[0] = ZenityStrdup("zenity");
+    command[1] = ZenityStrdup("--file-selection");
+    command[2] = ZenityStrdup("--title=Save File");
+    command[3] = ZenityStrdup("--save");
+
+    return ZenityCommonStart(command, commandLen, defaultPath, filter, 0, outHandle);
+}
+
+nfdresult_t NFD_OpenDialogAsync( const nfdchar_t *filterList,
+                                 const nfdchar_t *defaultPath,
+                                 nfdhandle_t **outHandle )
+{
+    NFDi_CALL_ENTRY();
+    nfdfilter_t* filter;
+    nfdresult_t result = NFD_Filter_Compile(filterList, &filter);
+    if(result == NFD_OKAY)
     {
-        size_t len = strlen(stdOut);
-        *outPath = NFDi_Malloc(len);
-        memcpy(*outPath, stdOut, len);
-        (*outPath)[len-1] = '\0'; // trim out the final \n with a null terminator
-        free(stdOut);
+        result = ZenityOpenDialogStart(filter, defaultPath, outHandle);
+        NFD_Filter_Free(filter);
     }
-    else
+
+    NFDi_CALL_RETURN(result);
+    return result;
+}
+
+nfdresult_t NFD_OpenDialogMultipleAsync( const nfdchar_t *filterList,
+                                         const nfdchar_t *defaultPath,
+                                         nfdhandle_t **outHandle )
+{
+    NFDi_CALL_ENTRY();
+    nfdfilter_t* filter;
+    nfdresult_t result = NFD_Filter_Compile(filterList, &filter);
+    if(result == NFD_OKAY)
     {
-        *outPath = NULL;
+        result = ZenityOpenDialogMultipleStart(filter, defaultPath, outHandle);
+        NFD_Filter_Free(filter);
     }
 
+    NFDi_CALL_RETURN(result);
     return result;
 }
 
+nfdresult_t NFD_SaveDialogAsync( const nfdchar_t *filterList,
+                                 const nfdchar_t *defaultPath,
+                                 nfdhandle_t **outHandle )
+{
+    NFDi_CALL_ENTRY();
+    nfdfilter_t* filter;
+    nfdresult_t result = NFD_Filter_Compile(filterList, &filter);
+    if(result == NFD_OKAY)
+    {
+        result = ZenitySaveDialogStart(filter, defaultPath, outHandle);
+        NFD_Filter_Free(filter);
+    }
+
+    NFDi_CALL_RETURN(result);
+    return result;
+}
 
-nfdresult_t NFD_OpenDialogMultiple( const nfdchar_t *filterList,
-                                    const nfdchar_t *defaultPath,
-                                    nfdpathset_t *outPaths )
+nfdresult_t NFD_PickFolderAsync( const nfdchar_t *defaultPath,
+                                 nfdhandle_t **outHandle )
 {
+    NFDi_CALL_ENTRY();
     int commandLen = 100;
     char* command[commandLen];
     memset(command, 0, commandLen * sizeof(char*));
 
-    command[0] = strdup("zenity");
-    command[1] = strdup("--file-selection");
-    command[2] = strdup("--title=Open Files");
-    command[3] = strdup("--multiple");
+    command[0] = ZenityStrdup("zenity");
+    command[1] = ZenityStrdup("--file-selection");
+    command[2] = ZenityStrdup("--directory");
+    command[3] = ZenityStrdup("--title=Select folder");
 
-    char* stdOut = NULL;
-    nfdresult_t result = ZenityCommon(command, commandLen, defaultPath, filterList, &stdOut);
-            
-    if(stdOut != NULL)
-    {
-        size_t len = strlen(stdOut);
-        stdOut[len-1] = '\0'; // remove trailing newline
+    nfdresult_t result = ZenityCommonStart(command, commandLen, defaultPath, NULL, 0, outHandle);
+    NFDi_CALL_RETURN(result);
+    return result;
+}
+
+int NFD_Handle_GetFd( const nfdhandle_t *handle )
+{
+    assert(handle);
+    return handle->pollFd != -1 ? handle->pollFd : handle->process.stdoutFd;
+}
+
+int NFD_Handle_Poll( nfdhandle_t *handle )
+{
+    assert(handle);
+
+    nfdcontext_t* previous = NFD_SetThreadContext(handle->context);
+    int done = ZenityPoll(handle);
+    NFD_SetThreadContext(previous);
+    return done;
+}
+
+void NFD_Cancel( nfdhandle_t *handle )
+{
+    assert(handle);
+
+    if(NFDi_Atomic_CAS(&handle->state, HANDLE_OPEN, HANDLE_KILLING) != HANDLE_OPEN)
+        return;
+
+    /* zenity has nothing to clean up; NFD_Handle_Finish reaps it */
+    runCommandKill(&handle->process);
+    NFDi_Atomic_CAS(&handle->state, HANDLE_KILLING, HANDLE_CANCELLED);
+}
+
+void NFD_Handle_SetTimeout( nfdhandle_t *handle, int timeoutMs )
+{
+    assert(handle);
+    assert(timeoutMs >= 0);
+    handle->timeoutMs = timeoutMs;
+}
 
-        if ( AllocPathSet( stdOut, outPaths ) == NFD_ERROR )
-            result = NFD_ERROR;
+nfdresult_t NFD_Handle_Finish( nfdhandle_t *handle, nfdchar_t **outPath )
+{
+    NFDi_CALL_ENTRY();
+    assert(handle);
+    assert(outPath);
 
-        free(stdOut);
+    nfdcontext_t* previous = NFD_SetThreadContext(handle->context);
+    nfdresult_t result = ZenityCommonFinish(handle);
+
+    *outPath = NULL;
+    if(handle->multiple)
+    {
+        NFDi_SetErrorCode(NFD_ERR_USAGE, "NFD_Handle_FinishMultiple must finish multiple selection dialogs");
+        result = NFD_ERROR;
     }
-    else
+    else if(result == NFD_OKAY)
     {
+        result = CopyPathOutput(&handle->capture, outPath);
+    }
+
+    ZenityFreeHandle(handle);
+    NFD_SetThreadContext(previous);
+    NFDi_CALL_RETURN(result);
+    return result;
+}
+
+nfdresult_t NFD_Handle_FinishMultiple( nfdhandle_t *handle, nfdpathset_t *outPaths )
+{
+    NFDi_CALL_ENTRY();
+    assert(handle);
+    assert(outPaths);
+
+    nfdcontext_t* previous = NFD_SetThreadContext(handle->context);
+    nfdresult_t result = ZenityCommonFinish(handle);
+
+    if(!handle->multiple)
+    {
+        NFDi_SetErrorCode(NFD_ERR_USAGE, "NFD_Handle_Finish must finish single path dialogs");
         result = NFD_ERROR;
     }
+    else if(result == NFD_OKAY)
+    {
+        result = NFDi_PathParser_Finish(&handle->parser, outPaths);
+        if(result == NFD_OKAY)
+            result = NFDi_PathSet_CheckUTF8(outPaths);
+    }
 
+    ZenityFreeHandle(handle);
+    NFD_SetThreadContext(previous);
+    NFDi_CALL_RETURN(result);
     return result;
 }
 
-nfdresult_t NFD_SaveDialog( const nfdchar_t *filterList,
+nfdresult_t NFD_OpenDialog( const nfdchar_t *filterList,
                             const nfdchar_t *defaultPath,
                             nfdchar_t **outPath )
 {
-    int commandLen = 100;
-    char* command[commandLen];
-    memset(command, 0, commandLen * sizeof(char*));
+    NFDi_CALL_ENTRY();
+    nfdhandle_t* handle;
+    nfdresult_t result;
+    if(NFDi_Headless_IsEnabled())
+        result = NFDi_Headless_Dialog(NFD_DIALOG_OPEN, filterList, NULL, defaultPath, outPath, NULL);
+    else if((result = NFD_OpenDialogAsync(filterList, defaultPath, &handle)) == NFD_OKAY)
+        result = NFD_Handle_Finish(handle, outPath);
+    else
+        *outPath = NULL;
+
+    NFDi_CALL_RETURN(result);
+    return result;
+}
 
-    command[0] = strdup("zenity");
-    command[1] = strdup("--file-selection");
-    command[2] = strdup("--title=Save File");
-    command[3] = strdup("--save");
 
-    char* stdOut = NULL;
-    nfdresult_t result = ZenityCommon(command, commandLen, defaultPath, filterList, &stdOut);
-            
-    if(stdOut != NULL)
-    {
-        size_t len = strlen(stdOut);
-        *outPath = NFDi_Malloc(len);
-        memcpy(*outPath, stdOut, len);
-        (*outPath)[len-1] = '\0'; // trim out the final \n with a null terminator
-        free(stdOut);
-    }
+nfdresult_t NFD_OpenDialogMultiple( const nfdchar_t *filterList,
+                                    const nfdchar_t *defaultPath,
+                                    nfdpathset_t *outPaths )
+{
+    NFDi_CALL_ENTRY();
+    nfdhandle_t* handle;
+    nfdresult_t result;
+    if(NFDi_Headless_IsEnabled())
+        result = NFDi_Headless_Dialog(NFD_DIALOG_OPEN_MULTIPLE, filterList, NULL, defaultPath, NULL, outPaths);
+    else if((result = NFD_OpenDialogMultipleAsync(filterList, defaultPath, &handle)) == NFD_OKAY)
+        result = NFD_Handle_FinishMultiple(handle, outPaths);
+
+    NFDi_CALL_RETURN(result);
+    return result;
+}
+
+nfdresult_t NFD_SaveDialog( const nfdchar_t *filterList,
+                            const nfdchar_t *defaultPath,
+                            nfdchar_t **outPath )
+{
+    NFDi_CALL_ENTRY();
+    nfdhandle_t* handle;
+    nfdresult_t result;
+    if(NFDi_Headless_IsEnabled())
+        result = NFDi_Headless_Dialog(NFD_DIALOG_SAVE, filterList, NULL, defaultPath, outPath, NULL);
+    else if((result = NFD_SaveDialogAsync(filterList, defaultPath, &handle)) == NFD_OKAY)
+        result = NFD_Handle_Finish(handle, outPath);
     else
-    {
         *outPath = NULL;
-    }
 
+    NFDi_CALL_RETURN(result);
     return result;
 }
 
 nfdresult_t NFD_PickFolder(const nfdchar_t *defaultPath,
     nfdchar_t **outPath)
 {
-    int commandLen = 100;
-    char* command[commandLen];
-    memset(command, 0, commandLen * sizeof(char*));
+    NFDi_CALL_ENTRY();
+    nfdhandle_t* handle;
+    nfdresult_t result;
+    if(NFDi_Headless_IsEnabled())
+        result = NFDi_Headless_Dialog(NFD_DIALOG_PICK_FOLDER, NULL, NULL, defaultPath, outPath, NULL);
+    else if((result = NFD_PickFolderAsync(defaultPath, &handle)) == NFD_OKAY)
+        result = NFD_Handle_Finish(handle, outPath);
+    else
+        *outPath = NULL;
+
+    NFDi_CALL_RETURN(result);
+    return result;
+}
 
-    command[0] = strdup("zenity");
-    command[1] = strdup("--file-selection");
-    command[2] = strdup("--directory");
-    command[3] = strdup("--title=Select folder");
+nfdresult_t NFD_OpenDialogF( nfdfilter_t *filter,
+                             const nfdchar_t *defaultPath,
+                             nfdchar_t **outPath )
+{
+    NFDi_CALL_ENTRY();
+    nfdhandle_t* handle;
+    nfdresult_t result;
+    if(NFDi_Headless_IsEnabled())
+        result = NFDi_Headless_Dialog(NFD_DIALOG_OPEN, NULL, filter, defaultPath, outPath, NULL);
+    else if((result = ZenityOpenDialogStart(filter, defaultPath, &handle)) == NFD_OKAY)
+        result = NFD_Handle_Finish(handle, outPath);
+    else
+        *outPath = NULL;
 
-    char* stdOut = NULL;
-    nfdresult_t result = ZenityCommon(command, commandLen, defaultPath, "", &stdOut);
-            
-    if(stdOut != NULL)
-    {
-        size_t len = strlen(stdOut);
-        *outPath = NFDi_Malloc(len);
-        memcpy(*outPath, stdOut, len);
-        (*outPath)[len-1] = '\0'; // trim out the final \n with a null terminator
-        free(stdOut);
-    }
+    NFDi_CALL_RETURN(result);
+    return result;
+}
+
+nfdresult_t NFD_OpenDialogMultipleF( nfdfilter_t *filter,
+                                     const nfdchar_t *defaultPath,
+                                     nfdpathset_t *outPaths )
+{
+    NFDi_CALL_ENTRY();
+    nfdhandle_t* handle;
+    nfdresult_t result;
+    if(NFDi_Headless_IsEnabled())
+        result = NFDi_Headless_Dialog(NFD_DIALOG_OPEN_MULTIPLE, NULL, filter, defaultPath, NULL, outPaths);
+    else if((result = ZenityOpenDialogMultipleStart(filter, defaultPath, &handle)) == NFD_OKAY)
+        result = NFD_Handle_FinishMultiple(handle, outPaths);
+
+    NFDi_CALL_RETURN(result);
+    return result;
+}
+
+nfdresult_t NFD_SaveDialogF( nfdfilter_t *filter,
+                             const nfdchar_t *defaultPath,
+                             nfdchar_t **outPath )
+{
+    NFDi_CALL_ENTRY();
+    nfdhandle_t* handle;
+    nfdresult_t result;
+    if(NFDi_Headless_IsEnabled())
+        result = NFDi_Headless_Dialog(NFD_DIALOG_SAVE, NULL, filter, defaultPath, outPath, NULL);
+    else if((result = ZenitySaveDialogStart(filter, defaultPath, &handle)) == NFD_OKAY)
+        result = NFD_Handle_Finish(handle, outPath);
     else
-    {
         *outPath = NULL;
-    }
 
+    NFDi_CALL_RETURN(result);
     return result;
 }
@@ -12,8 +12,51 @@
 #ifndef SIMPLE_EXEC_H
 #define SIMPLE_EXEC_H
 
+#include <sys/types.h>
+
+// called with each chunk of the child's output as soon as it is read
+typedef void (*runCommandOutputCallback)(const char* data, int byteCount, void* userData);
+
+// a running child, for callers that drive the output loop themselves
+typedef struct
+{
+    pid_t pid;
+    int pidFd;     // -1 where pidfds are unavailable, else readable on exit
+    int statusFd;  // exit status reported by the launcher, else -1
+    int stdinFd;   // write end of the child's stdin
+    int stdoutFd;  // read end of the child's stdout, poll it for POLLIN
+    char* buffer;
+    int bufferSize;
+} runCommandProcess;
+
 int runCommand(char** stdOut, int* stdOutByteCount, int* returnCode, int includeStdErr, char* command, ...);
 int runCommandArray(char** stdOut, int* stdOutByteCount, int* returnCode, int includeStdErr, char* const* allArgs);
+int runCommandArrayStream(runCommandOutputCallback onOutput, void* userData, int* returnCode, int includeStdErr, char* const* allArgs);
+
+// runCommandArrayStream in steps: start the child, call runCommandRead until
+// it returns 0 (end of output), then reap it with runCommandFinish.  Pass
+// nonBlocking to have runCommandRead return -1 instead of waiting for output.
+int runCommandStart(runCommandProcess* process, int includeStdErr, int nonBlocking, char* const* allArgs);
+int runCommandRead(runCommandProcess* process, runCommandOutputCallback onOutput, void* userData);
+int runCommandFinish(runCommandProcess* process, int* returnCode);
+// kills a started child; runCommandRead then reaches the end of output.
+// Call it before runCommandFinish, never after.  The child is signalled
+// through its pidfd, or by the launcher helper that has yet to reap it,
+// and only by pid when neither exists; a pid is only safe to signal while
+// nothing has reaped it, so hosts without pidfds that reap every child
+// themselves should not kill children this way.
+void runCommandKill(runCommandProcess* process);
+// non-zero once the child has exited, without reaping it; always zero when
+// there is no pidfd and no launcher
+int runCommandHasExited(runCommandProcess* process);
+
+// Optional: forks a small launcher process that spawns every later command
+// on the caller's behalf, so the fork is paid once while the host is still
+// small and single threaded.  Commands inherit the environment as it was
+// when the launcher started.  Returns 0 on success.
+int runCommandLauncherStart(void);
+// commands already running are not affected
+void runCommandLauncherStop(void);
 
 #endif // SIMPLE_EXEC_H
 
@@ -27,9 +70,59 @@ int runCommandArray(char** stdOut, int* stdOutByteCount, int* returnCode, int in
 #include <sys/wait.h>
 #include <stdarg.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <spawn.h>
+#include <dirent.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
 
 #define release_assert(exp) { if (!(exp)) { abort(); } }
 
+// define all three before including the implementation to allocate
+// through something other than the C library; realloc is told the old size
+// so that it can be built from the other two
+#ifndef SIMPLE_EXEC_MALLOC
+#define SIMPLE_EXEC_MALLOC(size) malloc(size)
+#define SIMPLE_EXEC_REALLOC(ptr, oldSize, newSize) ((void)(oldSize), realloc((ptr), (newSize)))
+#define SIMPLE_EXEC_FREE(ptr) free(ptr)
+#endif
+
+// define both before including the implementation to mark where a command
+// is spawned, starts running, closes its output and is reaped, e.g. with
+// USDT probes; name is one of spawn, start, eof and wait
+#ifndef SIMPLE_EXEC_PROBE1
+#define SIMPLE_EXEC_PROBE1(name, a)
+#define SIMPLE_EXEC_PROBE2(name, a, b)
+#endif
+
+// output is read in large chunks so megabytes of paths take few syscalls
+#define SIMPLE_EXEC_READ_SIZE (256 * 1024)
+#define SIMPLE_EXEC_PIPE_SIZE (1024 * 1024)
+
+#if defined(__linux__) && !defined(F_SETPIPE_SZ)
+#define F_SETPIPE_SZ 1031
+#endif
+
+// pipe2(), posix_spawn_file_actions_addclosefrom_np() and pidfd_spawnp()
+// need _GNU_SOURCE defined before the first system header.  Without them,
+// pipes are made close-on-exec with fcntl, inherited fds are found in
+// /proc/self/fd, and a child's pidfd is opened after it has been spawned.
+#if defined(__linux__) && defined(_GNU_SOURCE)
+#define SIMPLE_EXEC_HAVE_PIPE2
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 34))
+#define SIMPLE_EXEC_HAVE_CLOSEFROM
+#endif
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 39))
+#define SIMPLE_EXEC_HAVE_PIDFD_SPAWN
+#include <sys/pidfd.h>
+#endif
+#endif
+
 enum PIPE_FILE_DESCRIPTORS
 {
   READ_FD  = 0,
@@ -42,144 +135,820 @@ enum RUN_COMMAND_ERROR
     COMMAND_NOT_FOUND = 1
 };
 
-int runCommandArray(char** stdOut, int* stdOutByteCount, int* returnCode, int includeStdErr, char* const* allArgs)
+#ifdef __linux__
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+#ifndef SYS_pidfd_send_signal
+#define SYS_pidfd_send_signal 424
+#endif
+// idtype_t value for waitid() on a pidfd, Linux 5.4 and later
+#define SIMPLE_EXEC_P_PIDFD 3
+#endif
+
+extern char** environ;
+
+// pipes are close-on-exec so that children spawned concurrently by other
+// threads of the host do not hold them open
+static int makePipe(int fds[2])
 {
-    // adapted from: https://stackoverflow.com/a/479103
+#ifdef SIMPLE_EXEC_HAVE_PIPE2
+    return pipe2(fds, O_CLOEXEC);
+#else
+    if(pipe(fds) != 0)
+        return -1;
+    fcntl(fds[READ_FD], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[WRITE_FD], F_SETFD, FD_CLOEXEC);
+    return 0;
+#endif
+}
+
+// A pidfd keeps referring to our child even if its pid is reused after
+// another part of the host reaps it.  Linux 5.3 and later.
+//
+// Opened from a pid, it only names our child if nothing reaped the child
+// between the spawn and pidfd_open.  The pidfd is dropped if it does not
+// name a child of ours by then, which catches a host that reaps every
+// child or ignores SIGCHLD; what is left is the pid being reused, within
+// that window, by another child of the host, and on Linux 5.3, which
+// cannot tell, by any process.  pidfd_spawnp, and the launcher, whose
+// helper does not reap the command until the host has its pidfd, leave
+// no window at all.
+static int openPidFd(pid_t pid)
+{
+#ifdef __linux__
+    int pidFd = (int)syscall(SYS_pidfd_open, pid, 0);
+    if(pidFd == -1)
+        return -1;
+    fcntl(pidFd, F_SETFD, FD_CLOEXEC);
+
+    siginfo_t info;
+    memset(&info, 0, sizeof(info));
+    int result;
+    while((result = waitid((idtype_t)SIMPLE_EXEC_P_PIDFD, pidFd, &info, WEXITED | WNOHANG | WNOWAIT)) == -1 && errno == EINTR);
+    if(result == -1 && errno == ECHILD)
+    {
+        close(pidFd);
+        return -1;
+    }
 
-    int bufferSize = 256;
-    char buffer[bufferSize + 1];
+    return pidFd;
+#else
+    (void)pid;
+    return -1;
+#endif
+}
 
-    int dataReadFromChildDefaultSize = bufferSize * 5;
-    int dataReadFromChildSize = dataReadFromChildDefaultSize;
-    int dataReadFromChildUsed = 0;
-    char* dataReadFromChild = (char*)malloc(dataReadFromChildSize);
+// Keeps every fd above stderr from being inherited by the child, whether
+// or not the host marked it close-on-exec.
+static void addCloseInheritedFds(posix_spawn_file_actions_t* actions)
+{
+#ifdef SIMPLE_EXEC_HAVE_CLOSEFROM
+    // a single close_range() in the child
+    release_assert(posix_spawn_file_actions_addclosefrom_np(actions, STDERR_FILENO + 1) == 0);
+#else
+    DIR* dir = opendir("/proc/self/fd");
+    if(dir == NULL)
+        return;
+
+    struct dirent* entry;
+    while((entry = readdir(dir)) != NULL)
+    {
+        int fd = atoi(entry->d_name);
+        if(fd <= STDERR_FILENO || fd == dirfd(dir))
+            continue;
 
+        int flags = fcntl(fd, F_GETFD);
+        if(flags != -1 && !(flags & FD_CLOEXEC))
+            release_assert(posix_spawn_file_actions_addclose(actions, fd) == 0);
+    }
 
-    int parentToChild[2];
-    release_assert(pipe(parentToChild) == 0);
+    closedir(dir);
+#endif
+}
 
-    int childToParent[2];
-    release_assert(pipe(childToParent) == 0);
+// Closes every fd from lowFd up, whether or not it is close-on-exec.
+static void closeFdsFrom(int lowFd)
+{
+#ifdef SIMPLE_EXEC_HAVE_CLOSEFROM
+    closefrom(lowFd);
+#else
+    DIR* dir = opendir("/proc/self/fd");
+    if(dir == NULL)
+        return;
+
+    struct dirent* entry;
+    while((entry = readdir(dir)) != NULL)
+    {
+        int fd = atoi(entry->d_name);
+        if(fd >= lowFd && fd != dirfd(dir))
+            close(fd);
+    }
 
-    int errPipe[2];
-    release_assert(pipe(errPipe) == 0);
+    closedir(dir);
+#endif
+}
 
-    pid_t pid;
-    switch( pid = fork() )
+// exit status of a posix_spawn child that could not exec, on libcs that
+// do not report the failure from posix_spawnp itself
+#define SIMPLE_EXEC_EXEC_FAILED 127
+
+// Launches allArgs with stdin and stdout redirected to the given fds.
+// posix_spawn avoids fork()'s page table copy, which is expensive when the
+// host process is large.  Returns -1 if the command could not be run.
+// With outPidFd, also gets a pidfd for the child, or -1 without one.
+static pid_t spawnChild(char* const* allArgs, int includeStdErr, int stdinFd, int stdoutFd, int* outPidFd)
+{
+    posix_spawn_file_actions_t actions;
+    release_assert(posix_spawn_file_actions_init(&actions) == 0);
+
+    release_assert(posix_spawn_file_actions_adddup2(&actions, stdinFd, STDIN_FILENO) == 0);
+    release_assert(posix_spawn_file_actions_adddup2(&actions, stdoutFd, STDOUT_FILENO) == 0);
+
+    if(includeStdErr)
+    {
+        release_assert(posix_spawn_file_actions_adddup2(&actions, stdoutFd, STDERR_FILENO) == 0);
+    }
+    else
+    {
+        release_assert(posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0) == 0);
+    }
+
+    addCloseInheritedFds(&actions);
+
+    pid_t pid = -1;
+    int err = ENOSYS;
+#ifdef SIMPLE_EXEC_HAVE_PIDFD_SPAWN
+    if(outPidFd != NULL)
     {
-        case -1:
+        // clone3() hands back the pidfd with the child, so there is no
+        // moment where the pid alone names it
+        int pidFd;
+        err = pidfd_spawnp(&pidFd, allArgs[0], &actions, NULL, allArgs, environ);
+        if(err == 0)
         {
-            release_assert(0 && "Fork failed");
+            pid = pidfd_getpid(pidFd);
+            *outPidFd = pidFd;
+        }
+    }
+#endif
+    // without clone3(), pidfd_spawnp fails before spawning anything
+    if(err == ENOSYS || err == EINVAL)
+    {
+        err = posix_spawnp(&pid, allArgs[0], &actions, NULL, allArgs, environ);
+        if(err == 0 && outPidFd != NULL)
+            *outPidFd = openPidFd(pid);
+    }
+    posix_spawn_file_actions_destroy(&actions);
+
+    if(err != 0)
+        return -1;
+
+    return pid;
+}
+
+// The launcher is forked by runCommandLauncherStart and receives one
+// SOCK_SEQPACKET message per command: a byte holding includeStdErr followed
+// by the null terminated arguments, with the child's stdin, its stdout and
+// a status socket attached.  A helper forked from the launcher spawns the
+// command, writes its pid to the status socket, waits for a byte back so
+// the pid stays valid until the host has a pidfd for it, then writes its
+// exit status.  Until the command exits, SIMPLE_EXEC_LAUNCHER_KILL on the
+// status socket has the helper kill it; the helper has not reaped it, so
+// the pid cannot name anything else yet.
+#define SIMPLE_EXEC_LAUNCHER_MAX_REQUEST (64 * 1024)
+#define SIMPLE_EXEC_LAUNCHER_MAX_ARGS 256
+#define SIMPLE_EXEC_LAUNCHER_FDS 3
+#define SIMPLE_EXEC_LAUNCHER_KILL 'k'
+
+static int g_launcherFd = -1;
+static pid_t g_launcherPid = -1;
+
+static int makeSocketPair(int type, int fds[2])
+{
+#ifdef SOCK_CLOEXEC
+    return socketpair(AF_UNIX, type | SOCK_CLOEXEC, 0, fds);
+#else
+    if(socketpair(AF_UNIX, type, 0, fds) != 0)
+        return -1;
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    return 0;
+#endif
+}
+
+// returns non-zero if all of size was read
+static int readAll(int fd, void* data, size_t size)
+{
+    size_t done = 0;
+    while(done < size)
+    {
+        ssize_t bytesRead = read(fd, (char*)data + done, size - done);
+        if(bytesRead == -1 && errno == EINTR)
+            continue;
+        if(bytesRead <= 0)
+            return 0;
+        done += (size_t)bytesRead;
+    }
+    return 1;
+}
+
+static void sendAll(int fd, const void* data, size_t size)
+{
+    while(send(fd, data, size, MSG_NOSIGNAL) == -1 && errno == EINTR);
+}
+
+// write end of the pipe that SIGCHLD wakes a helper through
+static int g_helperWakeFd = -1;
+
+static void helperOnChildExit(int sig)
+{
+    (void)sig;
+    int savedErrno = errno;
+    char wake = 0;
+    ssize_t unused = write(g_helperWakeFd, &wake, 1);
+    (void)unused;
+    errno = savedErrno;
+}
+
+// Waits for the helper's command to exit while serving kill requests from
+// the host on hostFd.  Returns the waitpid result.
+static pid_t helperWait(pid_t pid, int hostFd, int wakeFd, int* status)
+{
+    pid_t result;
+    while(1)
+    {
+        while((result = waitpid(pid, status, WNOHANG)) == -1 && errno == EINTR);
+        if(result != 0)
+            return result;
+
+        struct pollfd pfds[2];
+        pfds[0].fd = hostFd;
+        pfds[0].events = POLLIN;
+        pfds[0].revents = 0;
+        pfds[1].fd = wakeFd;
+        pfds[1].events = POLLIN;
+        pfds[1].revents = 0;
+        if(poll(pfds, 2, -1) == -1 && errno != EINTR)
             break;
+
+        if(pfds[0].revents)
+        {
+            char request;
+            ssize_t got = recv(hostFd, &request, 1, 0);
+            if(got == 1 && request == SIMPLE_EXEC_LAUNCHER_KILL)
+                kill(pid, SIGKILL);
+            else if(got == 0 || (got == -1 && errno != EINTR))
+                hostFd = -1; // the host has gone, poll ignores -1
         }
 
-        case 0: // child
+        if(pfds[1].revents)
         {
-            release_assert(dup2(parentToChild[READ_FD ], STDIN_FILENO ) != -1);
-            release_assert(dup2(childToParent[WRITE_FD], STDOUT_FILENO) != -1);
-            
-            if(includeStdErr)
-            {
-                release_assert(dup2(childToParent[WRITE_FD], STDERR_FILENO) != -1);
-            }
-            else
-            {
-                int devNull = open("/dev/null", O_WRONLY);
-                release_assert(dup2(devNull, STDERR_FILENO) != -1);
-            }
+            char drain[64];
+            while(read(wakeFd, drain, sizeof(drain)) > 0);
+        }
+    }
+
+    while((result = waitpid(pid, status, 0)) == -1 && errno == EINTR);
+    return result;
+}
+
+// Runs in a helper forked from the launcher for each command; never returns.
+static void launcherRunCommand(char* request, ssize_t size, int fds[SIMPLE_EXEC_LAUNCHER_FDS])
+{
+    char* allArgs[SIMPLE_EXEC_LAUNCHER_MAX_ARGS + 1];
+    int argCount = 0;
+
+    if(size > 1 && request[size - 1] == '\0')
+    {
+        char* arg = request + 1;
+        while(arg < request + size && argCount < SIMPLE_EXEC_LAUNCHER_MAX_ARGS)
+        {
+            allArgs[argCount++] = arg;
+            arg += strlen(arg) + 1;
+        }
+    }
+    allArgs[argCount] = NULL;
+
+    // installed before the spawn so that no exit goes unnoticed; the
+    // command gets the default disposition back when it execs
+    int wakeFds[2];
+    release_assert(makePipe(wakeFds) == 0);
+    fcntl(wakeFds[READ_FD], F_SETFL, O_NONBLOCK);
+    fcntl(wakeFds[WRITE_FD], F_SETFL, O_NONBLOCK);
+    g_helperWakeFd = wakeFds[WRITE_FD];
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = helperOnChildExit;
+    action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGCHLD, &action, NULL);
+
+    pid_t pid = argCount > 0 ? spawnChild(allArgs, request[0], fds[0], fds[1], NULL) : -1;
+    close(fds[0]);
+    close(fds[1]);
+
+    sendAll(fds[2], &pid, sizeof(pid));
+    if(pid == -1)
+        _exit(0);
+
+    char ack;
+    readAll(fds[2], &ack, 1);
+
+    int status = 0;
+    pid_t result = helperWait(pid, fds[2], wakeFds[READ_FD], &status);
+
+    int exitCode = -1;
+    if(result != -1)
+        exitCode = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    sendAll(fds[2], &exitCode, sizeof(exitCode));
+    _exit(0);
+}
+
+// Returns the size of the next request and fills fds, 0 once the host has
+// closed its end, or -1 for a malformed request, which is dropped.
+static ssize_t launcherReceive(int controlFd, char* request, size_t requestSize, int fds[SIMPLE_EXEC_LAUNCHER_FDS])
+{
+    union
+    {
+        struct cmsghdr header;
+        char buffer[CMSG_SPACE(sizeof(int) * SIMPLE_EXEC_LAUNCHER_FDS)];
+    } control;
+
+    struct iovec iov;
+    iov.iov_base = request;
+    iov.iov_len = requestSize;
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+
+    ssize_t size;
+    while((size = recvmsg(controlFd, &msg, 0)) == -1 && errno == EINTR);
+    if(size <= 0)
+        return 0;
+
+    int fdCount = 0;
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if(cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+    {
+        fdCount = (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+        memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * (fdCount < SIMPLE_EXEC_LAUNCHER_FDS ? fdCount : SIMPLE_EXEC_LAUNCHER_FDS));
+    }
+
+    if(fdCount != SIMPLE_EXEC_LAUNCHER_FDS || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)))
+    {
+        for(int i = 0; i < fdCount && i < SIMPLE_EXEC_LAUNCHER_FDS; i++)
+            close(fds[i]);
+        return -1;
+    }
+
+    for(int i = 0; i < SIMPLE_EXEC_LAUNCHER_FDS; i++)
+        fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+
+    return size;
+}
+
+static void launcherMain(int controlFd)
+{
+    // helpers are reaped by the kernel
+    signal(SIGCHLD, SIG_IGN);
 
-            // unused
-            release_assert(close(parentToChild[WRITE_FD]) == 0);
-            release_assert(close(childToParent[READ_FD ]) == 0);
-            release_assert(close(errPipe[READ_FD]) == 0);
-            
-            const char* command = allArgs[0];
-            execvp(command, allArgs);
-
-            char err = 1;
-            ssize_t result = write(errPipe[WRITE_FD], &err, 1);
-            release_assert(result != -1);
-            
-            close(errPipe[WRITE_FD]);
-            close(parentToChild[READ_FD]);
-            close(childToParent[WRITE_FD]);
-
-            exit(0);
+    static char request[SIMPLE_EXEC_LAUNCHER_MAX_REQUEST];
+    while(1)
+    {
+        int fds[SIMPLE_EXEC_LAUNCHER_FDS];
+        ssize_t size = launcherReceive(controlFd, request, sizeof(request), fds);
+        if(size == 0)
+            _exit(0);
+        if(size == -1)
+            continue;
+
+        pid_t helper = fork();
+        if(helper == 0)
+        {
+            signal(SIGCHLD, SIG_DFL);
+            close(controlFd);
+            launcherRunCommand(request, size, fds);
         }
 
+        if(helper == -1)
+        {
+            pid_t failed = -1;
+            sendAll(fds[2], &failed, sizeof(failed));
+        }
 
-        default: // parent
+        for(int i = 0; i < SIMPLE_EXEC_LAUNCHER_FDS; i++)
+            close(fds[i]);
+    }
+}
+
+int runCommandLauncherStart(void)
+{
+    if(g_launcherFd != -1)
+        return 0;
+
+    int fds[2];
+    if(makeSocketPair(SOCK_SEQPACKET, fds) != 0)
+        return -1;
+
+    pid_t pid = fork();
+    if(pid == -1)
+    {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+
+    if(pid == 0)
+    {
+        // keep only the control socket, so the launcher does not hold the
+        // host's pipes and sockets open
+        int controlFd = STDERR_FILENO + 1;
+        if(fds[1] != controlFd)
+            release_assert(dup2(fds[1], controlFd) == controlFd);
+
+        int devNull = open("/dev/null", O_RDWR);
+        if(devNull != -1)
         {
-            // unused
-            release_assert(close(parentToChild[READ_FD]) == 0);
-            release_assert(close(childToParent[WRITE_FD]) == 0);
-            release_assert(close(errPipe[WRITE_FD]) == 0);
+            dup2(devNull, STDIN_FILENO);
+            dup2(devNull, STDOUT_FILENO);
+        }
+        closeFdsFrom(controlFd + 1);
+
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigprocmask(SIG_SETMASK, &mask, NULL);
 
-            while(1)
+        launcherMain(controlFd);
+    }
+
+    close(fds[1]);
+    g_launcherFd = fds[0];
+    g_launcherPid = pid;
+    return 0;
+}
+
+void runCommandLauncherStop(void)
+{
+    if(g_launcherFd == -1)
+        return;
+
+    // the launcher exits when it reads the end of the control socket
+    close(g_launcherFd);
+    g_launcherFd = -1;
+
+    while(waitpid(g_launcherPid, NULL, 0) == -1 && errno == EINTR);
+    g_launcherPid = -1;
+}
+
+// Has the launcher spawn allArgs.  Returns -1 if the command could not be
+// run, or -2 if the launcher is not running or did not take the request,
+// in which case the caller spawns the command itself.
+static pid_t launcherSpawn(char* const* allArgs, int includeStdErr, int stdinFd, int stdoutFd, int* outPidFd, int* outStatusFd)
+{
+    if(g_launcherFd == -1)
+        return -2;
+
+    size_t size = 1;
+    int argCount = 0;
+    for(; allArgs[argCount] != NULL; argCount++)
+        size += strlen(allArgs[argCount]) + 1;
+
+    if(argCount > SIMPLE_EXEC_LAUNCHER_MAX_ARGS || size > SIMPLE_EXEC_LAUNCHER_MAX_REQUEST)
+        return -2;
+
+    int statusFds[2];
+    if(makeSocketPair(SOCK_STREAM, statusFds) != 0)
+        return -2;
+
+    char* request = (char*)SIMPLE_EXEC_MALLOC(size);
+    release_assert(request != NULL);
+    request[0] = (char)(includeStdErr != 0);
+    char* arg = request + 1;
+    for(int i = 0; i < argCount; i++)
+    {
+        size_t len = strlen(allArgs[i]) + 1;
+        memcpy(arg, allArgs[i], len);
+        arg += len;
+    }
+
+    union
+    {
+        struct cmsghdr header;
+        char buffer[CMSG_SPACE(sizeof(int) * SIMPLE_EXEC_LAUNCHER_FDS)];
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    struct iovec iov;
+    iov.iov_base = request;
+    iov.iov_len = size;
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+
+    int fds[SIMPLE_EXEC_LAUNCHER_FDS] = { stdinFd, stdoutFd, statusFds[1] };
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    ssize_t sent;
+    while((sent = sendmsg(g_launcherFd, &msg, MSG_NOSIGNAL)) == -1 && errno == EINTR);
+    SIMPLE_EXEC_FREE(request);
+    close(statusFds[1]);
+
+    pid_t pid;
+    if(sent == -1 || !readAll(statusFds[0], &pid, sizeof(pid)))
+    {
+        // the launcher has died
+        close(statusFds[0]);
+        return -2;
+    }
+
+    if(pid == -1)
+    {
+        close(statusFds[0]);
+        return -1;
+    }
+
+    *outPidFd = openPidFd(pid);
+    char ack = 0;
+    sendAll(statusFds[0], &ack, 1);
+
+    *outStatusFd = statusFds[0];
+    return pid;
+}
+
+int runCommandStart(runCommandProcess* process, int includeStdErr, int nonBlocking, char* const* allArgs)
+{
+    // adapted from: https://stackoverflow.com/a/479103
+
+    SIMPLE_EXEC_PROBE1(spawn, allArgs[0]);
+
+    int parentToChild[2];
+    release_assert(makePipe(parentToChild) == 0);
+
+    int childToParent[2];
+    release_assert(makePipe(childToParent) == 0);
+
+#ifdef F_SETPIPE_SZ
+    // best effort, the default 64k pipe fills after a few hundred paths
+    fcntl(childToParent[READ_FD], F_SETPIPE_SZ, SIMPLE_EXEC_PIPE_SIZE);
+#endif
+
+    int pidFd = -1;
+    int statusFd = -1;
+    pid_t pid = launcherSpawn(allArgs, includeStdErr, parentToChild[READ_FD], childToParent[WRITE_FD], &pidFd, &statusFd);
+    if(pid == -2)
+    {
+        pid = spawnChild(allArgs, includeStdErr, parentToChild[READ_FD], childToParent[WRITE_FD], &pidFd);
+    }
+
+    // unused
+    release_assert(close(parentToChild[READ_FD]) == 0);
+    release_assert(close(childToParent[WRITE_FD]) == 0);
+
+    if(pid == -1)
+    {
+        release_assert(close(parentToChild[WRITE_FD]) == 0);
+        release_assert(close(childToParent[READ_FD]) == 0);
+        return COMMAND_NOT_FOUND;
+    }
+
+    SIMPLE_EXEC_PROBE2(start, allArgs[0], (int)pid);
+
+    if(nonBlocking)
+        release_assert(fcntl(childToParent[READ_FD], F_SETFL, O_NONBLOCK) == 0);
+
+    process->pid = pid;
+    process->pidFd = pidFd;
+    process->statusFd = statusFd;
+    process->stdinFd = parentToChild[WRITE_FD];
+    process->stdoutFd = childToParent[READ_FD];
+    process->bufferSize = SIMPLE_EXEC_READ_SIZE;
+    process->buffer = (char*)SIMPLE_EXEC_MALLOC(process->bufferSize);
+    release_assert(process->buffer != NULL);
+
+    return COMMAND_RAN_OK;
+}
+
+// Returns 1 after passing a chunk of output to onOutput, 0 at end of output,
+// and -1 if the child is non-blocking and has no output ready.
+int runCommandRead(runCommandProcess* process, runCommandOutputCallback onOutput, void* userData)
+{
+    while(1)
+    {
+        ssize_t bytesRead = read(process->stdoutFd, process->buffer, process->bufferSize);
+        switch(bytesRead)
+        {
+            case 0: // End-of-File
+                SIMPLE_EXEC_PROBE1(eof, (int)process->pid);
+                return 0;
+
+            case -1:
+            {
+                if(errno == EAGAIN || errno == EWOULDBLOCK)
+                    return -1;
+                release_assert(errno == EINTR && "read() failed");
+                break;
+            }
+
+            default:
             {
-                ssize_t bytesRead = 0;
-                switch(bytesRead = read(childToParent[READ_FD], buffer, bufferSize))
-                {
-                    case 0: // End-of-File, or non-blocking read.
-                    {
-                        int status = 0;
-                        release_assert(waitpid(pid, &status, 0) == pid);
-
-                        // done with these now
-                        release_assert(close(parentToChild[WRITE_FD]) == 0);
-                        release_assert(close(childToParent[READ_FD]) == 0);
-
-                        char errChar = 0;
-                        ssize_t result = read(errPipe[READ_FD], &errChar, 1);
-                        release_assert(result != -1);
-                        close(errPipe[READ_FD]);
-
-                        if(errChar)
-                        {
-                            free(dataReadFromChild); 
-                            return COMMAND_NOT_FOUND;
-                        }
-                        
-                        // free any un-needed memory with realloc + add a null terminator for convenience
-                        dataReadFromChild = (char*)realloc(dataReadFromChild, dataReadFromChildUsed + 1);
-                        dataReadFromChild[dataReadFromChildUsed] = '\0';
-                        
-                        if(stdOut != NULL)
-                            *stdOut = dataReadFromChild;
-                        else
-                            free(dataReadFromChild);
-
-                        if(stdOutByteCount != NULL)
-                            *stdOutByteCount = dataReadFromChildUsed;
-                        if(returnCode != NULL)
-                            *returnCode = WEXITSTATUS(status);
-
-                        return COMMAND_RAN_OK;
-                    }
-                    case -1:
-                    {
-                        release_assert(0 && "read() failed");
-                        break;
-                    }
-
-                    default:
-                    {
-                        if(dataReadFromChildUsed + bytesRead + 1 >= dataReadFromChildSize)
-                        {
-                            dataReadFromChildSize += dataReadFromChildDefaultSize;
-                            dataReadFromChild = (char*)realloc(dataReadFromChild, dataReadFromChildSize);
-                        }
-
-                        memcpy(dataReadFromChild + dataReadFromChildUsed, buffer, bytesRead);
-                        dataReadFromChildUsed += bytesRead;
-                        break;
-                    }
-                }
+                onOutput(process->buffer, (int)bytesRead, userData);
+                return 1;
             }
         }
     }
 }
 
+// Reaps the child and returns its exit status, 128 + the signal number if it
+// was killed, or -1 if some other part of the host already reaped it.
+static int reapChild(runCommandProcess* process)
+{
+    if(process->statusFd != -1)
+    {
+        // the launcher reaps the child and reports how it exited
+        int exitCode;
+        return readAll(process->statusFd, &exitCode, sizeof(exitCode)) ? exitCode : -1;
+    }
+
+#ifdef __linux__
+    if(process->pidFd != -1)
+    {
+        // waits on exactly our child, even if its pid has been reused
+        siginfo_t info;
+        memset(&info, 0, sizeof(info));
+
+        int result;
+        while((result = waitid((idtype_t)SIMPLE_EXEC_P_PIDFD, process->pidFd, &info, WEXITED)) == -1 && errno == EINTR);
+        if(result != -1)
+            return info.si_code == CLD_EXITED ? info.si_status : 128 + info.si_status;
+
+        if(errno != EINVAL)
+        {
+            release_assert(errno == ECHILD);
+            return -1;
+        }
+
+        // Linux 5.3 has pidfd_open but waitid() cannot wait on a pidfd,
+        // so wait on the pid instead
+        close(process->pidFd);
+        process->pidFd = -1;
+    }
+#endif
+
+    int status = 0;
+    pid_t result;
+    while((result = waitpid(process->pid, &status, 0)) == -1 && errno == EINTR);
+    if(result == -1)
+    {
+        release_assert(errno == ECHILD);
+        return -1;
+    }
+
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+int runCommandHasExited(runCommandProcess* process)
+{
+    int fd = process->pidFd != -1 ? process->pidFd : process->statusFd;
+    if(fd == -1)
+        return 0;
+
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    return poll(&pfd, 1, 0) == 1;
+}
+
+int runCommandFinish(runCommandProcess* process, int* returnCode)
+{
+    int exitCode = reapChild(process);
+    SIMPLE_EXEC_PROBE2(wait, (int)process->pid, exitCode);
+
+    // done with these now
+    release_assert(close(process->stdinFd) == 0);
+    release_assert(close(process->stdoutFd) == 0);
+    if(process->pidFd != -1)
+        close(process->pidFd);
+    if(process->statusFd != -1)
+        close(process->statusFd);
+    SIMPLE_EXEC_FREE(process->buffer);
+    process->buffer = NULL;
+
+    if(exitCode == SIMPLE_EXEC_EXEC_FAILED)
+        return COMMAND_NOT_FOUND;
+
+    if(returnCode != NULL)
+        *returnCode = exitCode;
+
+    return COMMAND_RAN_OK;
+}
+
+void runCommandKill(runCommandProcess* process)
+{
+#ifdef __linux__
+    if(process->pidFd != -1)
+    {
+        // fails with ESRCH once the child has been reaped, and the pid,
+        // which may belong to another process by then, is left alone
+        syscall(SYS_pidfd_send_signal, process->pidFd, SIGKILL, NULL, 0);
+        return;
+    }
+#endif
+
+    if(process->statusFd != -1)
+    {
+        // the launcher helper reaps the child, so only it knows whether
+        // the pid is still the child's
+        char request = SIMPLE_EXEC_LAUNCHER_KILL;
+        sendAll(process->statusFd, &request, 1);
+        return;
+    }
+
+    // not reaped until runCommandFinish, so the pid is still the child's
+    kill(process->pid, SIGKILL);
+}
+
+int runCommandArrayStream(runCommandOutputCallback onOutput, void* userData, int* returnCode, int includeStdErr, char* const* allArgs)
+{
+    runCommandProcess process;
+    int retval = runCommandStart(&process, includeStdErr, 0, allArgs);
+    if(retval != COMMAND_RAN_OK)
+        return retval;
+
+    while(runCommandRead(&process, onOutput, userData) != 0);
+
+    return runCommandFinish(&process, returnCode);
+}
+
+typedef struct
+{
+    char* data;
+    size_t size;
+    size_t used;
+} runCommandCapture;
+
+static void runCommandCaptureOutput(const char* data, int byteCount, void* userData)
+{
+    runCommandCapture* capture = (runCommandCapture*)userData;
+
+    // grow geometrically so large outputs are copied a constant number of times
+    if(capture->used + byteCount + 1 > capture->size)
+    {
+        size_t oldSize = capture->size;
+        while(capture->used + byteCount + 1 > capture->size)
+            capture->size *= 2;
+        capture->data = (char*)SIMPLE_EXEC_REALLOC(capture->data, oldSize, capture->size);
+        release_assert(capture->data != NULL);
+    }
+
+    memcpy(capture->data + capture->used, data, byteCount);
+    capture->used += byteCount;
+}
+
+int runCommandArray(char** stdOut, int* stdOutByteCount, int* returnCode, int includeStdErr, char* const* allArgs)
+{
+    runCommandCapture capture;
+    capture.size = 4096;
+    capture.used = 0;
+    capture.data = (char*)SIMPLE_EXEC_MALLOC(capture.size);
+    release_assert(capture.data != NULL);
+
+    int retval = runCommandArrayStream(runCommandCaptureOutput, &capture, returnCode, includeStdErr, allArgs);
+    if(retval != COMMAND_RAN_OK)
+    {
+        SIMPLE_EXEC_FREE(capture.data);
+        return retval;
+    }
+
+    // there is always room for a null terminator; the slack is handed over as-is
+    // rather than paying for a shrinking realloc
+    capture.data[capture.used] = '\0';
+
+    if(stdOut != NULL)
+        *stdOut = capture.data;
+    else
+        SIMPLE_EXEC_FREE(capture.data);
+
+    if(stdOutByteCount != NULL)
+        *stdOutByteCount = (int)capture.used;
+
+    return COMMAND_RAN_OK;
+}
+
 int runCommand(char** stdOut, int* stdOutByteCount, int* returnCode, int includeStdErr, char* command, ...)
 {
     va_list vl;
@@ -189,7 +958,7 @@ int runCommand(char** stdOut, int* stdOutByteCount, int* returnCode, int include
       
     int allArgsInitialSize = 16;
     int allArgsSize = allArgsInitialSize;
-    char** allArgs = (char**)malloc(sizeof(char*) * allArgsSize);
+    char** allArgs = (char**)SIMPLE_EXEC_MALLOC(sizeof(char*) * allArgsSize);
     allArgs[0] = command;
         
     int i = 1;
@@ -203,7 +972,7 @@ int runCommand(char** stdOut, int* stdOutByteCount, int* returnCode, int include
         if(i >= allArgsSize)
         {
             allArgsSize += allArgsInitialSize;
-            allArgs = (char**)realloc(allArgs, sizeof(char*) * allArgsSize);
+            allArgs = (char**)SIMPLE_EXEC_REALLOC(allArgs, sizeof(char*) * (allArgsSize - allArgsInitialSize), sizeof(char*) * allArgsSize);
         }
 
     } while(currArg != NULL);
@@ -211,7 +980,7 @@ int runCommand(char** stdOut, int* stdOutByteCount, int* returnCode, int include
     va_end(vl);
 
     int retval = runCommandArray(stdOut, stdOutByteCount, returnCode, includeStdErr, allArgs);
-    free(allArgs);
+    SIMPLE_EXEC_FREE(allArgs);
     return retval;
 }
 
@@ -0,0 +1,252 @@
+#include "nfd.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/wait.h>
+
+/* Checks that dialogs which are cancelled from a second thread, time
+   out, or are cancelled while zenity answers all return in time and
+   leave no zombie behind, once spawning zenity directly and once
+   through the launcher NFD_Init starts.  fake_zenity stands in for
+   zenity, and keeps the dialog open for a default folder named wait.
+
+   Needs fake_zenity, built as build/bin/fake_zenity/zenity.  Zenity
+   backend only.  POSIX only. */
+
+#define CANCEL_AFTER_MS 50
+#define TIMEOUT_MS      100
+#define BOUND_MS        1000    /* a cancelled dialog returns within this */
+#define RACES           200     /* cancels racing zenity's answer */
+#define WAIT_FOLDER     "/nfd-bench/wait/"
+#define ANSWER_FOLDER   "/nfd-bench/1/"
+
+static double Now( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void Fail( const char *mode, const char *what )
+{
+    printf( "FAIL: %s, %s (%s)\n", mode, what, NFD_GetError() );
+    exit(1);
+}
+
+/* zenity is reaped by nfd, and the launcher's helpers by the kernel, so
+   there is never an exited child left for the host */
+static void CheckNoZombie( const char *mode, const char *what )
+{
+    int status;
+    pid_t pid;
+
+    while ( (pid = waitpid( -1, &status, WNOHANG )) == -1 && errno == EINTR )
+        ;
+    if ( pid > 0 )
+    {
+        printf( "FAIL: %s, %s left child %d unreaped\n", mode, what, (int)pid );
+        exit(1);
+    }
+}
+
+typedef struct {
+    nfdhandle_t *handle;
+    int delayMs;
+} Canceller;
+
+static void *CancelLater( void *userData )
+{
+    Canceller *canceller = (Canceller*)userData;
+
+    if ( canceller->delayMs > 0 )
+        usleep( canceller->delayMs * 1000 );
+    NFD_Cancel( canceller->handle );
+    return NULL;
+}
+
+/* returns how long after NFD_Cancel the dialog returned, in ms */
+static double CheckCancel( const char *mode )
+{
+    Canceller canceller;
+    nfdchar_t *outPath = NULL;
+    pthread_t thread;
+    nfdresult_t result;
+    double start, elapsedMs;
+
+    if ( NFD_OpenDialogAsync( NULL, WAIT_FOLDER, &canceller.handle ) != NFD_OKAY )
+        Fail( mode, "opening a dialog to cancel" );
+    canceller.delayMs = CANCEL_AFTER_MS;
+
+    start = Now();
+    pthread_create( &thread, NULL, CancelLater, &canceller );
+    result = NFD_Handle_Finish( canceller.handle, &outPath );
+    elapsedMs = (Now() - start) * 1e3 - CANCEL_AFTER_MS;
+    pthread_join( thread, NULL );
+
+    if ( result != NFD_CANCEL )
+        Fail( mode, "a dialog cancelled from another thread did not return NFD_CANCEL" );
+    if ( elapsedMs > BOUND_MS )
+        Fail( mode, "a dialog cancelled from another thread returned late" );
+    CheckNoZombie( mode, "a cancelled dialog" );
+
+    return elapsedMs;
+}
+
+/* returns how long after its timeout the dialog returned, in ms */
+static double CheckTimeout( const char *mode )
+{
+    nfdchar_t *outPath = NULL;
+    nfdresult_t result;
+    double start, elapsedMs;
+
+    NFD_SetTimeout( TIMEOUT_MS );
+    start = Now();
+    result = NFD_PickFolder( WAIT_FOLDER, &outPath );
+    elapsedMs = (Now() - start) * 1e3 - TIMEOUT_MS;
+    NFD_SetTimeout( 0 );
+
+    if ( result != NFD_CANCEL )
+        Fail( mode, "a dialog that timed out did not return NFD_CANCEL" );
+    if ( elapsedMs < 0 || elapsedMs > BOUND_MS )
+        Fail( mode, "a dialog did not time out on time" );
+    CheckNoZombie( mode, "a dialog that timed out" );
+
+    return elapsedMs;
+}
+
+static void WaitClosed( nfdhandle_t *handle )
+{
+    while ( !NFD_Handle_Poll( handle ) )
+    {
+        struct pollfd pfd;
+        pfd.fd = NFD_Handle_GetFd( handle );
+        pfd.events = POLLIN;
+        poll( &pfd, 1, -1 );
+    }
+}
+
+/* a dialog that has already answered ignores NFD_Cancel */
+static void CheckCancelAfterAnswer( const char *mode )
+{
+    nfdhandle_t *handle;
+    nfdchar_t *outPath = NULL;
+
+    if ( NFD_OpenDialogAsync( NULL, ANSWER_FOLDER, &handle ) != NFD_OKAY )
+        Fail( mode, "opening a dialog" );
+
+    WaitClosed( handle );
+    NFD_Cancel( handle );
+    if ( NFD_Handle_Finish( handle, &outPath ) != NFD_OKAY )
+        Fail( mode, "NFD_Cancel after the answer discarded it" );
+    free( outPath );
+    CheckNoZombie( mode, "a dialog cancelled after its answer" );
+}
+
+/* cancels at once while zenity answers at once; either may win */
+static void CheckRaces( const char *mode, int *outOkay, int *outCancelled )
+{
+    int race;
+
+    *outOkay = 0;
+    *outCancelled = 0;
+
+    for ( race = 0; race < RACES; ++race )
+    {
+        Canceller canceller;
+        nfdchar_t *outPath = NULL;
+        pthread_t thread;
+        nfdresult_t result;
+
+        if ( NFD_OpenDialogAsync( NULL, ANSWER_FOLDER, &canceller.handle ) != NFD_OKAY )
+            Fail( mode, "opening a dialog to race" );
+        canceller.delayMs = 0;
+
+        /* NFD_Cancel must not outlive the handle, so join before
+           NFD_Handle_Finish frees it */
+        pthread_create( &thread, NULL, CancelLater, &canceller );
+        WaitClosed( canceller.handle );
+        pthread_join( thread, NULL );
+        result = NFD_Handle_Finish( canceller.handle, &outPath );
+
+        if ( result == NFD_OKAY )
+        {
+            ++*outOkay;
+            free( outPath );
+        }
+        else if ( result == NFD_CANCEL )
+            ++*outCancelled;
+        else
+            Fail( mode, "a cancel racing the answer" );
+    }
+
+    CheckNoZombie( mode, "cancels racing the answer" );
+}
+
+/* build/bin, where this program and fake_zenity are built */
+static void GetBinDir( char *dir, size_t size )
+{
+    ssize_t len = readlink( "/proc/self/exe", dir, size - 1 );
+    char *slash;
+
+    if ( len <= 0 )
+    {
+        snprintf( dir, size, "." );
+        return;
+    }
+    dir[len] = '\0';
+    slash = strrchr( dir, '/' );
+    if ( slash )
+        *slash = '\0';
+}
+
+int main( void )
+{
+    const char *modes[] = { "direct", "launcher" };
+    char binDir[4096], fakeDir[4200], *pathEnv;
+    int mode;
+
+    /* before the launcher starts, which keeps the environment it saw */
+    GetBinDir( binDir, sizeof(binDir) );
+    snprintf( fakeDir, sizeof(fakeDir), "%s/fake_zenity", binDir );
+    pathEnv = malloc( strlen(fakeDir) + strlen( getenv("PATH") ? getenv("PATH") : "" ) + 2 );
+    sprintf( pathEnv, "%s:%s", fakeDir, getenv("PATH") ? getenv("PATH") : "" );
+    setenv( "PATH", pathEnv, 1 );
+    free( pathEnv );
+    snprintf( fakeDir + strlen(fakeDir), sizeof(fakeDir) - strlen(fakeDir), "/zenity" );
+    if ( access( fakeDir, X_OK ) != 0 )
+    {
+        printf( "Error: %s is missing; build fake_zenity.\n", fakeDir );
+        return 1;
+    }
+
+    puts("mode        cancel ms   timeout ms   races answered / cancelled");
+    for ( mode = 0; mode < 2; ++mode )
+    {
+        double cancelMs, timeoutMs;
+        int okay, cancelled;
+
+        if ( mode == 1 && NFD_Init() != NFD_OKAY )
+            Fail( modes[mode], "NFD_Init" );
+
+        cancelMs = CheckCancel( modes[mode] );
+        timeoutMs = CheckTimeout( modes[mode] );
+        CheckCancelAfterAnswer( modes[mode] );
+        CheckRaces( modes[mode], &okay, &cancelled );
+
+        if ( mode == 1 )
+            NFD_Quit();
+        CheckNoZombie( modes[mode], "NFD_Quit" );
+
+        printf( "%-9s %11.3f %12.3f   %8d / %d\n", modes[mode], cancelMs, timeoutMs,
+                okay, cancelled );
+    }
+
+    puts("OK: cancelled dialogs returned in time and left no zombies");
+    return 0;
+}
@@ -0,0 +1,88 @@
+#define SIMPLE_EXEC_IMPLEMENTATION
+#include "../src/simple_exec.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Measures how fast runCommandArray captures the stdout of a child
+   that prints megabytes of paths.  The child is this program, re-run
+   with --child <count>.  POSIX only. */
+
+static double Now( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static int RunChild( size_t count )
+{
+    /* format everything up front so the child writes as fast as the
+       pipe allows */
+    size_t size = count * 48 + 2;
+    char *out = malloc( size );
+    size_t len = 0;
+    size_t i;
+
+    for ( i = 0; i < count; ++i )
+    {
+        len += (size_t)snprintf( out + len, size - len, "%s/home/user/assets/file_%07u.png",
+                                 i ? "|" : "", (unsigned)i );
+    }
+    out[len++] = '\n';
+
+    fwrite( out, 1, len, stdout );
+    free( out );
+    return 0;
+}
+
+int main( int argc, char **argv )
+{
+    const size_t counts[] = { 1000, 30000, 300000, 1000000 };
+    size_t i;
+
+    if ( argc == 3 && strcmp( argv[1], "--child" ) == 0 )
+        return RunChild( (size_t)strtoul( argv[2], NULL, 10 ) );
+
+    puts("    paths        MB     best ms     MB/s");
+    for ( i = 0; i < sizeof(counts) / sizeof(counts[0]); ++i )
+    {
+        char countStr[32];
+        char *args[4];
+        double best = 1e9;
+        int byteCount = 0;
+        int run;
+
+        snprintf( countStr, sizeof(countStr), "%u", (unsigned)counts[i] );
+        args[0] = argv[0];
+        args[1] = "--child";
+        args[2] = countStr;
+        args[3] = NULL;
+
+        for ( run = 0; run < 5; ++run )
+        {
+            char *stdOut = NULL;
+            int exitCode = 0;
+            double start = Now();
+            double elapsed;
+
+            if ( runCommandArray( &stdOut, &byteCount, &exitCode, 0, args ) != COMMAND_RAN_OK || exitCode != 0 )
+            {
+                puts("Error: could not run the child.");
+                return 1;
+            }
+            elapsed = Now() - start;
+            free( stdOut );
+
+            if ( elapsed < best )
+                best = elapsed;
+        }
+
+        printf( "%9u  %8.2f  %10.3f  %7.1f\n", (unsigned)counts[i],
+                byteCount / 1e6, best * 1e3, byteCount / 1e6 / best );
+    }
+
+    return 0;
+}
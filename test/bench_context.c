@@ -0,0 +1,241 @@
+#include "nfd.h"
+#include "../src/nfd_common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+/* Runs the work a dialog does around the platform call -- compiling
+   the filter, splitting the returned paths, matching them and
+   reporting errors -- on several threads at once.  Each thread has its
+   own context with its own counting allocator, except one that uses
+   the thread's fallback error.  Checks that no thread sees another's
+   error or allocates through another's allocator, then compares the
+   threads running at once against the same threads serialized behind
+   one lock, as callers had to before contexts, and that the shared
+   NFD_GetStats totals lost no allocation to the threads racing.  POSIX
+   only. */
+
+#define THREADS     8
+#define ITERATIONS  2000
+#define PATHS       64
+
+static const char FILTER_LIST[] = "(?i)png,jpg,jpeg,gif;obj,fbx,gltf;wav,ogg;Makefile*,*.[ch]";
+
+typedef struct {
+    int index;
+    int useContext;
+    unsigned long allocs;
+    unsigned long frees;
+    unsigned long wrongFrees;
+    unsigned long errorMismatches;
+} Worker;
+
+static pthread_mutex_t serializeLock = PTHREAD_MUTEX_INITIALIZER;
+static int serialize = 0;
+static unsigned long defaultAllocs = 0;
+
+static double Now( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/* each block records the worker that allocated it */
+static void *CountingAlloc( size_t bytes, void *userData )
+{
+    Worker *worker = (Worker*)userData;
+    void **block = malloc( bytes + sizeof(void*) * 2 );
+
+    if ( !block )
+        return NULL;
+    ++worker->allocs;
+    block[0] = worker;
+    return block + 2;
+}
+
+static void CountingFree( void *ptr, void *userData )
+{
+    Worker *worker = (Worker*)userData;
+    void **block = (void**)ptr - 2;
+
+    if ( block[0] != worker )
+        ++worker->wrongFrees;
+    ++worker->frees;
+    free( block );
+}
+
+/* the process-wide allocator, used by the worker without a context
+   and for allocating the contexts themselves */
+static void *DefaultAlloc( size_t bytes, void *userData )
+{
+    (void)userData;
+    __sync_fetch_and_add( &defaultAllocs, 1 );
+    return malloc( bytes );
+}
+
+static void DefaultFree( void *ptr, void *userData )
+{
+    (void)userData;
+    free( ptr );
+}
+
+static void RunIteration( Worker *worker, int iteration )
+{
+    char message[64], paths[PATHS * 40];
+    unsigned char mask[PATHS];
+    nfdpathparser_t parser;
+    nfdpathset_t pathSet;
+    nfdfilter_t *filter;
+    size_t len = 0;
+    int i;
+
+    for ( i = 0; i < PATHS; ++i )
+    {
+        len += (size_t)snprintf( paths + len, sizeof(paths) - len, "%s/work/%d/file%d.%s",
+                                 i ? "|" : "", worker->index, i, i % 2 ? "PNG" : "txt" );
+    }
+
+    NFDi_PathParser_Init( &parser, '|' );
+    NFDi_PathParser_Feed( &parser, paths, len );
+    if ( NFDi_PathParser_Finish( &parser, &pathSet ) != NFD_OKAY ||
+         NFD_Filter_Compile( FILTER_LIST, &filter ) != NFD_OKAY ||
+         NFD_Filter_MatchPathSet( filter, &pathSet, mask ) != NFD_OKAY )
+    {
+        printf("Error: %s\n", NFD_GetError() );
+        exit(1);
+    }
+    NFD_Filter_Free( filter );
+    NFD_PathSet_Free( &pathSet );
+
+    snprintf( message, sizeof(message), "worker %d iteration %d", worker->index, iteration );
+    NFDi_SetErrorCode( (nfderror_t)(1 + iteration % 5), message );
+    if ( strcmp( NFD_GetError(), message ) != 0 ||
+         NFD_GetErrorCode() != (nfderror_t)(1 + iteration % 5) )
+        ++worker->errorMismatches;
+}
+
+static void *RunWorker( void *userData )
+{
+    Worker *worker = (Worker*)userData;
+    nfdcontext_t *context = NULL;
+    int iteration;
+
+    if ( worker->useContext )
+    {
+        if ( NFD_Context_Create( &context ) != NFD_OKAY )
+        {
+            printf("Error: %s\n", NFD_GetError() );
+            exit(1);
+        }
+        NFD_Context_SetAllocator( context, CountingAlloc, CountingFree, worker );
+        NFD_SetThreadContext( context );
+    }
+
+    for ( iteration = 0; iteration < ITERATIONS; ++iteration )
+    {
+        if ( serialize )
+            pthread_mutex_lock( &serializeLock );
+        RunIteration( worker, iteration );
+        if ( serialize )
+            pthread_mutex_unlock( &serializeLock );
+    }
+
+    if ( context )
+    {
+        NFD_SetThreadContext( NULL );
+        NFD_Context_Free( context );
+    }
+
+    return NULL;
+}
+
+static double RunWorkers( Worker *workers )
+{
+    pthread_t threads[THREADS];
+    double start = Now();
+    int i;
+
+    memset( workers, 0, sizeof(Worker) * THREADS );
+    for ( i = 0; i < THREADS; ++i )
+    {
+        workers[i].index = i;
+        workers[i].useContext = i != 0;
+        pthread_create( &threads[i], NULL, RunWorker, &workers[i] );
+    }
+    for ( i = 0; i < THREADS; ++i )
+        pthread_join( threads[i], NULL );
+
+    return Now() - start;
+}
+
+int main( void )
+{
+    Worker workers[THREADS];
+    double concurrent, serialized;
+    unsigned long contextAllocs, defaultAllocsBefore;
+    nfdstats_t statsBefore, statsAfter;
+    int i;
+
+    /* the main thread's fallback error must survive the workers */
+    NFDi_SetErrorCode( NFD_ERR_USAGE, "main thread" );
+    NFD_SetAllocator( DefaultAlloc, DefaultFree, NULL );
+
+    serialize = 1;
+    serialized = RunWorkers( workers );
+    serialize = 0;
+    defaultAllocsBefore = defaultAllocs;
+    NFD_GetStats( &statsBefore );
+    concurrent = RunWorkers( workers );
+    NFD_GetStats( &statsAfter );
+
+    NFD_SetAllocator( NULL, NULL, NULL );
+
+    contextAllocs = 0;
+    for ( i = 0; i < THREADS; ++i )
+    {
+        Worker *worker = &workers[i];
+
+        if ( worker->errorMismatches > 0 )
+        {
+            printf("FAIL: worker %d saw another thread's error %lu times\n",
+                   i, worker->errorMismatches );
+            return 1;
+        }
+        if ( worker->useContext &&
+             (worker->allocs == 0 || worker->allocs != worker->frees || worker->wrongFrees > 0) )
+        {
+            printf("FAIL: worker %d allocated %lu, freed %lu, %lu of them another's\n",
+                   i, worker->allocs, worker->frees, worker->wrongFrees );
+            return 1;
+        }
+        contextAllocs += worker->allocs;
+    }
+
+    /* contexts are allocated directly, not through NFDi_Malloc */
+    if ( statsAfter.total.allocs - statsBefore.total.allocs !=
+         contextAllocs + (defaultAllocs - defaultAllocsBefore) - (THREADS - 1) )
+    {
+        printf("FAIL: NFD_GetStats counted %llu allocations, the allocators %lu\n",
+               (unsigned long long)(statsAfter.total.allocs - statsBefore.total.allocs),
+               contextAllocs + (defaultAllocs - defaultAllocsBefore) - (THREADS - 1) );
+        return 1;
+    }
+
+    if ( strcmp( NFD_GetError(), "main thread" ) != 0 || NFD_GetErrorCode() != NFD_ERR_USAGE )
+    {
+        puts("FAIL: a worker overwrote the main thread's error");
+        return 1;
+    }
+
+    printf( "%d threads x %d iterations, %lu allocations through contexts, %lu through the default\n",
+            THREADS, ITERATIONS, contextAllocs, defaultAllocs );
+    printf( "serialized behind a lock: %8.3f ms\n", serialized * 1e3 );
+    printf( "concurrent contexts:      %8.3f ms\n", concurrent * 1e3 );
+
+    puts("OK: errors and allocations stay with their thread's context, and every allocation is counted");
+    return 0;
+}
@@ -0,0 +1,204 @@
+#include "nfd.h"
+#include "../src/nfd_common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Fuzzes NFD_Filter_Compile against a simple reference split of random
+   filter lists, then measures compile throughput for lists of up to
+   a hundred thousand extensions and checks that it scales linearly.
+   An optional argument seeds the fuzzer.  POSIX only. */
+
+#define FUZZ_RUNS     100000
+#define FUZZ_MAX_LEN  512
+/* a quadratic parser would be 10x slower per extension from one size
+   to the next; allow for the larger lists falling out of cache */
+#define MAX_RATIO     3.0
+
+static unsigned int firstSeed = 1;
+static unsigned int seed = 1;
+
+static unsigned int Random( void )
+{
+    /* xorshift32, so a failing seed reproduces everywhere */
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+static double Now( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void RandomFilterList( char *buf, size_t len )
+{
+    /* mostly separators and short extensions, with some UTF-8 */
+    static const char alphabet[] = ",,;;;abcxyz.*\xc3\xa9";
+    size_t i;
+
+    for ( i = 0; i < len; ++i )
+        buf[i] = alphabet[Random() % (sizeof(alphabet) - 1)];
+    buf[len] = '\0';
+}
+
+static void Fail( const char *filterList, const char *what )
+{
+    printf("FAIL: %s for \"%s\" (seed %u)\n", what, filterList, firstSeed );
+    exit(1);
+}
+
+/* walks filterList the obvious way and checks each extension and group
+   boundary against the compiled table */
+static void CheckAgainstReference( const char *filterList, const nfdfilter_t *filter )
+{
+    size_t spec = 0, group = 0, groupStart = 0;
+    const char *p = filterList;
+
+    if ( strcmp( NFDi_Filter_GetSource(filter), filterList ) != 0 )
+        Fail( filterList, "source differs" );
+
+    while ( 1 )
+    {
+        size_t len = strcspn( p, ",;" );
+
+        if ( len > 0 )
+        {
+            size_t specLen;
+            const nfdchar_t *ext;
+
+            if ( spec >= filter->specCount )
+                Fail( filterList, "too few extensions" );
+
+            ext = NFDi_Filter_GetSpec( filter, spec, &specLen );
+            if ( specLen != len || memcmp( ext, p, len ) != 0 || ext[len] != '\0' ||
+                 filter->specs[spec].offset != (size_t)(p - filterList) )
+                Fail( filterList, "extension differs" );
+            ++spec;
+        }
+
+        if ( (p[len] == ';' || p[len] == '\0') && spec > groupStart )
+        {
+            if ( group >= filter->groupCount ||
+                 filter->groups[group].firstSpec != groupStart ||
+                 filter->groups[group].specCount != spec - groupStart )
+                Fail( filterList, "group differs" );
+            ++group;
+            groupStart = spec;
+        }
+
+        if ( p[len] == '\0' )
+            break;
+        p += len + 1;
+    }
+
+    if ( spec != filter->specCount || group != filter->groupCount )
+        Fail( filterList, "too many extensions or groups" );
+}
+
+static void Fuzz( void )
+{
+    char filterList[FUZZ_MAX_LEN + 1];
+    nfdfilter_t *filter;
+    int run;
+
+    for ( run = 0; run < FUZZ_RUNS; ++run )
+    {
+        RandomFilterList( filterList, Random() % (FUZZ_MAX_LEN + 1) );
+
+        if ( NFD_Filter_Compile( filterList, &filter ) != NFD_OKAY )
+            Fail( filterList, NFD_GetError() );
+
+        CheckAgainstReference( filterList, filter );
+        NFD_Filter_Free( filter );
+    }
+
+    if ( NFD_Filter_Compile( NULL, &filter ) != NFD_OKAY ||
+         filter->specCount != 0 || filter->groupCount != 0 )
+        Fail( "(null)", "NULL is not an empty filter" );
+    NFD_Filter_Free( filter );
+
+    printf("fuzz: %d random filter lists match the reference\n", FUZZ_RUNS );
+}
+
+/* count extensions, four to a group, in the style of an asset tool */
+static char *MakeFilterList( size_t count )
+{
+    size_t size = count * 16 + 1;
+    char *out = malloc( size );
+    size_t len = 0;
+    size_t i;
+
+    for ( i = 0; i < count; ++i )
+    {
+        len += (size_t)snprintf( out + len, size - len, "%sext%05u",
+                                 i == 0 ? "" : (i % 4 ? "," : ";"), (unsigned)i );
+    }
+
+    return out;
+}
+
+int main( int argc, char **argv )
+{
+    const size_t counts[] = { 10, 100, 1000, 10000, 100000 };
+    const size_t numCounts = sizeof(counts) / sizeof(counts[0]);
+    double nsPerExt[sizeof(counts) / sizeof(counts[0])];
+    size_t i;
+
+    if ( argc > 1 )
+        firstSeed = seed = (unsigned int)strtoul( argv[1], NULL, 10 ) | 1;
+
+    Fuzz();
+
+    puts("extensions      best us    ns/ext");
+    for ( i = 0; i < numCounts; ++i )
+    {
+        char *filterList = MakeFilterList( counts[i] );
+        size_t runs = 10000000 / counts[i] + 3;
+        double best = 1e9;
+        size_t run;
+
+        for ( run = 0; run < runs; ++run )
+        {
+            nfdfilter_t *filter;
+            double start = Now(), elapsed;
+
+            if ( NFD_Filter_Compile( filterList, &filter ) != NFD_OKAY )
+            {
+                printf("Error: %s\n", NFD_GetError() );
+                return 1;
+            }
+            elapsed = Now() - start;
+
+            if ( filter->specCount != counts[i] || filter->groupCount != (counts[i] + 3) / 4 )
+            {
+                puts("Error: compiled filter does not match the input.");
+                return 1;
+            }
+            NFD_Filter_Free( filter );
+
+            if ( elapsed < best )
+                best = elapsed;
+        }
+
+        nsPerExt[i] = best * 1e9 / (double)counts[i];
+        printf("%10u  %11.3f  %8.2f\n", (unsigned)counts[i], best * 1e6, nsPerExt[i] );
+        free( filterList );
+    }
+
+    if ( nsPerExt[numCounts-1] > nsPerExt[numCounts-2] * MAX_RATIO )
+    {
+        printf("FAIL: per-extension cost grew %.2fx from %u to %u extensions\n",
+               nsPerExt[numCounts-1] / nsPerExt[numCounts-2],
+               (unsigned)counts[numCounts-2], (unsigned)counts[numCounts-1] );
+        return 1;
+    }
+
+    puts("OK: filter lists compile in one linear pass");
+    return 0;
+}
@@ -0,0 +1,275 @@
+/* FNM_CASEFOLD */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "nfd.h"
+#include "../src/nfd_common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <unistd.h>
+
+/* Filters a 10000 entry folder the way a file chooser does, once with
+   the compiled filter matcher and once with an fnmatch call per
+   pattern, as GTK does for gtk_file_filter_add_pattern, and checks
+   that both agree on every entry.  First checks that (?i) ranges are
+   taken between the endpoints as written, where fnmatch folds the
+   endpoints instead.  POSIX only. */
+
+#define ENTRIES  10000
+#define RUNS     20
+
+static const char FILTER_LIST[] =
+    "(?i)png,jpg,jpeg,gif,bmp,tga,tif,tiff,psd,exr,hdr,dds,ktx,webp,svg;"
+    "obj,fbx,gltf,glb,dae,3ds,blend,ply,stl,usd,usda,usdc,abc;"
+    "wav,ogg,mp3,flac,opus;"
+    "tar.gz,tar.xz,zip,7z;"
+    "Makefile*,CMakeLists.txt,*.[ch],*.[ch]pp,README*";
+
+static const char *NAME_FORMATS[] = {
+    "texture_%05d.PNG", "mesh_%05d.fbx", "sound_%05d.Ogg", "notes_%05d.txt",
+    "backup_%05d.tar.gz", "Makefile.%05d", "source_%05d.c", "source_%05d.cpp",
+    "README_%05d", "data_%05d.bin", "image_%05d.jpeg", "scene_%05d.usda",
+};
+
+typedef struct {
+    const char *filterList;
+    const char *name;
+    int         matched;
+} RangeCase;
+
+static const RangeCase RANGE_CASES[] = {
+    { "(?i)x[A-z]", "x[", 1 },    /* between 'Z' and 'a' */
+    { "(?i)x[A-z]", "x`", 1 },
+    { "(?i)x[A-z]", "xQ", 1 },
+    { "(?i)x[A-z]", "xq", 1 },
+    { "(?i)x[A-z]", "x~", 0 },
+    { "(?i)x[Z-a]", "x_", 1 },    /* empty once folded to z-a */
+    { "(?i)x[Z-a]", "xz", 1 },
+    { "(?i)x[Z-a]", "xA", 1 },
+    { "(?i)x[Z-a]", "xb", 0 },
+    { "(?i)x[!A-C]", "xb", 0 },
+    { "(?i)x[!A-C]", "xd", 1 },
+    { "x[A-C]", "xb", 0 },
+};
+
+static void CheckFoldedRanges( void )
+{
+    size_t i;
+
+    for ( i = 0; i < sizeof(RANGE_CASES) / sizeof(RANGE_CASES[0]); ++i )
+    {
+        const RangeCase *c = &RANGE_CASES[i];
+        nfdfilter_t *filter;
+        int matched;
+
+        if ( NFD_Filter_Compile( c->filterList, &filter ) != NFD_OKAY )
+        {
+            printf("Error: %s\n", NFD_GetError() );
+            exit(1);
+        }
+        matched = NFDi_Filter_MatchName( filter, 0, c->name, strlen(c->name), 0 );
+        NFD_Filter_Free( filter );
+
+        if ( matched != c->matched )
+        {
+            printf("FAIL: %s: %s: matched %d, expected %d\n",
+                   c->filterList, c->name, matched, c->matched );
+            exit(1);
+        }
+    }
+}
+
+static double Now( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static char **ReadFolder( const char *dirPath, size_t *outCount )
+{
+    char **names = malloc( sizeof(char*) * ENTRIES );
+    DIR *dir = opendir( dirPath );
+    struct dirent *entry;
+    size_t count = 0;
+
+    while ( dir && (entry = readdir(dir)) != NULL )
+    {
+        if ( entry->d_name[0] != '.' && count < ENTRIES )
+            names[count++] = strdup( entry->d_name );
+    }
+    if ( dir )
+        closedir( dir );
+
+    *outCount = count;
+    return names;
+}
+
+static char **MakeFolder( char *dirPath, size_t *outCount )
+{
+    char path[512];
+    int i;
+
+    if ( !mkdtemp( dirPath ) )
+    {
+        perror("mkdtemp");
+        exit(1);
+    }
+
+    for ( i = 0; i < ENTRIES; ++i )
+    {
+        int len = snprintf( path, sizeof(path), "%s/", dirPath );
+        FILE *file;
+
+        snprintf( path + len, sizeof(path) - (size_t)len,
+                  NAME_FORMATS[i % (int)(sizeof(NAME_FORMATS) / sizeof(NAME_FORMATS[0]))], i );
+        file = fopen( path, "w" );
+        if ( !file )
+        {
+            perror( path );
+            exit(1);
+        }
+        fclose( file );
+    }
+
+    return ReadFolder( dirPath, outCount );
+}
+
+static void RemoveFolder( const char *dirPath, char **names, size_t count )
+{
+    char path[512];
+    size_t i;
+
+    for ( i = 0; i < count; ++i )
+    {
+        snprintf( path, sizeof(path), "%s/%s", dirPath, names[i] );
+        unlink( path );
+        free( names[i] );
+    }
+    free( names );
+    rmdir( dirPath );
+}
+
+/* the patterns a backend without a matcher would register: "*.ext" for
+   an extension, the glob itself otherwise */
+static char **MakePatterns( const nfdfilter_t *filter )
+{
+    char **patterns = malloc( sizeof(char*) * filter->specCount );
+    size_t i;
+
+    for ( i = 0; i < filter->specCount; ++i )
+    {
+        size_t len;
+        const nfdchar_t *spec = NFDi_Filter_GetSpec( filter, i, &len );
+
+        patterns[i] = malloc( len + 3 );
+        if ( NFDi_Filter_IsGlob( filter, i ) )
+            memcpy( patterns[i], spec, len + 1 );
+        else
+            snprintf( patterns[i], len + 3, "*.%s", spec );
+    }
+
+    return patterns;
+}
+
+static int MatchPatterns( const nfdfilter_t *filter, char **patterns,
+                          size_t group, const char *name )
+{
+    const nfdfiltergroup_t *g = &filter->groups[group];
+    int flags = FNM_NOESCAPE | (filter->ignoreCase ? FNM_CASEFOLD : 0);
+    size_t i;
+
+    for ( i = g->firstSpec; i < g->firstSpec + g->specCount; ++i )
+    {
+        if ( fnmatch( patterns[i], name, flags ) == 0 )
+            return 1;
+    }
+
+    return 0;
+}
+
+int main( void )
+{
+    char dirPath[] = "/tmp/nfd_bench_glob_XXXXXX";
+    nfdfilter_t *filter;
+    char **names, **patterns;
+    size_t count, *lens, group, i;
+    double matcherBest = 1e9, fnmatchBest = 1e9;
+    size_t shown = 0;
+    int run;
+
+    CheckFoldedRanges();
+
+    names = MakeFolder( dirPath, &count );
+    lens = malloc( sizeof(size_t) * count );
+    for ( i = 0; i < count; ++i )
+        lens[i] = strlen( names[i] );
+
+    if ( NFD_Filter_Compile( FILTER_LIST, &filter ) != NFD_OKAY )
+    {
+        printf("Error: %s\n", NFD_GetError() );
+        return 1;
+    }
+    patterns = MakePatterns( filter );
+
+    /* each run shows the folder under every group of the filter */
+    for ( run = 0; run < RUNS; ++run )
+    {
+        double start = Now();
+        shown = 0;
+        for ( group = 0; group < filter->groupCount; ++group )
+            for ( i = 0; i < count; ++i )
+                shown += (size_t)NFDi_Filter_MatchName( filter, group, names[i], lens[i], 0 );
+        if ( Now() - start < matcherBest )
+            matcherBest = Now() - start;
+
+        start = Now();
+        for ( group = 0; group < filter->groupCount; ++group )
+            for ( i = 0; i < count; ++i )
+                MatchPatterns( filter, patterns, group, names[i] );
+        if ( Now() - start < fnmatchBest )
+            fnmatchBest = Now() - start;
+    }
+
+    for ( group = 0; group < filter->groupCount; ++group )
+    {
+        for ( i = 0; i < count; ++i )
+        {
+            int matched = NFDi_Filter_MatchName( filter, group, names[i], lens[i], 0 );
+            if ( matched != MatchPatterns( filter, patterns, group, names[i] ) )
+            {
+                printf("FAIL: group %u: %s: matcher says %d, fnmatch disagrees\n",
+                       (unsigned)group, names[i], matched );
+                return 1;
+            }
+        }
+    }
+
+    printf( "%u entries, %u groups, %u specs, %u shown in all\n",
+            (unsigned)count, (unsigned)filter->groupCount,
+            (unsigned)filter->specCount, (unsigned)shown );
+    printf( "compiled matcher:     %8.3f ms\n", matcherBest * 1e3 );
+    printf( "fnmatch per pattern:  %8.3f ms\n", fnmatchBest * 1e3 );
+
+    for ( i = 0; i < filter->specCount; ++i )
+        free( patterns[i] );
+    free( patterns );
+    free( lens );
+    NFD_Filter_Free( filter );
+    RemoveFolder( dirPath, names, count );
+
+    if ( matcherBest >= fnmatchBest )
+    {
+        puts("FAIL: the compiled matcher is not faster than fnmatch");
+        return 1;
+    }
+
+    puts("OK: the matcher agrees with fnmatch and is faster");
+    return 0;
+}
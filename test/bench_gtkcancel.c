@@ -0,0 +1,152 @@
+#include "nfd.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/* Checks that NFD_CancelDialogs, called from a second thread once a
+   dialog is on screen, closes it in time with NFD_CANCEL, and that a
+   cancel made while no dialog was open leaves the next dialog alone.
+   Needs a display; run it under Xvfb on a headless machine:
+
+     xvfb-run build/bin/bench_gtkcancel
+
+   A dialog counts as on screen once its window is mapped, which the
+   trace hook sees as the show phase that follows the filter build.
+   NFD_SetTimeout closes dialogs a cancel missed.  GTK only. */
+
+#define DIALOGS         20
+#define BOUND_MS        1000    /* a cancelled dialog returns within this */
+#define FAILSAFE_MS     10000   /* closes dialogs the cancel missed */
+#define STALE_MS        300     /* how long the dialog after a stale cancel stays open */
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t shown = PTHREAD_COND_INITIALIZER;
+static int filterBuilt = 0;
+static int shownCount = 0;
+static int finished = 0;
+static double cancelledAt[DIALOGS];
+
+static double Now( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static int CompareDoubles( const void *a, const void *b )
+{
+    double da = *(const double*)a, db = *(const double*)b;
+    return (da > db) - (da < db);
+}
+
+/* a dialog's show phase is traced once when it is acquired and once
+   when its window is mapped, with the filter build in between */
+static void TracePhase( nfdphase_t phase, uint64_t startNs, uint64_t endNs, void *userData )
+{
+    (void)startNs;
+    (void)endNs;
+    (void)userData;
+
+    pthread_mutex_lock( &lock );
+    if ( phase == NFD_PHASE_FILTER_BUILD )
+        filterBuilt = 1;
+    else if ( phase == NFD_PHASE_SHOW && filterBuilt )
+    {
+        filterBuilt = 0;
+        ++shownCount;
+        pthread_cond_signal( &shown );
+    }
+    pthread_mutex_unlock( &lock );
+}
+
+/* cancels each dialog as soon as it is on screen */
+static void *CancelThread( void *userData )
+{
+    int i;
+    (void)userData;
+
+    for ( i = 0; i < DIALOGS; ++i )
+    {
+        pthread_mutex_lock( &lock );
+        while ( shownCount <= i && !finished )
+            pthread_cond_wait( &shown, &lock );
+        pthread_mutex_unlock( &lock );
+        if ( finished )
+            break;
+
+        cancelledAt[i] = Now();
+        NFD_CancelDialogs();
+    }
+    return NULL;
+}
+
+static double OpenDialogMs( nfdresult_t *result )
+{
+    nfdchar_t *outPath = NULL;
+    double start = Now();
+
+    *result = NFD_OpenDialog( "txt", NULL, &outPath );
+    if ( *result == NFD_ERROR )
+    {
+        printf("Error: %s\n", NFD_GetError() );
+        exit(1);
+    }
+    free( outPath );
+    return (Now() - start) * 1e3;
+}
+
+int main( void )
+{
+    double latencies[DIALOGS];
+    double staleMs;
+    nfdresult_t result;
+    pthread_t thread;
+    int i;
+
+    NFD_SetTraceHook( TracePhase, NULL );
+    NFD_SetTimeout( FAILSAFE_MS );
+    pthread_create( &thread, NULL, CancelThread, NULL );
+
+    for ( i = 0; i < DIALOGS; ++i )
+    {
+        OpenDialogMs( &result );
+        latencies[i] = (Now() - cancelledAt[i]) * 1e3;
+        if ( result != NFD_CANCEL || latencies[i] > BOUND_MS )
+        {
+            printf( "FAIL: dialog %d was not cancelled within %d ms\n", i, BOUND_MS );
+            return 1;
+        }
+    }
+
+    pthread_mutex_lock( &lock );
+    finished = 1;
+    pthread_cond_signal( &shown );
+    pthread_mutex_unlock( &lock );
+    pthread_join( thread, NULL );
+
+    /* nothing is open to cancel, so only the timeout closes this one */
+    NFD_SetTraceHook( NULL, NULL );
+    NFD_CancelDialogs();
+    NFD_SetTimeout( STALE_MS );
+    staleMs = OpenDialogMs( &result );
+
+    NFD_Quit();
+
+    qsort( latencies, DIALOGS, sizeof(double), CompareDoubles );
+    printf( "median cancel to return: %8.2f ms\n", latencies[DIALOGS/2] );
+    printf( "worst cancel to return:  %8.2f ms\n", latencies[DIALOGS-1] );
+    printf( "dialog after a stale cancel stayed open: %8.2f ms\n", staleMs );
+
+    if ( staleMs < STALE_MS )
+    {
+        puts("FAIL: a cancel made before the dialog opened closed it");
+        return 1;
+    }
+
+    puts("OK: cancelled dialogs returned in time, stale cancels were ignored");
+    return 0;
+}
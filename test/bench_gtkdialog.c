@@ -0,0 +1,543 @@
+#include "nfd.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <X11/Xlib.h>
+#include <X11/extensions/XTest.h>
+#include <X11/extensions/Xfixes.h>
+
+/* Times GTK open dialogs end to end, from the call to the dialog being
+   visible and from the user's answer to the call returning, on folders
+   of 10, 10k and 100k files.  Needs a display with the XTEST and XFIXES
+   extensions; run it under Xvfb on a headless machine:
+
+     xvfb-run -s "-screen 0 1280x1024x24" build/bin/bench_gtkdialog
+
+   Each sample is a fresh child, this program re-run with --child, which
+   opens DIALOGS dialogs in a row: the first is cold, paying for
+   gtk_init_check and building the dialog, and the rest reuse it warm.
+   A second X connection in the child plays the user.  It waits for the
+   dialog's window to be mapped, then for the busy cursor GTK shows
+   while it reads the folder to go away, then answers through XTest:
+   even dialogs accept a file typed into the location bar, odd ones
+   press Escape.
+
+     init       gtk_init_check and the first file chooser class
+     construct  creating the dialog, or resetting a reused one
+     visible    from the call to the window being mapped
+     folder     from mapped until the folder has been read
+     return     from the answer to the call returning
+     cleanup    hiding the dialog, through WaitForCleanup
+
+   init, construct and cleanup come from NFD_SetTraceHook.  GTK only. */
+
+#define RUNS            5
+#define DIALOGS         5
+#define SETTLE_MS       100     /* the cursor is not busy for this long */
+#define ANSWER_MS       1000    /* answers not taken by then are repeated */
+#define ANSWER_TRIES    3
+#define LOAD_TIMEOUT_MS 120000
+#define DIALOG_MS       300000  /* closes dialogs nobody answered */
+#define ANSWER_NAME     "f0000000"
+
+typedef enum {
+    COL_INIT,
+    COL_CONSTRUCT,
+    COL_VISIBLE,
+    COL_FOLDER,
+    COL_RETURN,
+    COL_CLEANUP,
+    COL_COUNT
+} Column;
+
+static const char *COLUMN_NAMES[COL_COUNT] = {
+    "init", "construct", "visible", "folder", "return", "cleanup"
+};
+
+/* what the watcher saw of one dialog */
+typedef struct {
+    double mapped;
+    double loaded;
+    double answered;
+} Sighting;
+
+static Display *display;
+static int fixesEventBase;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sighted = PTHREAD_COND_INITIALIZER;
+static Sighting sightings[DIALOGS];
+static int sightingCount = 0;
+
+/* the dialog being timed, filled in by the trace hook */
+static double phaseMs[COL_COUNT];
+static int constructed;
+
+static double Now( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static int CompareDoubles( const void *a, const void *b )
+{
+    double da = *(const double*)a, db = *(const double*)b;
+    return (da > db) - (da < db);
+}
+
+static double Median( double *samples, int count )
+{
+    qsort( samples, (size_t)count, sizeof(double), CompareDoubles );
+    return samples[count/2];
+}
+
+/* the dialog may be hidden again before a request about it arrives */
+static int IgnoreXError( Display *d, XErrorEvent *error )
+{
+    (void)d;
+    (void)error;
+    return 0;
+}
+
+static void TracePhase( nfdphase_t phase, uint64_t startNs, uint64_t endNs, void *userData )
+{
+    double ms = (double)(endNs - startNs) * 1e-6;
+    (void)userData;
+
+    switch ( phase )
+    {
+    case NFD_PHASE_INIT:
+        phaseMs[COL_INIT] += ms;
+        break;
+    case NFD_PHASE_SHOW:
+        /* later show phases run until the window is mapped, which the
+           watcher times from the outside */
+        if ( !constructed )
+            phaseMs[COL_CONSTRUCT] += ms;
+        constructed = 1;
+        break;
+    case NFD_PHASE_CLEANUP:
+        phaseMs[COL_CLEANUP] += ms;
+        break;
+    default:
+        break;
+    }
+}
+
+/* waits up to timeoutMs for an event; returns 0 if none came */
+static int NextEvent( XEvent *event, int timeoutMs )
+{
+    struct pollfd pfd;
+
+    if ( !XPending( display ) )
+    {
+        pfd.fd = ConnectionNumber( display );
+        pfd.events = POLLIN;
+        if ( poll( &pfd, 1, timeoutMs ) <= 0 || !XPending( display ) )
+            return 0;
+    }
+
+    XNextEvent( display, event );
+    return 1;
+}
+
+static int IsBusyCursor( const char *name )
+{
+    return name && ( strcmp( name, "watch" ) == 0 ||
+                     strcmp( name, "left_ptr_watch" ) == 0 ||
+                     strcmp( name, "progress" ) == 0 ||
+                     strcmp( name, "wait" ) == 0 );
+}
+
+static Window WaitForMap( void )
+{
+    XEvent event;
+
+    for ( ;; )
+    {
+        XNextEvent( display, &event );
+        if ( event.type == MapNotify && !event.xmap.override_redirect )
+            return event.xmap.window;
+    }
+}
+
+/* Puts the pointer over the dialog so that its cursor is the one
+   displayed, and returns when the cursor has not been busy for
+   SETTLE_MS: the last time it stopped being busy, or mapped if it
+   never was. */
+static double WaitForFolder( Window window, double mapped )
+{
+    XWindowAttributes attributes;
+    XFixesCursorImage *image;
+    XEvent event;
+    double loaded = mapped;
+    int busy = 0;
+
+    if ( XGetWindowAttributes( display, window, &attributes ) )
+    {
+        XTestFakeMotionEvent( display, -1, attributes.x + attributes.width / 2,
+                              attributes.y + attributes.height / 2, CurrentTime );
+        XSetInputFocus( display, window, RevertToPointerRoot, CurrentTime );
+    }
+    XSync( display, False );
+
+    image = XFixesGetCursorImage( display );
+    if ( image )
+    {
+        busy = IsBusyCursor( image->name );
+        XFree( image );
+    }
+
+    while ( Now() - mapped < LOAD_TIMEOUT_MS * 1e-3 )
+    {
+        if ( !NextEvent( &event, SETTLE_MS ) )
+        {
+            if ( !busy )
+                return loaded;
+            continue;
+        }
+
+        if ( event.type == fixesEventBase + XFixesCursorNotify )
+        {
+            XFixesCursorNotifyEvent *notify = (XFixesCursorNotifyEvent*)&event;
+            char *name = notify->cursor_name ? XGetAtomName( display, notify->cursor_name ) : NULL;
+            int nowBusy = IsBusyCursor( name );
+
+            if ( busy && !nowBusy )
+                loaded = Now();
+            busy = nowBusy;
+            if ( name )
+                XFree( name );
+        }
+    }
+
+    puts("FAIL: the folder was still loading after the timeout");
+    exit(1);
+}
+
+static void PressKey( const char *keysymName, int withControl )
+{
+    KeyCode control = XKeysymToKeycode( display, XStringToKeysym( "Control_L" ) );
+    KeyCode key = XKeysymToKeycode( display, XStringToKeysym( keysymName ) );
+
+    if ( withControl )
+        XTestFakeKeyEvent( display, control, True, CurrentTime );
+    XTestFakeKeyEvent( display, key, True, CurrentTime );
+    XTestFakeKeyEvent( display, key, False, CurrentTime );
+    if ( withControl )
+        XTestFakeKeyEvent( display, control, False, CurrentTime );
+}
+
+/* types ANSWER_NAME into the location bar and accepts it; a reused
+   dialog's location bar can still hold the last name, so it is
+   selected first and typed over */
+static void Accept( void )
+{
+    char keysymName[2] = { 0, 0 };
+    const char *c;
+
+    PressKey( "l", 1 );
+    PressKey( "a", 1 );
+    for ( c = ANSWER_NAME; *c; ++c )
+    {
+        keysymName[0] = *c;
+        PressKey( keysymName, 0 );
+    }
+    PressKey( "Return", 0 );
+}
+
+static int WaitForUnmap( Window window )
+{
+    double start = Now();
+    XEvent event;
+
+    while ( Now() - start < ANSWER_MS * 1e-3 )
+    {
+        if ( NextEvent( &event, ANSWER_MS ) &&
+             event.type == UnmapNotify && event.xunmap.window == window )
+            return 1;
+    }
+    return 0;
+}
+
+static void *Watch( void *userData )
+{
+    int dialog, tries;
+    (void)userData;
+
+    for ( dialog = 0; dialog < DIALOGS; ++dialog )
+    {
+        Sighting sighting;
+        Window window = WaitForMap();
+
+        sighting.mapped = Now();
+        sighting.loaded = WaitForFolder( window, sighting.mapped );
+
+        /* return is timed from the answer that was taken */
+        for ( tries = 0; ; ++tries )
+        {
+            if ( tries == ANSWER_TRIES )
+            {
+                printf( "FAIL: dialog %d ignored its answer\n", dialog );
+                exit(1);
+            }
+
+            sighting.answered = Now();
+            if ( dialog % 2 == 0 )
+                Accept();
+            else
+                PressKey( "Escape", 0 );
+            XFlush( display );
+
+            if ( WaitForUnmap( window ) )
+                break;
+        }
+
+        pthread_mutex_lock( &lock );
+        sightings[sightingCount++] = sighting;
+        pthread_cond_signal( &sighted );
+        pthread_mutex_unlock( &lock );
+    }
+
+    return NULL;
+}
+
+static int RunChild( const char *folder )
+{
+    char expected[4096];
+    int event, error, major, minor;
+    pthread_t watcher;
+    int dialog, column;
+
+    display = XOpenDisplay( NULL );
+    if ( !display )
+    {
+        puts("Error: no display.");
+        return 1;
+    }
+    /* cursor names need XFIXES 2 */
+    if ( !XTestQueryExtension( display, &event, &error, &major, &minor ) ||
+         !XFixesQueryExtension( display, &fixesEventBase, &error ) ||
+         !XFixesQueryVersion( display, &major, &minor ) || major < 2 )
+    {
+        puts("Error: the display lacks XTEST or XFIXES.");
+        return 1;
+    }
+    XSetErrorHandler( IgnoreXError );
+    XSelectInput( display, DefaultRootWindow( display ), SubstructureNotifyMask );
+    XFixesSelectCursorInput( display, DefaultRootWindow( display ), XFixesDisplayCursorNotifyMask );
+    XSync( display, False );
+
+    snprintf( expected, sizeof(expected), "%s/%s", folder, ANSWER_NAME );
+    NFD_SetTraceHook( TracePhase, NULL );
+    NFD_SetTimeout( DIALOG_MS );
+    pthread_create( &watcher, NULL, Watch, NULL );
+
+    for ( dialog = 0; dialog < DIALOGS; ++dialog )
+    {
+        nfdchar_t *outPath = NULL;
+        nfdresult_t result;
+        Sighting sighting;
+        double called, returned;
+
+        memset( phaseMs, 0, sizeof(phaseMs) );
+        constructed = 0;
+
+        called = Now();
+        result = NFD_OpenDialog( NULL, folder, &outPath );
+        returned = Now();
+
+        if ( dialog % 2 == 0 ? result != NFD_OKAY || strcmp( outPath, expected ) != 0
+                             : result != NFD_CANCEL )
+        {
+            printf( "Error: dialog %d returned %d %s\n", dialog, (int)result,
+                    result == NFD_OKAY ? outPath : NFD_GetError() );
+            return 1;
+        }
+        free( outPath );
+
+        pthread_mutex_lock( &lock );
+        while ( sightingCount <= dialog )
+            pthread_cond_wait( &sighted, &lock );
+        sighting = sightings[dialog];
+        pthread_mutex_unlock( &lock );
+
+        phaseMs[COL_VISIBLE] = (sighting.mapped - called) * 1e3;
+        phaseMs[COL_FOLDER] = (sighting.loaded - sighting.mapped) * 1e3;
+        phaseMs[COL_RETURN] = (returned - sighting.answered) * 1e3;
+
+        for ( column = 0; column < COL_COUNT; ++column )
+            printf( "%f%c", phaseMs[column], column + 1 < COL_COUNT ? ' ' : '\n' );
+    }
+
+    pthread_join( watcher, NULL );
+    NFD_SetTraceHook( NULL, NULL );
+    NFD_Quit();
+    XCloseDisplay( display );
+    return 0;
+}
+
+/* entries empty files named f0000000 on, in a new folder under parent */
+static void MakeFolder( char *folder, size_t size, const char *parent, int entries )
+{
+    char path[4096];
+    int i;
+
+    snprintf( folder, size, "%s/%d", parent, entries );
+    if ( mkdir( folder, 0700 ) != 0 )
+    {
+        perror( folder );
+        exit(1);
+    }
+
+    for ( i = 0; i < entries; ++i )
+    {
+        int fd;
+
+        snprintf( path, sizeof(path), "%s/f%07d", folder, i );
+        fd = open( path, O_WRONLY|O_CREAT|O_EXCL, 0600 );
+        if ( fd == -1 )
+        {
+            perror( path );
+            exit(1);
+        }
+        close( fd );
+    }
+}
+
+static void RemoveFolder( const char *folder, int entries )
+{
+    char path[4096];
+    int i;
+
+    for ( i = 0; i < entries; ++i )
+    {
+        snprintf( path, sizeof(path), "%s/f%07d", folder, i );
+        unlink( path );
+    }
+    rmdir( folder );
+}
+
+/* runs RUNS children on folder, with the median of each column over the
+   first dialogs in cold and over the others in warm */
+static void MeasureFolder( const char *self, const char *folder,
+                           double cold[COL_COUNT], double warm[COL_COUNT] )
+{
+    double coldSamples[COL_COUNT][RUNS];
+    double warmSamples[COL_COUNT][RUNS * (DIALOGS - 1)];
+    char command[8192];
+    int run, dialog, column;
+
+    snprintf( command, sizeof(command), "'%s' --child '%s'", self, folder );
+
+    for ( run = 0; run < RUNS; ++run )
+    {
+        FILE *child = popen( command, "r" );
+        char line[512] = {0};
+
+        if ( !child )
+        {
+            puts("Error: could not start a child.");
+            exit(1);
+        }
+
+        for ( dialog = 0; dialog < DIALOGS; ++dialog )
+        {
+            double values[COL_COUNT];
+
+            if ( !fgets( line, sizeof(line), child ) ||
+                 sscanf( line, "%lf %lf %lf %lf %lf %lf", &values[0], &values[1],
+                         &values[2], &values[3], &values[4], &values[5] ) != COL_COUNT )
+            {
+                printf( "FAIL: dialog %d of a child on %s: %s", dialog, folder, line );
+                exit(1);
+            }
+
+            for ( column = 0; column < COL_COUNT; ++column )
+            {
+                if ( dialog == 0 )
+                    coldSamples[column][run] = values[column];
+                else
+                    warmSamples[column][run * (DIALOGS - 1) + dialog - 1] = values[column];
+            }
+        }
+
+        if ( pclose( child ) != 0 )
+        {
+            printf( "FAIL: a child on %s exited with an error\n", folder );
+            exit(1);
+        }
+    }
+
+    for ( column = 0; column < COL_COUNT; ++column )
+    {
+        cold[column] = Median( coldSamples[column], RUNS );
+        warm[column] = Median( warmSamples[column], RUNS * (DIALOGS - 1) );
+    }
+}
+
+static void PrintRow( int entries, const char *run, const double *medians )
+{
+    int column;
+
+    printf( "%8d  %-4s", entries, run );
+    for ( column = 0; column < COL_COUNT; ++column )
+        printf( " %10.2f", medians[column] );
+    printf( "\n" );
+    fflush( stdout );
+}
+
+int main( int argc, char **argv )
+{
+    const int entryCounts[] = { 10, 10000, 100000 };
+    char parent[] = "/tmp/nfd_gtkdialog_XXXXXX";
+    char folder[4096];
+    double cold[COL_COUNT], warm[COL_COUNT];
+    int slowerWarm = 0;
+    size_t i;
+    int column;
+
+    if ( argc == 3 && strcmp( argv[1], "--child" ) == 0 )
+        return RunChild( argv[2] );
+
+    if ( !mkdtemp( parent ) )
+    {
+        perror( parent );
+        return 1;
+    }
+
+    printf( " entries  run " );
+    for ( column = 0; column < COL_COUNT; ++column )
+        printf( " %10s", COLUMN_NAMES[column] );
+    printf( "   (median ms)\n" );
+
+    for ( i = 0; i < sizeof(entryCounts) / sizeof(entryCounts[0]); ++i )
+    {
+        MakeFolder( folder, sizeof(folder), parent, entryCounts[i] );
+        MeasureFolder( argv[0], folder, cold, warm );
+        RemoveFolder( folder, entryCounts[i] );
+
+        PrintRow( entryCounts[i], "cold", cold );
+        PrintRow( entryCounts[i], "warm", warm );
+
+        if ( warm[COL_VISIBLE] >= cold[COL_VISIBLE] )
+            slowerWarm = 1;
+    }
+    rmdir( parent );
+
+    if ( slowerWarm )
+    {
+        puts("FAIL: a reused dialog was not visible sooner than a new one");
+        return 1;
+    }
+
+    puts("OK: every dialog was answered, and reused dialogs showed sooner");
+    return 0;
+}
@@ -0,0 +1,139 @@
+#include "nfd.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Opens the same dialog many times, once with the dialog pool and once
+   with NFD_GTK_NO_POOL set, which makes every open build a new dialog.
+   Checks that warm opens from the pool are faster than warm opens
+   without it, and that the resident size settles instead of growing
+   with every pooled dialog.  Needs a display; run it under Xvfb on a
+   headless machine:
+
+     xvfb-run build/bin/bench_gtkpool
+
+   Each mode runs in a fresh child, this program re-run with --child,
+   as the environment is only read when GTK starts.  The first
+   WARMUP_DIALOGS are left out in both, so GTK's own caches are as warm
+   for one as for the other.  Dialogs are closed by NFD_SetTimeout,
+   which is subtracted out.  GTK only. */
+
+#define DIALOGS         100
+#define WARMUP_DIALOGS  10    /* GTK fills its caches during these */
+#define DIALOG_MS       20    /* how long each dialog stays open */
+#define MAX_GROWTH_KB   1024  /* allowed RSS growth after the warmup */
+
+static double Now( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static int CompareDoubles( const void *a, const void *b )
+{
+    double da = *(const double*)a, db = *(const double*)b;
+    return (da > db) - (da < db);
+}
+
+static long ResidentKB( void )
+{
+    FILE *statm = fopen( "/proc/self/statm", "r" );
+    long size = 0, resident = 0;
+
+    if ( !statm )
+        return 0;
+    if ( fscanf( statm, "%ld %ld", &size, &resident ) != 2 )
+        resident = 0;
+    fclose( statm );
+
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+/* prints the median warm open and the RSS growth after the warmup */
+static int RunChild( void )
+{
+    double samples[DIALOGS];
+    long warmKB = 0, finalKB;
+    int i;
+
+    NFD_SetTimeout( DIALOG_MS );
+
+    for ( i = 0; i < DIALOGS; ++i )
+    {
+        nfdchar_t *outPath = NULL;
+        const nfdchar_t *filterList = (i % 2) ? "png,jpg;pdf" : "txt";
+        double start = Now();
+
+        if ( NFD_OpenDialog( filterList, NULL, &outPath ) == NFD_ERROR )
+        {
+            printf("Error: %s\n", NFD_GetError() );
+            return 1;
+        }
+        samples[i] = (Now() - start) * 1e3 - DIALOG_MS;
+
+        if ( i + 1 == WARMUP_DIALOGS )
+            warmKB = ResidentKB();
+    }
+    finalKB = ResidentKB();
+
+    NFD_Quit();
+
+    qsort( samples + WARMUP_DIALOGS, DIALOGS - WARMUP_DIALOGS, sizeof(double), CompareDoubles );
+    printf( "%f %ld\n", samples[WARMUP_DIALOGS + (DIALOGS - WARMUP_DIALOGS) / 2], finalKB - warmKB );
+    return 0;
+}
+
+static void RunMode( const char *self, int pooled, double *warmMs, long *growthKB )
+{
+    char command[1024];
+    char line[256] = {0};
+    FILE *child;
+
+    snprintf( command, sizeof(command), "%s'%s' --child",
+              pooled ? "" : "NFD_GTK_NO_POOL=1 ", self );
+
+    child = popen( command, "r" );
+    if ( !child || !fgets( line, sizeof(line), child ) ||
+         pclose( child ) != 0 ||
+         sscanf( line, "%lf %ld", warmMs, growthKB ) != 2 )
+    {
+        printf("Error: dialogs failed: %s", line );
+        exit(1);
+    }
+}
+
+int main( int argc, char **argv )
+{
+    double pooledMs, unpooledMs;
+    long pooledKB, unpooledKB;
+
+    if ( argc == 2 && strcmp( argv[1], "--child" ) == 0 )
+        return RunChild();
+
+    RunMode( argv[0], 1, &pooledMs, &pooledKB );
+    RunMode( argv[0], 0, &unpooledMs, &unpooledKB );
+
+    printf( "median warm open, pooled:      %8.2f ms\n", pooledMs );
+    printf( "median warm open, not pooled:  %8.2f ms\n", unpooledMs );
+    printf( "rss growth after %d dialogs, pooled:     %ld KB\n", WARMUP_DIALOGS, pooledKB );
+    printf( "rss growth after %d dialogs, not pooled: %ld KB\n", WARMUP_DIALOGS, unpooledKB );
+
+    if ( pooledMs >= unpooledMs )
+    {
+        puts("FAIL: opening a pooled dialog is not faster than building a new one");
+        return 1;
+    }
+    if ( pooledKB > MAX_GROWTH_KB )
+    {
+        printf( "FAIL: rss grew by more than %d KB over %d pooled dialogs\n",
+                MAX_GROWTH_KB, DIALOGS - WARMUP_DIALOGS );
+        return 1;
+    }
+
+    puts("OK: pooled dialogs open faster than new ones, without growing");
+    return 0;
+}
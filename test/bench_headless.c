@@ -0,0 +1,247 @@
+#include "nfd.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/* Answers dialogs headless, first from a script in NFD_HEADLESS_SCRIPT
+   and then from a callback, and checks every result.  Then measures
+   dialog calls per second with one and several threads, for single
+   paths and for multiple selections, and checks that no allocation
+   outlives its dialog.  Runs against any Linux backend without a
+   display.  POSIX only. */
+
+#define CALLS       200000
+#define THREADS     4
+#define MULTI_PATHS 100
+
+static const char SCRIPT[] =
+    "# headless answers, in order\n"
+    "okay /home/user/a.png\n"
+    "\n"
+    "okay /home/user/a.png|/home/user/b.jpg|/home/user/c.pdf\n"
+    "cancel\r\n"
+    "error no disk in drive A:\n";
+
+static char multiAnswer[MULTI_PATHS * 32];
+static unsigned long live = 0;
+
+static double Now( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void *CountingAlloc( size_t bytes, void *userData )
+{
+    (void)userData;
+    __sync_fetch_and_add( &live, 1 );
+    return malloc( bytes );
+}
+
+static void CountingFree( void *ptr, void *userData )
+{
+    (void)userData;
+    __sync_fetch_and_sub( &live, 1 );
+    free( ptr );
+}
+
+static void Fail( const char *what )
+{
+    printf( "FAIL: %s (%s)\n", what, NFD_GetError() );
+    exit(1);
+}
+
+static void CheckScript( void )
+{
+    nfdchar_t *outPath = NULL;
+    nfdpathset_t pathSet;
+    int round;
+
+    /* the script starts over after its last answer */
+    for ( round = 0; round < 2; ++round )
+    {
+        if ( NFD_OpenDialog( "png", NULL, &outPath ) != NFD_OKAY ||
+             strcmp( outPath, "/home/user/a.png" ) != 0 )
+            Fail("the script's first answer");
+        CountingFree( outPath, NULL );
+
+        if ( NFD_OpenDialogMultiple( "png,jpg;pdf", NULL, &pathSet ) != NFD_OKAY ||
+             NFD_PathSet_GetCount( &pathSet ) != 3 ||
+             strcmp( NFD_PathSet_GetPath( &pathSet, 2 ), "/home/user/c.pdf" ) != 0 )
+            Fail("the script's multiple selection");
+        NFD_PathSet_Free( &pathSet );
+
+        if ( NFD_SaveDialog( NULL, NULL, &outPath ) != NFD_CANCEL )
+            Fail("the script's cancel");
+
+        if ( NFD_PickFolder( NULL, &outPath ) != NFD_ERROR ||
+             strcmp( NFD_GetError(), "no disk in drive A:" ) != 0 )
+            Fail("the script's error");
+    }
+}
+
+static nfdresult_t Answer( nfddialogtype_t type, const nfdchar_t *filterList,
+                           const nfdchar_t *defaultPath, const nfdchar_t **outPaths,
+                           void *userData )
+{
+    (void)defaultPath;
+    (void)userData;
+
+    switch ( type )
+    {
+    case NFD_DIALOG_OPEN:
+        *outPaths = filterList ? "/home/user/photo.png" : "/home/user/any";
+        return NFD_OKAY;
+    case NFD_DIALOG_OPEN_MULTIPLE:
+        *outPaths = multiAnswer;
+        return NFD_OKAY;
+    case NFD_DIALOG_SAVE:
+        *outPaths = "/home/user/not\xff" "utf8";
+        return NFD_OKAY;
+    default:
+        return NFD_CANCEL;
+    }
+}
+
+static void CheckCallback( void )
+{
+    nfdchar_t *outPath = NULL;
+    nfdpathset_t pathSet;
+    nfdfilter_t *filter;
+
+    if ( NFD_OpenDialog( "png", "/home/user", &outPath ) != NFD_OKAY ||
+         strcmp( outPath, "/home/user/photo.png" ) != 0 )
+        Fail("the callback's answer");
+    CountingFree( outPath, NULL );
+
+    if ( NFD_Filter_Compile( NULL, &filter ) != NFD_OKAY )
+        Fail("compiling an empty filter");
+    if ( NFD_OpenDialogF( filter, NULL, &outPath ) != NFD_OKAY ||
+         strcmp( outPath, "/home/user/any" ) != 0 )
+        Fail("the callback's answer to a dialog without a filter");
+    CountingFree( outPath, NULL );
+    NFD_Filter_Free( filter );
+
+    if ( NFD_OpenDialogMultiple( NULL, NULL, &pathSet ) != NFD_OKAY ||
+         NFD_PathSet_GetCount( &pathSet ) != MULTI_PATHS )
+        Fail("the callback's multiple selection");
+    NFD_PathSet_Free( &pathSet );
+
+    if ( NFD_SaveDialog( NULL, NULL, &outPath ) != NFD_ERROR ||
+         NFD_GetErrorCode() != NFD_ERR_INVALID_UTF8 )
+        Fail("a path that is not UTF-8");
+
+    if ( NFD_PickFolder( NULL, &outPath ) != NFD_CANCEL )
+        Fail("the callback's cancel");
+}
+
+typedef struct {
+    nfdfilter_t *filter;
+    int multiple;
+    long calls;
+} Job;
+
+static void *RunCalls( void *userData )
+{
+    Job *job = (Job*)userData;
+    long i;
+
+    for ( i = 0; i < job->calls; ++i )
+    {
+        if ( job->multiple )
+        {
+            nfdpathset_t pathSet;
+            if ( NFD_OpenDialogMultipleF( job->filter, NULL, &pathSet ) != NFD_OKAY )
+                Fail("a multiple selection under load");
+            NFD_PathSet_Free( &pathSet );
+        }
+        else
+        {
+            nfdchar_t *outPath;
+            if ( NFD_OpenDialogF( job->filter, NULL, &outPath ) != NFD_OKAY )
+                Fail("a dialog under load");
+            CountingFree( outPath, NULL );
+        }
+    }
+
+    return NULL;
+}
+
+static double Measure( nfdfilter_t *filter, int multiple, int threads )
+{
+    pthread_t ids[THREADS];
+    Job job;
+    double start;
+    int i;
+
+    job.filter = filter;
+    job.multiple = multiple;
+    job.calls = (multiple ? CALLS / 10 : CALLS) / threads;
+
+    start = Now();
+    for ( i = 0; i < threads; ++i )
+        pthread_create( &ids[i], NULL, RunCalls, &job );
+    for ( i = 0; i < threads; ++i )
+        pthread_join( ids[i], NULL );
+
+    return (double)(job.calls * threads) / (Now() - start);
+}
+
+int main( void )
+{
+    char scriptPath[] = "/tmp/nfd_headless_XXXXXX";
+    nfdfilter_t *filter;
+    double single1, singleN, multi1, multiN;
+    size_t len = 0;
+    int fd, i;
+
+    fd = mkstemp( scriptPath );
+    if ( fd == -1 || write( fd, SCRIPT, sizeof(SCRIPT) - 1 ) != (ssize_t)(sizeof(SCRIPT) - 1) )
+    {
+        puts("Error: could not write the script.");
+        return 1;
+    }
+    close( fd );
+
+    /* read as the first dialog opens */
+    setenv( "NFD_HEADLESS_SCRIPT", scriptPath, 1 );
+    NFD_SetAllocator( CountingAlloc, CountingFree, NULL );
+
+    CheckScript();
+    unlink( scriptPath );
+
+    for ( i = 0; i < MULTI_PATHS; ++i )
+        len += (size_t)snprintf( multiAnswer + len, sizeof(multiAnswer) - len,
+                                 "%s/home/user/file%03d.png", i ? "|" : "", i );
+    NFD_Headless_SetCallback( Answer, NULL );
+    CheckCallback();
+
+    if ( NFD_Filter_Compile( "(?i)png,jpg,jpeg;psd;*.[ch]", &filter ) != NFD_OKAY )
+        Fail("compiling the filter");
+    single1 = Measure( filter, 0, 1 );
+    singleN = Measure( filter, 0, THREADS );
+    multi1 = Measure( filter, 1, 1 );
+    multiN = Measure( filter, 1, THREADS );
+    NFD_Filter_Free( filter );
+
+    NFD_Headless_SetCallback( NULL, NULL );
+    NFD_SetAllocator( NULL, NULL, NULL );
+
+    puts("dialog                      1 thread     4 threads   (calls/s)");
+    printf( "single path            %12.0f  %12.0f\n", single1, singleN );
+    printf( "%3d paths              %12.0f  %12.0f\n", MULTI_PATHS, multi1, multiN );
+
+    if ( live != 0 )
+    {
+        printf( "FAIL: %lu allocations outlived their dialog\n", live );
+        return 1;
+    }
+
+    puts("OK: headless dialogs answered from the script and the callback");
+    return 0;
+}
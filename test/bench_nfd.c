@@ -0,0 +1,553 @@
+#include "nfd.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/* End-to-end latency of every public dialog call of the zenity backend,
+   with fake_zenity standing in for zenity so that nfd_zenity.c and
+   simple_exec.h run for real but nobody has to click.  Each call is
+   timed with and without the launcher NFD_Init starts, as the host's
+   resident size grows, and multiple selections with 1 to 1M paths.
+
+   Every run checks its rows against each other, so that it holds on
+   any machine: the run fails if a call got more than SAME_RUN_RATIO
+   times slower as the host grew, or if an F variant is that much
+   slower than the call that compiles its filter every time.
+
+   With --baseline, the median of each row is also compared with a
+   baseline such as test/bench_nfd_baseline.txt, and the run fails if
+   one got slower by more than the tolerance.  Those timings only hold
+   on the machine that wrote them: after a deliberate change, rewrite
+   the baseline with --write-baseline and check it in with the change.
+
+     bench_nfd [--quick] [--baseline FILE] [--write-baseline FILE]
+               [--tolerance FACTOR]
+
+   --quick stays at the starting resident size and stops at 10k paths.
+   Needs fake_zenity, built as build/bin/fake_zenity/zenity.  Zenity
+   backend only.  POSIX only. */
+
+#define MAX_ROWS          512
+#define MAX_RUNS          31
+#define MAX_MAPPINGS      4000
+#define MAPPINGS_PER_STEP 1000
+#define FILTER_LIST       "png,jpg;pdf"
+#define DEFAULT_TOLERANCE 1.5
+/* generous, since both rows of a same-run check come from one noisy
+   run rather than from a quiet baseline */
+#define SAME_RUN_RATIO    3.0
+/* a row that is slower by less than this has not regressed, whatever
+   the ratio; spawning a process varies by about as much */
+#define NOISE_FLOOR_MS    0.5
+
+typedef enum {
+    CALL_OPEN,
+    CALL_OPEN_F,
+    CALL_SAVE,
+    CALL_SAVE_F,
+    CALL_PICK_FOLDER,
+    CALL_OPEN_ASYNC,
+    CALL_SAVE_ASYNC,
+    CALL_PICK_FOLDER_ASYNC,
+    CALL_OPEN_MULTIPLE,
+    CALL_OPEN_MULTIPLE_F,
+    CALL_OPEN_MULTIPLE_ASYNC,
+    CALL_COUNT
+} Call;
+
+/* calls from CALL_OPEN_MULTIPLE on return path sets */
+static const char *CALL_NAMES[CALL_COUNT] = {
+    "NFD_OpenDialog",
+    "NFD_OpenDialogF",
+    "NFD_SaveDialog",
+    "NFD_SaveDialogF",
+    "NFD_PickFolder",
+    "NFD_OpenDialogAsync",
+    "NFD_SaveDialogAsync",
+    "NFD_PickFolderAsync",
+    "NFD_OpenDialogMultiple",
+    "NFD_OpenDialogMultipleF",
+    "NFD_OpenDialogMultipleAsync"
+};
+
+typedef struct {
+    char        key[96];
+    const char *name, *mode;
+    size_t      residentMB, count;
+    double      p50, p90, p99;    /* milliseconds */
+} Row;
+
+static Row rows[MAX_ROWS];
+static size_t rowCount = 0;
+
+static void *mappings[MAX_MAPPINGS];
+static size_t mappingSizes[MAX_MAPPINGS];
+static size_t mappingCount = 0;
+
+static double Now( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static int CompareDoubles( const void *a, const void *b )
+{
+    double da = *(const double*)a, db = *(const double*)b;
+    return (da > db) - (da < db);
+}
+
+/* nearest rank, of samples sorted in place */
+static double Percentile( double *samples, int runs, int percent )
+{
+    int rank = (percent * runs + 99) / 100;
+
+    qsort( samples, (size_t)runs, sizeof(double), CompareDoubles );
+    return samples[rank > 0 ? rank - 1 : 0];
+}
+
+static void Fail( const char *what )
+{
+    printf( "FAIL: %s (%s)\n", what, NFD_GetError() );
+    exit(1);
+}
+
+/* touch size more bytes of fresh memory spread over many mappings */
+static void GrowResident( size_t size )
+{
+    size_t mappingSize = size / MAPPINGS_PER_STEP;
+    size_t i;
+
+    if ( size == 0 )
+        return;
+
+    for ( i = 0; i < MAPPINGS_PER_STEP && mappingCount < MAX_MAPPINGS; ++i )
+    {
+        char *p = mmap( NULL, mappingSize, PROT_READ|PROT_WRITE,
+                        MAP_PRIVATE|MAP_ANONYMOUS, -1, 0 );
+        if ( p == MAP_FAILED )
+        {
+            puts("Error: mmap failed.");
+            exit(1);
+        }
+        memset( p, 1, mappingSize );
+        mappings[mappingCount] = p;
+        mappingSizes[mappingCount++] = mappingSize;
+    }
+}
+
+static void ReleaseResident( void )
+{
+    while ( mappingCount > 0 )
+    {
+        --mappingCount;
+        munmap( mappings[mappingCount], mappingSizes[mappingCount] );
+    }
+}
+
+static void WaitForDialog( nfdhandle_t *handle )
+{
+    while ( !NFD_Handle_Poll( handle ) )
+    {
+        struct pollfd pfd;
+        pfd.fd = NFD_Handle_GetFd( handle );
+        pfd.events = POLLIN;
+        poll( &pfd, 1, -1 );
+    }
+}
+
+/* one call, from the request to the returned paths, checked against
+   what fake_zenity answers */
+static double TimeCall( Call call, nfdfilter_t *filter, size_t count )
+{
+    char defaultPath[64];
+    nfdchar_t *outPath = NULL;
+    nfdpathset_t pathSet;
+    nfdhandle_t *handle;
+    nfdresult_t result;
+    double start, elapsed;
+
+    snprintf( defaultPath, sizeof(defaultPath), "/nfd-bench/%lu/", (unsigned long)count );
+
+    start = Now();
+    switch ( call )
+    {
+    case CALL_OPEN:
+        result = NFD_OpenDialog( FILTER_LIST, defaultPath, &outPath );
+        break;
+    case CALL_OPEN_F:
+        result = NFD_OpenDialogF( filter, defaultPath, &outPath );
+        break;
+    case CALL_SAVE:
+        result = NFD_SaveDialog( FILTER_LIST, defaultPath, &outPath );
+        break;
+    case CALL_SAVE_F:
+        result = NFD_SaveDialogF( filter, defaultPath, &outPath );
+        break;
+    case CALL_PICK_FOLDER:
+        result = NFD_PickFolder( defaultPath, &outPath );
+        break;
+    case CALL_OPEN_ASYNC:
+    case CALL_SAVE_ASYNC:
+    case CALL_PICK_FOLDER_ASYNC:
+        if ( call == CALL_OPEN_ASYNC )
+            result = NFD_OpenDialogAsync( FILTER_LIST, defaultPath, &handle );
+        else if ( call == CALL_SAVE_ASYNC )
+            result = NFD_SaveDialogAsync( FILTER_LIST, defaultPath, &handle );
+        else
+            result = NFD_PickFolderAsync( defaultPath, &handle );
+        if ( result == NFD_OKAY )
+        {
+            WaitForDialog( handle );
+            result = NFD_Handle_Finish( handle, &outPath );
+        }
+        break;
+    case CALL_OPEN_MULTIPLE:
+        result = NFD_OpenDialogMultiple( FILTER_LIST, defaultPath, &pathSet );
+        break;
+    case CALL_OPEN_MULTIPLE_F:
+        result = NFD_OpenDialogMultipleF( filter, defaultPath, &pathSet );
+        break;
+    default:
+        result = NFD_OpenDialogMultipleAsync( FILTER_LIST, defaultPath, &handle );
+        if ( result == NFD_OKAY )
+        {
+            WaitForDialog( handle );
+            result = NFD_Handle_FinishMultiple( handle, &pathSet );
+        }
+        break;
+    }
+    elapsed = Now() - start;
+
+    if ( result != NFD_OKAY )
+        Fail( CALL_NAMES[call] );
+
+    if ( call >= CALL_OPEN_MULTIPLE )
+    {
+        if ( NFD_PathSet_GetCount( &pathSet ) != count )
+            Fail("a multiple selection with the wrong number of paths");
+        NFD_PathSet_Free( &pathSet );
+    }
+    else
+    {
+        if ( strncmp( outPath, defaultPath, strlen(defaultPath) - 1 ) != 0 )
+            Fail("a path outside the default folder");
+        free( outPath );
+    }
+
+    return elapsed;
+}
+
+static void AddRow( const char *name, const char *mode, size_t residentMB,
+                    size_t count, double *samples, int runs )
+{
+    Row *row = &rows[rowCount++];
+
+    snprintf( row->key, sizeof(row->key), "%s/%s/rss=%lu/paths=%lu", name, mode,
+              (unsigned long)residentMB, (unsigned long)count );
+    row->name = name;
+    row->mode = mode;
+    row->residentMB = residentMB;
+    row->count = count;
+    row->p50 = Percentile( samples, runs, 50 ) * 1e3;
+    row->p90 = Percentile( samples, runs, 90 ) * 1e3;
+    row->p99 = Percentile( samples, runs, 99 ) * 1e3;
+
+    printf( "%-28s %-9s %7lu %8lu %5d %9.3f %9.3f %9.3f\n", name, mode,
+            (unsigned long)residentMB, (unsigned long)count, runs,
+            row->p50, row->p90, row->p99 );
+    fflush( stdout );
+}
+
+static void MeasureCalls( const char *mode, size_t residentMB, const size_t *counts,
+                          size_t countCount, nfdfilter_t *filter )
+{
+    double samples[MAX_RUNS];
+    int call, run;
+    size_t i;
+
+    for ( call = 0; call < CALL_COUNT; ++call )
+    {
+        for ( i = 0; i < (call >= CALL_OPEN_MULTIPLE ? countCount : 1); ++i )
+        {
+            size_t count = call >= CALL_OPEN_MULTIPLE ? counts[i] : 1;
+            int runs = count >= 1000000 ? 5 : count >= 10000 ? 11 : MAX_RUNS;
+
+            for ( run = 0; run < runs; ++run )
+                samples[run] = TimeCall( (Call)call, filter, count );
+            AddRow( CALL_NAMES[call], mode, residentMB, count, samples, runs );
+        }
+    }
+}
+
+/* NFD_Init forks the launcher, so what it costs grows with the host */
+static void MeasureInit( size_t residentMB )
+{
+    double initSamples[MAX_RUNS], quitSamples[MAX_RUNS];
+    double start;
+    int run;
+
+    for ( run = 0; run < MAX_RUNS; ++run )
+    {
+        start = Now();
+        if ( NFD_Init() != NFD_OKAY )
+            Fail("NFD_Init");
+        initSamples[run] = Now() - start;
+
+        start = Now();
+        NFD_Quit();
+        quitSamples[run] = Now() - start;
+    }
+
+    AddRow( "NFD_Init", "direct", residentMB, 0, initSamples, MAX_RUNS );
+    AddRow( "NFD_Quit", "direct", residentMB, 0, quitSamples, MAX_RUNS );
+}
+
+static const Row *FindRow( const char *key )
+{
+    size_t i;
+
+    for ( i = 0; i < rowCount; ++i )
+    {
+        if ( strcmp( rows[i].key, key ) == 0 )
+            return &rows[i];
+    }
+    return NULL;
+}
+
+static const Row *FindSameRunRow( const char *name, const char *mode,
+                                  size_t residentMB, size_t count )
+{
+    size_t i;
+
+    for ( i = 0; i < rowCount; ++i )
+    {
+        if ( strcmp( rows[i].name, name ) == 0 && strcmp( rows[i].mode, mode ) == 0 &&
+             rows[i].residentMB == residentMB && rows[i].count == count )
+            return &rows[i];
+    }
+    return NULL;
+}
+
+static int CheckSameRun( const Row *row, const Row *reference, const char *why )
+{
+    if ( !reference || row->p50 <= reference->p50 * SAME_RUN_RATIO ||
+         row->p50 - reference->p50 <= NOISE_FLOOR_MS )
+        return 0;
+
+    printf( "REGRESSION: %s took %.3f ms, %s %.3f ms\n", row->key, row->p50, why,
+            reference->p50 );
+    return 1;
+}
+
+/* returns the number of rows that got slower than rows of this run
+   allow: spawning dialogs must not get slower as the host grows, and a
+   compiled filter must not cost more than compiling it every time.
+   NFD_Init forks the launcher and may grow with the host. */
+static int CompareSameRun( void )
+{
+    int regressions = 0;
+    size_t i;
+
+    for ( i = 0; i < rowCount; ++i )
+    {
+        const Row *row = &rows[i];
+        size_t nameLen = strlen( row->name );
+        char plainName[64];
+
+        if ( row->count == 0 )
+            continue;
+
+        if ( row->residentMB != 0 )
+            regressions += CheckSameRun( row,
+                FindSameRunRow( row->name, row->mode, 0, row->count ),
+                "at the starting size" );
+
+        if ( row->name[nameLen - 1] == 'F' && nameLen < sizeof(plainName) )
+        {
+            snprintf( plainName, sizeof(plainName), "%.*s", (int)(nameLen - 1), row->name );
+            regressions += CheckSameRun( row,
+                FindSameRunRow( plainName, row->mode, row->residentMB, row->count ),
+                plainName );
+        }
+    }
+
+    printf( "Compared rows within this run, ratio %.2fx\n", SAME_RUN_RATIO );
+    return regressions;
+}
+
+static int WriteBaseline( const char *path )
+{
+    FILE *file = fopen( path, "w" );
+    size_t i;
+
+    if ( !file )
+    {
+        perror( path );
+        return 0;
+    }
+
+    fputs( "# bench_nfd medians in milliseconds, from bench_nfd --write-baseline\n", file );
+    for ( i = 0; i < rowCount; ++i )
+        fprintf( file, "%s %.3f\n", rows[i].key, rows[i].p50 );
+
+    fclose( file );
+    printf( "Wrote %s\n", path );
+    return 1;
+}
+
+/* returns the number of rows that got slower than the baseline allows */
+static int CompareBaseline( const char *path, double tolerance )
+{
+    FILE *file = fopen( path, "r" );
+    char line[256], key[128];
+    int compared = 0, regressions = 0;
+    double baseline;
+
+    if ( !file )
+    {
+        printf( "FAIL: no baseline at %s\n", path );
+        exit(1);
+    }
+
+    while ( fgets( line, sizeof(line), file ) )
+    {
+        const Row *row;
+
+        if ( line[0] == '#' || sscanf( line, "%127s %lf", key, &baseline ) != 2 )
+            continue;
+
+        /* rows this run skipped, such as with --quick */
+        row = FindRow( key );
+        if ( !row )
+            continue;
+
+        ++compared;
+        if ( row->p50 > baseline * tolerance && row->p50 - baseline > NOISE_FLOOR_MS )
+        {
+            printf( "REGRESSION: %s took %.3f ms, baseline %.3f ms\n", key, row->p50, baseline );
+            ++regressions;
+        }
+    }
+    fclose( file );
+
+    printf( "Compared %d rows with %s, tolerance %.2fx\n", compared, path, tolerance );
+    return regressions;
+}
+
+/* build/bin, where this program and fake_zenity are built */
+static void GetBinDir( char *dir, size_t size )
+{
+    ssize_t len = readlink( "/proc/self/exe", dir, size - 1 );
+    char *slash;
+
+    if ( len <= 0 )
+    {
+        snprintf( dir, size, "." );
+        return;
+    }
+    dir[len] = '\0';
+    slash = strrchr( dir, '/' );
+    if ( slash )
+        *slash = '\0';
+}
+
+int main( int argc, char **argv )
+{
+    const size_t stepsMB[] = { 0, 64, 256, 1024 };
+    const size_t counts[] = { 1, 100, 10000, 1000000 };
+    const char *modes[] = { "launcher", "direct" };
+    const char *writePath = NULL, *baselinePath = NULL;
+    char binDir[4096], fakeDir[4200], *pathEnv;
+    double tolerance = DEFAULT_TOLERANCE;
+    size_t stepCount = 4, countCount = 4, residentMB, i;
+    nfdfilter_t *filter;
+    int quick = 0, mode, regressions;
+
+    GetBinDir( binDir, sizeof(binDir) );
+
+    for ( i = 1; i < (size_t)argc; ++i )
+    {
+        if ( strcmp( argv[i], "--quick" ) == 0 )
+            quick = 1;
+        else if ( strcmp( argv[i], "--baseline" ) == 0 && i + 1 < (size_t)argc )
+            baselinePath = argv[++i];
+        else if ( strcmp( argv[i], "--write-baseline" ) == 0 && i + 1 < (size_t)argc )
+            writePath = argv[++i];
+        else if ( strcmp( argv[i], "--tolerance" ) == 0 && i + 1 < (size_t)argc )
+            tolerance = atof( argv[++i] );
+        else
+        {
+            puts("usage: bench_nfd [--quick] [--baseline FILE] [--write-baseline FILE] [--tolerance FACTOR]");
+            return 1;
+        }
+    }
+    if ( quick )
+    {
+        stepCount = 1;
+        countCount = 3;
+    }
+
+    /* before the launcher starts, which keeps the environment it saw */
+    snprintf( fakeDir, sizeof(fakeDir), "%s/fake_zenity", binDir );
+    pathEnv = malloc( strlen(fakeDir) + strlen( getenv("PATH") ? getenv("PATH") : "" ) + 2 );
+    sprintf( pathEnv, "%s:%s", fakeDir, getenv("PATH") ? getenv("PATH") : "" );
+    setenv( "PATH", pathEnv, 1 );
+    free( pathEnv );
+    snprintf( fakeDir + strlen(fakeDir), sizeof(fakeDir) - strlen(fakeDir), "/zenity" );
+    if ( access( fakeDir, X_OK ) != 0 )
+    {
+        printf( "Error: %s is missing; build fake_zenity.\n", fakeDir );
+        return 1;
+    }
+
+    if ( NFD_Filter_Compile( FILTER_LIST, &filter ) != NFD_OKAY )
+        Fail("compiling the filter");
+
+    puts("call                         mode       rss MB    paths  runs    p50 ms    p90 ms    p99 ms");
+    for ( mode = 0; mode < 2; ++mode )
+    {
+        /* the launcher is started while the host is still small, as
+           NFD_Init early in main() would */
+        if ( mode == 0 && NFD_Init() != NFD_OKAY )
+            Fail("NFD_Init");
+
+        residentMB = 0;
+        for ( i = 0; i < stepCount; ++i )
+        {
+            GrowResident( (stepsMB[i] - residentMB) * 1024 * 1024 );
+            residentMB = stepsMB[i];
+
+            if ( mode == 1 )
+                MeasureInit( residentMB );
+            MeasureCalls( modes[mode], residentMB, counts, countCount, filter );
+        }
+
+        if ( mode == 0 )
+            NFD_Quit();
+        ReleaseResident();
+    }
+
+    NFD_Filter_Free( filter );
+
+    if ( writePath )
+        return WriteBaseline( writePath ) ? 0 : 1;
+
+    regressions = CompareSameRun();
+    if ( baselinePath )
+        regressions += CompareBaseline( baselinePath, tolerance );
+    if ( regressions > 0 )
+    {
+        printf( "FAIL: %d rows regressed\n", regressions );
+        return 1;
+    }
+
+    puts( baselinePath ? "OK: no call regressed within the run or against the baseline"
+                       : "OK: no call regressed within the run" );
+    return 0;
+}
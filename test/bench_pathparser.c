@@ -0,0 +1,113 @@
+#include "nfd.h"
+#include "../src/nfd_common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Measures the cost of splitting zenity --multiple output into a path
+   set, fed in pipe-sized chunks, and checks that it scales linearly
+   with the number of paths.  POSIX only. */
+
+#define CHUNK_SIZE (64*1024)
+#define MAX_RATIO  2.0
+
+static double Now( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static char *MakeZenityOutput( size_t count, size_t *outLen )
+{
+    size_t size = count * 48 + 2;
+    char *out = malloc( size );
+    size_t len = 0;
+    size_t i;
+
+    for ( i = 0; i < count; ++i )
+    {
+        len += (size_t)snprintf( out + len, size - len, "%s/home/user/assets/file_%07u.png",
+                                 i ? "|" : "", (unsigned)i );
+    }
+    out[len++] = '\n';
+    out[len] = '\0';
+
+    *outLen = len;
+    return out;
+}
+
+static double ParseOnce( const char *output, size_t len, size_t expectedCount )
+{
+    nfdpathparser_t parser;
+    nfdpathset_t pathSet;
+    size_t offset, pathLen;
+    double start, elapsed;
+
+    start = Now();
+    NFDi_PathParser_Init( &parser, '|' );
+    for ( offset = 0; offset < len; offset += CHUNK_SIZE )
+    {
+        size_t chunk = len - offset < CHUNK_SIZE ? len - offset : CHUNK_SIZE;
+        NFDi_PathParser_Feed( &parser, output + offset, chunk );
+    }
+    if ( NFDi_PathParser_Finish( &parser, &pathSet ) != NFD_OKAY )
+    {
+        printf("Error: %s\n", NFD_GetError() );
+        exit(1);
+    }
+    elapsed = Now() - start;
+
+    if ( NFD_PathSet_GetCount(&pathSet) != expectedCount ||
+         strcmp( NFD_PathSet_GetPathN(&pathSet, expectedCount-1, &pathLen) +
+                 pathLen - 4, ".png" ) != 0 )
+    {
+        puts("Error: path set does not match the input.");
+        exit(1);
+    }
+
+    NFD_PathSet_Free( &pathSet );
+    return elapsed;
+}
+
+int main( void )
+{
+    const size_t counts[] = { 1000, 10000, 100000, 1000000 };
+    const size_t numCounts = sizeof(counts) / sizeof(counts[0]);
+    double nsPerPath[sizeof(counts) / sizeof(counts[0])];
+    size_t i;
+
+    puts("    paths      best ms   ns/path");
+    for ( i = 0; i < numCounts; ++i )
+    {
+        size_t len;
+        char *output = MakeZenityOutput( counts[i], &len );
+        size_t runs = 10000000 / counts[i] + 3;
+        double best = 1e9;
+        size_t run;
+
+        for ( run = 0; run < runs; ++run )
+        {
+            double elapsed = ParseOnce( output, len, counts[i] );
+            if ( elapsed < best )
+                best = elapsed;
+        }
+
+        nsPerPath[i] = best * 1e9 / (double)counts[i];
+        printf("%9u  %11.3f  %8.2f\n", (unsigned)counts[i], best * 1e3, nsPerPath[i] );
+        free( output );
+    }
+
+    if ( nsPerPath[numCounts-1] > nsPerPath[1] * MAX_RATIO )
+    {
+        printf("FAIL: per-path cost grew %.2fx from %u to %u paths\n",
+               nsPerPath[numCounts-1] / nsPerPath[1],
+               (unsigned)counts[1], (unsigned)counts[numCounts-1] );
+        return 1;
+    }
+
+    puts("OK: parse cost scales linearly");
+    return 0;
+}
@@ -0,0 +1,134 @@
+#define SIMPLE_EXEC_IMPLEMENTATION
+#include "../src/simple_exec.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+
+/* Compares the latency of launching a trivial child through
+   runCommandArray (posix_spawn), through the launcher forked at startup,
+   and with a plain fork/exec/wait, as the resident size of the parent
+   grows.  POSIX only. */
+
+#define RUNS 21
+#define MAPPINGS_PER_STEP 1000
+
+static double Now( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static int CompareDoubles( const void *a, const void *b )
+{
+    double da = *(const double*)a, db = *(const double*)b;
+    return (da > db) - (da < db);
+}
+
+static double Median( double *samples )
+{
+    qsort( samples, RUNS, sizeof(double), CompareDoubles );
+    return samples[RUNS/2];
+}
+
+static void RunCommand( char **args, int useLauncher )
+{
+    /* runCommandArray spawns directly while the launcher is hidden */
+    int launcherFd = g_launcherFd;
+    int exitCode = 0;
+
+    if ( !useLauncher )
+        g_launcherFd = -1;
+
+    if ( runCommandArray( NULL, NULL, &exitCode, 0, args ) != COMMAND_RAN_OK )
+    {
+        puts("Error: could not run true.");
+        exit(1);
+    }
+
+    g_launcherFd = launcherFd;
+}
+
+static void ForkExecWait( char **args )
+{
+    pid_t pid = fork();
+    int status;
+
+    if ( pid == 0 )
+    {
+        execvp( args[0], args );
+        _exit( 127 );
+    }
+    waitpid( pid, &status, 0 );
+}
+
+/* touch size bytes of fresh memory spread over many mappings */
+static void GrowResident( size_t size )
+{
+    size_t mappingSize = size / MAPPINGS_PER_STEP;
+    size_t i;
+
+    if ( size == 0 )
+        return;
+
+    for ( i = 0; i < MAPPINGS_PER_STEP; ++i )
+    {
+        char *p = mmap( NULL, mappingSize, PROT_READ|PROT_WRITE,
+                        MAP_PRIVATE|MAP_ANONYMOUS, -1, 0 );
+        if ( p == MAP_FAILED )
+        {
+            puts("Error: mmap failed.");
+            exit(1);
+        }
+        memset( p, 1, mappingSize );
+    }
+}
+
+int main( void )
+{
+    const size_t stepsMB[] = { 0, 64, 192, 768 };
+    char *args[] = { "true", NULL };
+    size_t residentMB = 0;
+    size_t i;
+
+    if ( runCommandLauncherStart() != 0 )
+    {
+        puts("Error: could not start the launcher.");
+        return 1;
+    }
+
+    puts("  rss MB   spawn ms  launcher ms    fork ms");
+    for ( i = 0; i < sizeof(stepsMB) / sizeof(stepsMB[0]); ++i )
+    {
+        double spawnSamples[RUNS], launcherSamples[RUNS], forkSamples[RUNS];
+        int run;
+
+        GrowResident( stepsMB[i] * 1024 * 1024 );
+        residentMB += stepsMB[i];
+
+        for ( run = 0; run < RUNS; ++run )
+        {
+            double start = Now();
+            RunCommand( args, 0 );
+            spawnSamples[run] = Now() - start;
+
+            start = Now();
+            RunCommand( args, 1 );
+            launcherSamples[run] = Now() - start;
+
+            start = Now();
+            ForkExecWait( args );
+            forkSamples[run] = Now() - start;
+        }
+
+        printf( "%8u  %9.3f  %11.3f  %9.3f\n", (unsigned)residentMB,
+                Median(spawnSamples) * 1e3, Median(launcherSamples) * 1e3,
+                Median(forkSamples) * 1e3 );
+    }
+
+    runCommandLauncherStop();
+    return 0;
+}
@@ -0,0 +1,138 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#define SIMPLE_EXEC_IMPLEMENTATION
+#include "../src/simple_exec.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+/* Spawns a child while the host holds 10k inheritable fds, checks that
+   the child only sees stdin, stdout and stderr and that the parent
+   gets all of its own fds back, and reports the spawn latency.  The
+   child is this program, re-run with --child.  Linux only. */
+
+#define NUM_FDS 10000
+#define RUNS    21
+
+static double Now( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static int CompareDoubles( const void *a, const void *b )
+{
+    double da = *(const double*)a, db = *(const double*)b;
+    return (da > db) - (da < db);
+}
+
+static int CountOpenFds( void )
+{
+    DIR *dir = opendir("/proc/self/fd");
+    struct dirent *entry;
+    int count = 0;
+
+    if ( !dir )
+        return -1;
+
+    while ( (entry = readdir(dir)) != NULL )
+    {
+        if ( entry->d_name[0] != '.' )
+            ++count;
+    }
+    closedir(dir);
+
+    /* do not count the directory fd itself */
+    return count - 1;
+}
+
+static double MedianSpawn( char **args, int *outChildFds )
+{
+    double samples[RUNS];
+    int run;
+
+    for ( run = 0; run < RUNS; ++run )
+    {
+        char *stdOut = NULL;
+        int exitCode = 0;
+        double start = Now();
+
+        if ( runCommandArray( &stdOut, NULL, &exitCode, 0, args ) != COMMAND_RAN_OK )
+        {
+            puts("Error: could not run the child.");
+            exit(1);
+        }
+        samples[run] = Now() - start;
+
+        *outChildFds = atoi( stdOut );
+        free( stdOut );
+    }
+
+    qsort( samples, RUNS, sizeof(double), CompareDoubles );
+    return samples[RUNS/2];
+}
+
+int main( int argc, char **argv )
+{
+    char *args[3];
+    struct rlimit limit;
+    int childFds, parentFds;
+    double baseline, loaded;
+    int i;
+
+    if ( argc == 2 && strcmp( argv[1], "--child" ) == 0 )
+    {
+        printf( "%d\n", CountOpenFds() );
+        return 0;
+    }
+
+    args[0] = argv[0];
+    args[1] = "--child";
+    args[2] = NULL;
+
+    baseline = MedianSpawn( args, &childFds );
+
+    getrlimit( RLIMIT_NOFILE, &limit );
+    if ( limit.rlim_cur < NUM_FDS + 64 )
+    {
+        limit.rlim_cur = NUM_FDS + 64 < limit.rlim_max ? NUM_FDS + 64 : limit.rlim_max;
+        setrlimit( RLIMIT_NOFILE, &limit );
+    }
+
+    for ( i = 0; i < NUM_FDS; ++i )
+    {
+        /* deliberately inheritable, as a careless host would leave them */
+        if ( open( "/dev/null", O_RDONLY ) == -1 )
+        {
+            printf("Error: could only open %d fds.\n", i );
+            return 1;
+        }
+    }
+
+    parentFds = CountOpenFds();
+    loaded = MedianSpawn( args, &childFds );
+
+    printf( "spawn with %5d fds: %.3f ms\n", 0, baseline * 1e3 );
+    printf( "spawn with %5d fds: %.3f ms\n", NUM_FDS, loaded * 1e3 );
+    printf( "fds seen by child:   %d\n", childFds );
+
+    if ( childFds != 3 )
+    {
+        puts("FAIL: the child inherited fds beyond stdin, stdout and stderr");
+        return 1;
+    }
+    if ( CountOpenFds() != parentFds )
+    {
+        puts("FAIL: spawning leaked fds in the parent");
+        return 1;
+    }
+
+    puts("OK: no fds leaked");
+    return 0;
+}
@@ -0,0 +1,291 @@
+#include "nfd.h"
+#include "../src/nfd_common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Checks NFDi_UTF8_Validate and NFDi_UTF8_ValidateScalar against each
+   other and against a decoder written from the code point ranges, for
+   every 1 to 3 byte sequence and every 4 byte sequence that matters,
+   each at varying offsets so that vector block boundaries are crossed,
+   with every vector validator the CPU has.  Then measures them over
+   path corpora of ASCII names, of ASCII names with an accented one
+   among them, and of mostly non-ASCII names, one path at a time as
+   dialogs validate them, and fails if a vector validator is slower
+   than the scalar one on any, or not faster on ASCII.  POSIX only. */
+
+#define PATHS      1000000
+#define RUNS       5
+#define PAD_LEN    72        /* longer than two AVX2 blocks */
+
+static double Now( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/* decodes each sequence by its lead byte, then rejects code points that
+   are overlong, surrogates or past U+10FFFF */
+static int ReferenceValidate( const unsigned char *s, size_t len, size_t *outCount )
+{
+    size_t pos = 0, count = 0;
+
+    while ( pos < len )
+    {
+        unsigned long cp, min;
+        size_t n, i;
+
+        if ( s[pos] < 0x80 )      { n = 1; cp = s[pos];        min = 0; }
+        else if ( s[pos] < 0xC0 ) { return 0; }
+        else if ( s[pos] < 0xE0 ) { n = 2; cp = s[pos] & 0x1F; min = 0x80; }
+        else if ( s[pos] < 0xF0 ) { n = 3; cp = s[pos] & 0x0F; min = 0x800; }
+        else if ( s[pos] < 0xF8 ) { n = 4; cp = s[pos] & 0x07; min = 0x10000; }
+        else                      { return 0; }
+
+        if ( pos + n > len )
+            return 0;
+        for ( i = 1; i < n; ++i )
+        {
+            if ( (s[pos + i] & 0xC0) != 0x80 )
+                return 0;
+            cp = (cp << 6) | (s[pos + i] & 0x3F);
+        }
+
+        if ( cp < min || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF) )
+            return 0;
+
+        pos += n;
+        ++count;
+    }
+
+    *outCount = count;
+    return 1;
+}
+
+static unsigned long failures = 0;
+
+static void Check( const unsigned char *s, size_t len )
+{
+    size_t refCount = 0, scalarCount = 0, count = 0;
+    int ref = ReferenceValidate( s, len, &refCount );
+    int scalar = NFDi_UTF8_ValidateScalar( (const nfdchar_t*)s, len, &scalarCount );
+    int valid = NFDi_UTF8_Validate( (const nfdchar_t*)s, len, &count );
+
+    if ( ref != scalar || ref != valid ||
+         (ref && (refCount != scalarCount || refCount != count)) )
+    {
+        if ( failures++ < 10 )
+        {
+            size_t i;
+            printf("FAIL: reference %d/%u, scalar %d/%u, vector %d/%u for",
+                   ref, (unsigned)refCount, scalar, (unsigned)scalarCount,
+                   valid, (unsigned)count );
+            for ( i = 0; i < len; ++i )
+            {
+                if ( s[i] != 'a' )
+                    printf( " %u:%02x", (unsigned)i, s[i] );
+            }
+            puts("");
+        }
+    }
+}
+
+/* places seq among ASCII padding, at an offset and total length that
+   vary with n, sometimes right at the end */
+static void CheckPlaced( const unsigned char *seq, size_t seqLen, unsigned long n )
+{
+    unsigned char buf[PAD_LEN + 4];
+    size_t len = seqLen + n % (PAD_LEN - seqLen);
+    size_t offset = (n / 7) % 3 == 0 ? len - seqLen : (n / 3) % (len - seqLen + 1);
+
+    memset( buf, 'a', len );
+    memcpy( buf + offset, seq, seqLen );
+    Check( buf, len );
+}
+
+static void CheckExhaustive( const char *isaName )
+{
+    static const unsigned char tails[] = { 0x00, 0x41, 0x7F, 0x80, 0x8F, 0x90, 0x9F, 0xA0, 0xBF, 0xC0, 0xF0, 0xFF };
+    const size_t numTails = sizeof(tails) / sizeof(tails[0]);
+    unsigned char seq[4];
+    unsigned long v, checked = 0;
+    size_t i, j;
+
+    /* every 3 byte string, which includes every 1 and 2 byte sequence
+       followed by something */
+    for ( v = 0; v < (1ul << 24); ++v )
+    {
+        seq[0] = (unsigned char)(v >> 16);
+        seq[1] = (unsigned char)(v >> 8);
+        seq[2] = (unsigned char)v;
+        CheckPlaced( seq, 3, v );
+        ++checked;
+    }
+
+    /* every lead and second byte of a 4 byte sequence, with the
+       boundary values of the last two */
+    for ( v = 0xF0 << 8; v < (1ul << 16); ++v )
+    {
+        for ( i = 0; i < numTails; ++i )
+        {
+            for ( j = 0; j < numTails; ++j )
+            {
+                seq[0] = (unsigned char)(v >> 8);
+                seq[1] = (unsigned char)v;
+                seq[2] = tails[i];
+                seq[3] = tails[j];
+                CheckPlaced( seq, 4, v * numTails * numTails + i * numTails + j );
+                ++checked;
+            }
+        }
+    }
+
+    printf( "exhaustive, %s: %lu sequences checked\n", isaName, checked );
+}
+
+/* PATHS null terminated paths back to back; outPathLens gets the
+   length of each */
+static char *MakeCorpus( const char *const *names, size_t numNames, size_t *outLen,
+                         size_t **outPathLens )
+{
+    size_t size = (size_t)PATHS * 96;
+    char *corpus = malloc( size );
+    size_t *pathLens = malloc( PATHS * sizeof(size_t) );
+    size_t len = 0;
+    size_t i;
+
+    for ( i = 0; i < PATHS; ++i )
+    {
+        pathLens[i] = (size_t)snprintf( corpus + len, size - len, "/home/user/%s/%s_%07u.dat",
+                                        names[i % numNames], names[(i / 3) % numNames], (unsigned)i );
+        len += pathLens[i] + 1;
+    }
+
+    *outLen = len;
+    *outPathLens = pathLens;
+    return corpus;
+}
+
+static double Measure( int (*validate)( const nfdchar_t*, size_t, size_t* ),
+                       const char *corpus, size_t len, const size_t *pathLens )
+{
+    double best = 1e9;
+    int run;
+
+    for ( run = 0; run < RUNS; ++run )
+    {
+        const char *path = corpus;
+        double start = Now();
+        size_t i;
+
+        for ( i = 0; i < PATHS; ++i )
+        {
+            size_t count;
+            if ( !validate( path, pathLens[i], &count ) )
+            {
+                puts("Error: corpus is not valid UTF-8.");
+                exit(1);
+            }
+            path += pathLens[i] + 1;
+        }
+        if ( Now() - start < best )
+            best = Now() - start;
+    }
+
+    return (double)len / best / 1e6;
+}
+
+static const char *const ISA_NAMES[] = { "", "scalar", "ssse3", "avx2" };
+
+int main( void )
+{
+    static const char *const asciiNames[] = { "projects", "assets", "textures", "Documents", "build" };
+    static const char *const mixedNames[] = { "projects", "assets", "caf\xc3\xa9", "Documents", "build" };
+    static const char *const otherNames[] = {
+        "\xd0\x94\xd0\xbe\xd0\xba\xd1\x83\xd0\xbc\xd0\xb5\xd0\xbd\xd1\x82\xd1\x8b",
+        "\xe5\x86\x99\xe7\x9c\x9f\xe3\x83\x95\xe3\x82\xa9\xe3\x83\xab\xe3\x83\x80",
+        "r\xc3\xa9sum\xc3\xa9s",
+        "\xf0\x9f\x8e\xb5\xf0\x9f\x8e\xb6",
+    };
+    static const char *const corpusNames[] = { "ascii", "mixed", "non-ascii" };
+    char *corpora[3];
+    size_t corpusLens[3], *pathLens[3];
+    double rates[3][NFD_UTF8_AVX2 + 1];
+    int best, isa, corpus, slower = 0;
+
+    corpora[0] = MakeCorpus( asciiNames, sizeof(asciiNames) / sizeof(asciiNames[0]), &corpusLens[0], &pathLens[0] );
+    corpora[1] = MakeCorpus( mixedNames, sizeof(mixedNames) / sizeof(mixedNames[0]), &corpusLens[1], &pathLens[1] );
+    corpora[2] = MakeCorpus( otherNames, sizeof(otherNames) / sizeof(otherNames[0]), &corpusLens[2], &pathLens[2] );
+
+    best = NFDi_UTF8_GetISA();
+    for ( isa = best; isa > NFD_UTF8_SCALAR; --isa )
+    {
+        NFDi_UTF8_SetISA( isa );
+        CheckExhaustive( ISA_NAMES[isa] );
+        if ( failures > 0 )
+        {
+            printf( "FAIL: %lu sequences disagree with %s\n", failures, ISA_NAMES[isa] );
+            return 1;
+        }
+
+        for ( corpus = 0; corpus < 3; ++corpus )
+            rates[corpus][isa] = Measure( NFDi_UTF8_Validate, corpora[corpus],
+                                          corpusLens[corpus], pathLens[corpus] );
+    }
+    NFDi_UTF8_SetISA( best );
+
+    for ( corpus = 0; corpus < 3; ++corpus )
+        rates[corpus][NFD_UTF8_SCALAR] = Measure( NFDi_UTF8_ValidateScalar, corpora[corpus],
+                                                  corpusLens[corpus], pathLens[corpus] );
+
+    puts("corpus          MB     scalar MB/s    ssse3 MB/s     avx2 MB/s");
+    for ( corpus = 0; corpus < 3; ++corpus )
+    {
+        printf( "%-9s  %7.1f  %12.0f", corpusNames[corpus], corpusLens[corpus] / 1e6,
+                rates[corpus][NFD_UTF8_SCALAR] );
+        for ( isa = NFD_UTF8_SSSE3; isa <= NFD_UTF8_AVX2; ++isa )
+        {
+            if ( isa <= best )
+                printf( "  %12.0f", rates[corpus][isa] );
+            else
+                printf( "  %12s", "-" );
+        }
+        puts("");
+
+        free( corpora[corpus] );
+        free( pathLens[corpus] );
+    }
+
+    if ( best == NFD_UTF8_SCALAR )
+    {
+        puts("OK: validators agree; this CPU has no vector validator");
+        return 0;
+    }
+
+    for ( isa = NFD_UTF8_SSSE3; isa <= best; ++isa )
+    {
+        if ( rates[0][isa] <= rates[0][NFD_UTF8_SCALAR] )
+        {
+            printf( "FAIL: %s validation is not faster on ASCII paths\n", ISA_NAMES[isa] );
+            slower = 1;
+        }
+        for ( corpus = 1; corpus < 3; ++corpus )
+        {
+            if ( rates[corpus][isa] < rates[corpus][NFD_UTF8_SCALAR] )
+            {
+                printf( "FAIL: %s validation is slower on %s paths\n", ISA_NAMES[isa],
+                        corpusNames[corpus] );
+                slower = 1;
+            }
+        }
+    }
+
+    if ( slower )
+        return 1;
+
+    puts("OK: validators agree and the vector paths are never slower");
+    return 0;
+}
@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Stands in for zenity in bench_nfd: answers --file-selection at once,
+   with --multiple, --save or --directory, and never opens a window.
+   Paths are made up under the default folder, and a folder whose last
+   component is a number asks for that many paths from --multiple:
+
+     zenity --file-selection --multiple --filename=/nfd-bench/3/
+     /nfd-bench/3/file0000000.png|/nfd-bench/3/file0000001.png|...
+
+   A folder named wait keeps the dialog open, printing nothing, until
+   zenity is killed, for bench_cancel.  Without --filename, paths are
+   under /nfd-bench/1/.  Installed as build/bin/fake_zenity/zenity so
+   that a PATH lookup finds it.  POSIX only. */
+
+#define OUT_BUF_SIZE (64 * 1024)
+
+static char outBuf[OUT_BUF_SIZE];
+static size_t outUsed = 0;
+
+static void Flush( void )
+{
+    size_t done = 0;
+
+    while ( done < outUsed )
+    {
+        ssize_t written = write( STDOUT_FILENO, outBuf + done, outUsed - done );
+        if ( written <= 0 )
+            exit( 2 );
+        done += (size_t)written;
+    }
+    outUsed = 0;
+}
+
+static void Emit( const char *str, size_t len )
+{
+    if ( outUsed + len > OUT_BUF_SIZE )
+        Flush();
+    memcpy( outBuf + outUsed, str, len );
+    outUsed += len;
+}
+
+int main( int argc, char **argv )
+{
+    const char *folder = "/nfd-bench/1/";
+    int selection = 0, multiple = 0, save = 0, directory = 0;
+    size_t folderLen, count = 1, i;
+    const char *last;
+    char path[4096];
+    int n;
+
+    for ( n = 1; n < argc; ++n )
+    {
+        if ( strcmp( argv[n], "--file-selection" ) == 0 )
+            selection = 1;
+        else if ( strcmp( argv[n], "--multiple" ) == 0 )
+            multiple = 1;
+        else if ( strcmp( argv[n], "--save" ) == 0 )
+            save = 1;
+        else if ( strcmp( argv[n], "--directory" ) == 0 )
+            directory = 1;
+        else if ( strncmp( argv[n], "--filename=", 11 ) == 0 )
+            folder = argv[n] + 11;
+    }
+
+    if ( !selection )
+    {
+        fputs( "fake zenity: only --file-selection is supported\n", stderr );
+        return 255;
+    }
+
+    /* the folder without its trailing slashes, and its count */
+    folderLen = strlen( folder );
+    while ( folderLen > 1 && folder[folderLen - 1] == '/' )
+        --folderLen;
+    if ( folderLen >= sizeof(path) - 32 )
+        return 2;
+    for ( last = folder + folderLen; last > folder && last[-1] != '/'; --last )
+        ;
+    if ( multiple && last < folder + folderLen && *last >= '0' && *last <= '9' )
+        count = strtoul( last, NULL, 10 );
+
+    if ( (size_t)(folder + folderLen - last) == 4 && strncmp( last, "wait", 4 ) == 0 )
+    {
+        for ( ;; )
+            pause();
+    }
+
+    if ( directory )
+    {
+        Emit( folder, folderLen );
+        Emit( "\n", 1 );
+        Flush();
+        return 0;
+    }
+
+    for ( i = 0; i < count; ++i )
+    {
+        int len = snprintf( path, sizeof(path), "%s%.*s/file%07lu.%s",
+                            i ? "|" : "", (int)folderLen, folder,
+                            (unsigned long)i, save ? "txt" : "png" );
+        Emit( path, (size_t)len );
+    }
+    Emit( "\n", 1 );
+    Flush();
+
+    return 0;
+}
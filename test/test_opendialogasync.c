@@ -0,0 +1,50 @@
+#include "nfd.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <poll.h>
+
+
+/* this test only compiles with the zenity backend */
+
+int main( void )
+{
+    nfdhandle_t *handle;
+    nfdchar_t *outPath = NULL;
+    int ticks = 0;
+    nfdresult_t result = NFD_OpenDialogAsync( "png,jpg;pdf", NULL, &handle );
+    if ( result != NFD_OKAY )
+    {
+        printf("Error: %s\n", NFD_GetError() );
+        return 0;
+    }
+
+    /* stand-in for the host's event loop */
+    while ( !NFD_Handle_Poll(handle) )
+    {
+        struct pollfd pfd;
+        pfd.fd = NFD_Handle_GetFd(handle);
+        pfd.events = POLLIN;
+        if ( poll( &pfd, 1, 100 ) == 0 )
+            ++ticks;
+    }
+    printf("Main loop ticked %d times while the dialog was open.\n", ticks );
+
+    result = NFD_Handle_Finish( handle, &outPath );
+    if ( result == NFD_OKAY )
+    {
+        puts("Success!");
+        puts(outPath);
+        free(outPath);
+    }
+    else if ( result == NFD_CANCEL )
+    {
+        puts("User pressed cancel.");
+    }
+    else 
+    {
+        printf("Error: %s\n", NFD_GetError() );
+    }
+
+    return 0;
+}
@@ -0,0 +1,61 @@
+#include "nfd.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+
+/* this test should compile on all supported platforms */
+
+/* Writes each phase as a complete event in Chrome's trace event format.
+   Open nfd_trace.json in chrome://tracing or ui.perfetto.dev.  Phases
+   can arrive from a second thread after NFD_InitAsync on GTK; a hook
+   used that way needs a lock around the file. */
+static void WriteTraceEvent( nfdphase_t phase, uint64_t startNs, uint64_t endNs, void *userData )
+{
+    FILE *file = (FILE*)userData;
+    static int first = 1;
+
+    fprintf( file, "%s\n{\"name\":\"%s\",\"cat\":\"nfd\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":1}",
+             first ? "" : ",", NFD_GetPhaseName( phase ),
+             (double)startNs / 1000.0, (double)(endNs - startNs) / 1000.0 );
+    first = 0;
+}
+
+int main( void )
+{
+    nfdchar_t *outPath = NULL;
+    nfdresult_t result;
+    FILE *file = fopen( "nfd_trace.json", "w" );
+
+    if ( !file )
+    {
+        perror("nfd_trace.json");
+        return 1;
+    }
+
+    fputs( "{\"traceEvents\":[", file );
+    NFD_SetTraceHook( WriteTraceEvent, file );
+
+    result = NFD_OpenDialog( "png,jpg;pdf", NULL, &outPath );
+    if ( result == NFD_OKAY )
+    {
+        puts("Success!");
+        puts(outPath);
+        free(outPath);
+    }
+    else if ( result == NFD_CANCEL )
+    {
+        puts("User pressed cancel.");
+    }
+    else
+    {
+        printf("Error: %s\n", NFD_GetError() );
+    }
+
+    NFD_SetTraceHook( NULL, NULL );
+    fputs( "\n]}\n", file );
+    fclose( file );
+
+    puts("Wrote nfd_trace.json");
+    return 0;
+}